@@ -3,6 +3,8 @@ LOCAL_PATH := $(call my-dir)
 include $(LOCAL_PATH)/config.mk
 
 L_CFLAGS := -g -Wall
+# constexpr lookup tables in common.cpp
+L_CPPFLAGS := -std=gnu++0x
 
 #
 # Process config
@@ -28,14 +30,18 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     common.cpp \
+    scratch.cpp \
+    stats.cpp \
+    trace.cpp \
     aps_wrapper.cpp \
     audio_policy.cpp
 
 LOCAL_SHARED_LIBRARIES := \
-    libhardware liblog libutils
+    libhardware libcutils liblog libutils
 LOCAL_STATIC_LIBRARIES := libmedia_helper
 
 LOCAL_CFLAGS := $(L_CFLAGS)
+LOCAL_CPPFLAGS := $(L_CPPFLAGS)
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_MODULE := audio_policy.$(TARGET_BOARD_PLATFORM)
@@ -53,13 +59,21 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     common.cpp \
+    param_cache.cpp \
+    pcm.cpp \
+    resampler.cpp \
+    ring.cpp \
+    scratch.cpp \
+    stats.cpp \
+    trace.cpp \
     audio_hw.cpp
 
 LOCAL_SHARED_LIBRARIES := \
-    libhardware liblog libutils
+    libhardware libcutils liblog libutils
 LOCAL_STATIC_LIBRARIES := libmedia_helper
 
 LOCAL_CFLAGS := $(L_CFLAGS)
+LOCAL_CPPFLAGS := $(L_CPPFLAGS)
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_MODULE := audio.primary.$(TARGET_BOARD_PLATFORM)
@@ -68,3 +82,10 @@ LOCAL_MODULE_TAGS := optional
 include $(BUILD_SHARED_LIBRARY)
 #include $(BUILD_HEAPTRACKED_SHARED_LIBRARY)
 endif
+
+#
+# Host mock HALs and benchmarks
+#
+ifeq ($(BUILD_AUDIO_WRAPPER_HOST_TOOLS), true)
+include $(LOCAL_PATH)/host/Android.mk
+endif
@@ -15,27 +15,32 @@
  */
 
 #define LOG_TAG "AudioPolicyServiceWrapper"
-// Set to 1 to strip verbose logging messages
-#define LOG_NDEBUG 0
+//#define LOG_NDEBUG 0
 
 #include <cutils/log.h>
 
 #include "aps_wrapper.h"
 #include "common.h"
+#include "scratch.h"
+#include "trace.h"
 
 struct aps_wrapper_service {
     void * wrapped_service;
     struct audio_policy_service_ops * wrapped_aps_ops;
     struct wrapper::audio_policy_service_ops aps_ops;
+    // set_parameters() calls with a routing key
+    uint32_t routing_changes;
 };
 
 /**
  * Calls a function of the wrapped service.
  */
 #define WRAPPED_CALL(service, func, ...) ({\
-    ALOGV("%s", __FUNCTION__); \
+    WLOGV(WRAPPER_LOG_SERVICE, "%s", __FUNCTION__); \
+    TRACE_SCOPE(TRACE_aps_##func, service); \
     aps_wrapper_service_t * __wrapped_aps = (aps_wrapper_service_t*) service; \
-    return __wrapped_aps->wrapped_aps_ops->func(__wrapped_aps->wrapped_service, ##__VA_ARGS__); \
+    return TRACE_RETURN(__wrapped_aps->wrapped_aps_ops->func(__wrapped_aps->wrapped_service, \
+                                                             ##__VA_ARGS__)); \
 })
 
 #if WRAPPED_AUDIO_POLICY_VERSION >= ANDROID_VERSION(4, 1)
@@ -161,35 +166,40 @@ static int aps_move_effects(void *service, int session,
 static char * aps_get_parameters(void *service, audio_io_handle_t io_handle,
                                  const char *keys)
 {
-    ALOGI("%s: io_handle: %d, keys: %s", __FUNCTION__, io_handle, keys);
+    WLOGI(WRAPPER_LOG_SERVICE, "%s: io_handle: %d, keys: %s", __FUNCTION__, io_handle, keys);
+    TRACE_SCOPE(TRACE_aps_get_parameters, service);
     aps_wrapper_service_t * waps = (aps_wrapper_service_t*) service;
     char * kv_pairs;
-    char * fixed_kv_pairs;
 
     kv_pairs = waps->wrapped_aps_ops->get_parameters(waps->wrapped_service, io_handle,
                                                      keys);
-    fixed_kv_pairs = fixup_audio_parameters(kv_pairs, JB_TO_ICS);
-    free(kv_pairs);
-    return fixed_kv_pairs;
+    return fixup_returned_audio_parameters(kv_pairs, JB_TO_ICS);
 }
 
 static void aps_set_parameters(void *service, audio_io_handle_t io_handle,
                                const char *kv_pairs, int delay_ms)
 {
-    ALOGI("%s: io_handle: %d, kv_pairs: %s", __FUNCTION__, io_handle, kv_pairs);
+    WLOGI(WRAPPER_LOG_SERVICE, "%s: io_handle: %d, kv_pairs: %s", __FUNCTION__, io_handle, kv_pairs);
+    TRACE_SCOPE(TRACE_aps_set_parameters, service);
+    SCRATCH_SCOPE();
     aps_wrapper_service_t * waps = (aps_wrapper_service_t*) service;
-
-    char * fixed_kv_pairs = fixup_audio_parameters(kv_pairs, ICS_TO_JB);
+    const char * fixed_kv_pairs = fixup_audio_parameters_scratch(kv_pairs, ICS_TO_JB);
+
+    if (!fixed_kv_pairs) {
+        ALOGE("%s: out of memory, dropping %s", __FUNCTION__, kv_pairs);
+        return;
+    }
+    if (has_audio_parameter(kv_pairs, android::AudioParameter::keyRouting))
+        __atomic_fetch_add(&waps->routing_changes, 1, __ATOMIC_RELAXED);
     waps->wrapped_aps_ops->set_parameters(waps->wrapped_service, io_handle,
                                           fixed_kv_pairs, delay_ms);
-    free(fixed_kv_pairs);
 }
 
 static int aps_set_stream_volume(void *service, audio_stream_type_t stream,
                                  float volume, audio_io_handle_t output,
                                  int delay_ms)
 {
-    ALOGI("%s: stream: %d, volume: %f, output: %d, delay_ms: %d",
+    WLOGI(WRAPPER_LOG_SERVICE, "%s: stream: %d, volume: %f, output: %d, delay_ms: %d",
           __FUNCTION__, stream, volume, output, delay_ms);
     WRAPPED_CALL(service, set_stream_volume, stream, volume, output, delay_ms);
 }
@@ -207,7 +217,7 @@ static int aps_stop_tone(void *service)
 
 static int aps_set_voice_volume(void *service, float volume, int delay_ms)
 {
-    ALOGI("%s: volume: %f, delay_ms: %d", __FUNCTION__, volume, delay_ms);
+    WLOGI(WRAPPER_LOG_SERVICE, "%s: volume: %f, delay_ms: %d", __FUNCTION__, volume, delay_ms);
     WRAPPED_CALL(service, set_voice_volume, volume, delay_ms);
 }
 
@@ -228,6 +238,7 @@ int aps_wrapper_create(void *wrapped_service,
 
     waps->wrapped_service = wrapped_service;
     waps->wrapped_aps_ops = wrapped_aps_ops;
+    waps->routing_changes = 0;
 
     waps->aps_ops.open_output = aps_open_output;
     waps->aps_ops.open_duplicate_output = aps_open_dup_output;
@@ -261,3 +272,9 @@ void aps_wrapper_destroy(void * wrapped_service)
     free(wrapped_service);
 }
 
+uint32_t aps_wrapper_routing_changes(void * wrapper_service)
+{
+    aps_wrapper_service_t * waps = (aps_wrapper_service_t *) wrapper_service;
+
+    return __atomic_load_n(&waps->routing_changes, __ATOMIC_RELAXED);
+}
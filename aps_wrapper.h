@@ -30,3 +30,9 @@ int aps_wrapper_create(void *service, struct audio_policy_service_ops * aps_ops,
                        struct wrapper::audio_policy_service_ops ** wrapped_aps_ops);
 
 void aps_wrapper_destroy(void * wrapper_service);
+
+/**
+ * Returns the number of routing changes the vendor policy sent through
+ * set_parameters() so far.
+ */
+uint32_t aps_wrapper_routing_changes(void * wrapper_service);
@@ -20,30 +20,424 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
+#include <sys/resource.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include "common.h"
+#include "param_cache.h"
+#include "pcm.h"
+#include "resampler.h"
+#include "ring.h"
+#include "scratch.h"
+#include "stats.h"
+#include "trace.h"
 #include "include/4.0/hardware/audio.h"
 
+/**
+ * Last routing a blob stream or the blob device accepted. A routing key that
+ * sets the same devices again is removed before forwarding, HTC blobs
+ * reprogram the codec path (and pop) even if nothing changed. lock is held
+ * from routing_filter() to routing_done(), across the blob call. Legacy blobs
+ * route globally, so every forwarded routing change moves the device's
+ * routing_epoch and the other streams forward their next one.
+ */
+struct routing_state {
+    pthread_mutex_t lock;
+    bool known;
+    // ICS devices, valid if known
+    uint32_t devices;
+    // routing_epoch of the device after devices were set
+    uint32_t epoch;
+    // Devices of the call in progress
+    uint32_t pending;
+    uint32_t forwarded;
+    uint32_t dropped;
+};
+
 struct wrapper_audio_device {
     struct audio_hw_device device;
     struct wrapper::audio_hw_device *wrapped_device;
+    float master_volume;
+    bool master_mute;
+    // The blob accepted set_master_volume() and applies the volume itself
+    bool hw_master_volume;
+    // Gain the output streams apply in out_write(), see update_master_gain()
+    float master_gain;
+    // Period of deep buffer outputs in vendor buffers, 0 disables them
+    int deep_buffer_periods;
+    // Ring of async outputs in vendor buffers, 0 disables them
+    int async_write_periods;
+    // Periods per vendor buffer of fast outputs, 0 disables them
+    int fast_output_split;
+    int async_write_priority;
+    // Ring of prefetching inputs in vendor buffers, 0 disables it
+    int capture_prefetch_periods;
+    // Attach inputs the blob refuses to open to an open vendor input
+    bool shared_capture;
+    // Open vendor inputs. Opening and closing inputs is serialized by
+    // AudioFlinger.
+    struct capture_source *capture_sources;
+    // Dither when converting 32 and 8.24 bit output to 16 bit
+    bool dither;
+    // Preset for outputs opened at a rate the blob doesn't take
+    enum resampler_quality resampler_quality;
+    // Time outputs keep the blob running after out_standby(), 0 forwards it
+    // at once. The standby thread puts the outputs in delayed_outputs into
+    // standby when their delay passed.
+    int standby_delay_ms;
+    struct wrapper_stream_out *delayed_outputs;
+    pthread_t standby_thread;
+    pthread_mutex_t standby_lock;
+    pthread_cond_t standby_cond;
+    bool standby_exit;
+    // Answers of adev_get_parameters(), the streams have their own
+    bool param_cache;
+    struct param_cache parameters;
+    // Changed with every forwarded routing change and when the blob may have
+    // rerouted on its own, see routing_state
+    uint32_t routing_epoch;
+    struct routing_state routing;
+};
+
+enum stream_standby_state {
+    STREAM_ACTIVE,
+    // out_standby() was called, the blob keeps running until the delay passed
+    STREAM_STANDBY_PENDING,
+    STREAM_STANDBY,
+};
+
+/**
+ * Stream attributes that only change when the stream is reconfigured. latency
+ * is only used for output streams. sample_rate differs from blob_sample_rate
+ * if the wrapper resamples.
+ */
+struct stream_attributes {
+    uint32_t sample_rate;
+    uint32_t blob_sample_rate;
+    uint32_t channels;
+    uint32_t format;
+    uint32_t latency;
+    size_t buffer_size;
+};
+
+/**
+ * Attributes served to the getters. They are read from the blob again under
+ * lock when generation moved past valid_generation and published with the
+ * seqlock seq, so readers never see a half refreshed set.
+ */
+struct attributes_cache {
+    pthread_mutex_t lock;
+    uint32_t seq;
+    uint32_t generation;
+    uint32_t valid_generation;
+    struct stream_attributes values;
+};
+
+#ifndef ICS_AUDIO_BLOB
+/**
+ * Presentation clock of an output stream, used to emulate
+ * get_next_write_timestamp() for blobs that don't have it. Only touched by the
+ * playback thread, other threads request a restart through reset.
+ */
+struct write_clock {
+    int64_t start_ns;
+    uint64_t frames;
+    uint32_t sample_rate;
+    uint32_t frame_size;
+    int64_t latency_ns;
+    int32_t reset;
+};
+#endif
+
+/**
+ * Decouples out_write() from the blob. out_write() copies into ring and the
+ * feeder thread writes it to the blob, period bytes at a time. The ring is
+ * lock-free, lock and cond are only used to sleep when the ring is full
+ * (out_write) or empty (feeder). blob_lock is held by the feeder around its
+ * vendor writes so out_standby() can stop the blob in between.
+ *
+ * Deep buffer outputs keep the ring full and are paced by the blob. Async
+ * outputs (paced) keep it filled to target and pace out_write() by the sample
+ * rate instead, so a blob stall shorter than the data above target never
+ * reaches AudioFlinger.
+ *
+ * Fast outputs report fast_period, a fraction of a blob buffer, so AudioFlinger
+ * runs its FastMixer, and are paced like async outputs. The feeder collects
+ * whole blob buffers before it writes, so the fill goes up to a blob buffer
+ * and back with every feeder write and out_write() only returns early while
+ * the feeder waits for data.
+ */
+struct out_feeder {
+    struct byte_ring ring;
+    size_t period;
+    // Buffer size of fast outputs, 0 for the others
+    size_t fast_period;
+    char *buffer;
+    // Steady state fill level, reported as additional latency
+    size_t target;
+    bool paced;
+    // SCHED_FIFO priority of the feeder thread, 0 for SCHED_OTHER
+    int priority;
+    // Nominal return time of the last out_write(), playback thread only
+    int64_t pace_ns;
+    // Latency of the blob itself and the frames the feeder handed to it
+    uint32_t blob_latency;
+    uint64_t frames_written;
+    // Frames taken from the ring that the blob failed to accept
+    uint64_t frames_dropped;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_mutex_t blob_lock;
+    int32_t producer_waiting;
+    int32_t consumer_waiting;
+    bool exit;
+};
+
+/**
+ * Decouples the blob's capture from in_read(). The prefetch thread reads one
+ * blob buffer (period) after the other into ring and in_read() copies out of
+ * it, so the blob is read on time even if the record thread is descheduled.
+ * A buffer that doesn't fit is dropped and counted as lost. The thread only
+ * runs from the first in_read() to in_standby(), the blob stays idle in
+ * standby.
+ */
+struct in_prefetch {
+    struct byte_ring ring;
+    size_t period;
+    size_t frame_size;
+    // Rate of the blob input, updated under lock by capture_source_refresh()
+    uint32_t sample_rate;
+    char *buffer;
+    // SCHED_FIFO priority of the prefetch thread, 0 for SCHED_OTHER
+    int priority;
+    // Written by the prefetch thread. frames_lost is returned and cleared by
+    // in_get_input_frames_lost(), the others are kept for in_dump().
+    uint32_t frames_lost;
+    uint64_t frames_lost_total;
+    uint32_t overruns;
+    uint32_t high_water;
+    // Error of the last failed blob read, returned by the next in_read()
+    int32_t error;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int32_t consumer_waiting;
+    bool running;
+    bool exit;
+};
+
+/**
+ * A vendor input and the wrapper inputs (clients) reading from it. ICS blobs
+ * usually open one input only, so further inputs on the same device attach to
+ * the open one. A single client reads the blob straight into its buffer. With
+ * more clients the one that runs out of data reads the next blob buffer into
+ * ring for all of them and each copies out at its own cursor. A client that
+ * falls behind by more than the ring loses the oldest frames.
+ *
+ * lock protects the client list, the counters and the ring. reading is set
+ * while a client reads the blob with lock released, the others wait on cond.
+ */
+struct capture_source {
+    struct wrapper_audio_device *dev;
+    struct wrapper::audio_stream_in *wrapped_stream;
+    uint32_t devices;
+    // Blob attributes, see capture_source_refresh()
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t format;
+    size_t frame_size;
+    size_t buffer_size;
+    // Only with capture prefetch
+    struct in_prefetch *prefetch;
+    struct wrapper_stream_in *clients;
+    unsigned client_count;
+    // Clients that are not in standby, the blob is put into standby at 0
+    unsigned active;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool reading;
+    // Allocated when the second client attaches. write_pos counts the bytes
+    // that went through ring.
+    char *ring;
+    size_t ring_size;
+    char *buffer;
+    size_t buffer_bytes;
+    uint64_t write_pos;
+    // The blob input is in standby
+    bool standby;
+    // Answers of the blob input's get_parameters(), shared by the clients
+    struct param_cache parameters;
+    struct routing_state routing;
+    struct capture_source *next;
 };
 
 struct wrapper_stream_out {
     struct audio_stream_out stream;
     struct wrapper::audio_stream_out *wrapped_stream;
+    struct wrapper_audio_device *dev;
+    struct attributes_cache attributes;
+    struct stream_stats write_stats;
+    struct glitch_stats glitch_stats;
+    // enum stream_standby_state, only changed with standby_lock held. Only
+    // the playback thread leaves STREAM_ACTIVE, so it reads it without.
+    int32_t standby_state;
+    int64_t standby_deadline_ns;
+    pthread_mutex_t standby_lock;
+    struct standby_stats standby_stats;
+    struct wrapper_stream_out *next_delayed;
+    struct param_cache parameters;
+    struct routing_state routing;
+    // Master gain applied to the last write, the next write ramps from here
+    float gain;
+    int16_t *gain_buffer;
+    size_t gain_buffer_size;
+    // Format AudioFlinger writes if out_write() converts it to 16 bit for the
+    // blob, AUDIO_FORMAT_DEFAULT otherwise
+    audio_format_t format;
+    int16_t *convert_buffer;
+    size_t convert_buffer_size;
+    struct pcm_dither dither;
+    // Rate AudioFlinger writes at if out_write() resamples it for the blob,
+    // 0 otherwise
+    uint32_t sample_rate;
+    struct resampler *resampler;
+    int16_t *resample_buffer;
+    size_t resample_buffer_size;
+#ifndef ICS_AUDIO_BLOB
+    struct write_clock clock;
+#endif
+    // Only for deep buffer and async outputs
+    struct out_feeder *feeder;
 };
 
 struct wrapper_stream_in {
     struct audio_stream_in stream;
     struct wrapper::audio_stream_in *wrapped_stream;
+    struct attributes_cache attributes;
+    struct stream_stats read_stats;
+    struct standby_stats standby_stats;
+    // Rate AudioFlinger reads at if in_read() resamples the blob's capture,
+    // 0 otherwise. Frames resampled but not read yet are kept in
+    // resample_buffer from resample_offset on.
+    uint32_t sample_rate;
+    struct resampler *resampler;
+    int16_t *read_buffer;
+    size_t read_buffer_size;
+    int16_t *resample_buffer;
+    size_t resample_buffer_size;
+    size_t resample_offset;
+    size_t resample_frames;
+    // The vendor input, shared with other inputs if they attached to it
+    struct capture_source *source;
+    struct wrapper_stream_in *next;
+    bool active;
+    // Position in the source's ring and the frames this input missed in it
+    uint64_t cursor;
+    uint32_t frames_lost;
+    // Channel mask the client reads if it differs from the source's (mono
+    // and stereo only), 0 otherwise
+    uint32_t channels;
+    int16_t *convert_buffer;
+    size_t convert_buffer_size;
 };
 
 
+/**
+ * Length of the period of deep buffer outputs in blob buffers, 0 (the default)
+ * turns the emulation off. Either way a deep buffer output is an output stream
+ * of its own on the blob, so it only opens on blobs that allow more than one
+ * output at a time.
+ */
+#define DEEP_BUFFER_PROPERTY "persist.audiowrap.deep_buffer"
+
+/**
+ * Length of the ring of async outputs in blob buffers, 0 turns them off. Half
+ * of it is kept filled to ride out blob stalls. The feeder threads run with
+ * the SCHED_FIFO priority from ASYNC_WRITE_PRIORITY_PROPERTY, 0 keeps them at
+ * SCHED_OTHER.
+ */
+#define ASYNC_WRITE_PROPERTY "persist.audiowrap.async_write"
+#define ASYNC_WRITE_PRIORITY_PROPERTY "persist.audiowrap.async_priority"
+
+/**
+ * Wrapper-private stream parameter that turns async writes on (number of blob
+ * buffers in the ring) or off (0) for one output. It is not forwarded.
+ */
+#define ASYNC_WRITE_KEY "audiowrap_async_write"
+
+/**
+ * Length of the capture prefetch ring in blob buffers. 0 (default) reads the
+ * blob from in_read(), otherwise a thread with the priority of
+ * ASYNC_WRITE_PRIORITY_PROPERTY reads it ahead into the ring.
+ */
+#define CAPTURE_PREFETCH_PROPERTY "persist.audiowrap.capture_prefetch"
+
+/**
+ * Number of periods a blob buffer is split into for outputs opened with
+ * AUDIO_OUTPUT_FLAG_FAST. 0 (default) opens them like any other output,
+ * otherwise they report the short period and are fed to the blob by a feeder
+ * thread with the priority of ASYNC_WRITE_PRIORITY_PROPERTY. The
+ * wrapper-private stream parameter FAST_OUTPUT_KEY switches one output, but
+ * AudioFlinger only reads the buffer size when it opens the output.
+ */
+#define FAST_OUTPUT_PROPERTY "persist.audiowrap.fast_output"
+#define FAST_OUTPUT_KEY "audiowrap_fast_output"
+
+/**
+ * Time in ms outputs keep the blob running after out_standby(). A write
+ * within the delay resumes without waking the codec. 0 (default) forwards
+ * standby at once. Redundant standby calls are never forwarded.
+ */
+#define STANDBY_DELAY_PROPERTY "persist.audiowrap.standby_delay"
+
+/**
+ * Set to 0 to always ask the blob in get_parameters() instead of answering
+ * repeated queries for the supported formats, channels and rates from a
+ * cache. On by default.
+ */
+#define PARAM_CACHE_PROPERTY "persist.audiowrap.param_cache"
+
+/**
+ * Set to 0 to fail opening an input the blob refuses instead of attaching it
+ * to an open vendor input on the same device. On by default.
+ */
+#define SHARED_CAPTURE_PROPERTY "persist.audiowrap.shared_capture"
+
+/**
+ * Length of the ring shared by the inputs of a capture source in blob
+ * buffers.
+ */
+#define CAPTURE_SOURCE_RING_BUFFERS 4
+
+/**
+ * Set to 1 to add TPDF dither when 32 and 8.24 bit output is converted to 16
+ * bit for the blob. Off by default.
+ */
+#define DITHER_PROPERTY "persist.audiowrap.dither"
+
+/**
+ * Resampler preset (off, low, medium or high) for streams opened at a rate
+ * the blob rejects or replaces. The blob is opened at its own rate and
+ * out_write() or in_read() resamples. Off by default, the wrapper-private
+ * stream parameter RESAMPLER_KEY changes the preset of one output.
+ */
+#define RESAMPLER_PROPERTY "persist.audiowrap.resampler"
+#define RESAMPLER_KEY "audiowrap_resampler"
+
+/**
+ * Wrapper-private key for out_get_parameters() that returns the glitch
+ * counters of the output, see struct glitch_stats. It is not forwarded.
+ */
+#define GLITCH_STATS_KEY "audiowrap_glitches"
+
 /**
  * device macros.
  */
@@ -54,208 +448,2199 @@ struct wrapper_stream_in {
 })
 
 #define RETURN_WRAPPED_DEVICE_CALL(d, func, ...) ({\
-    ALOGV("%s", __FUNCTION__); \
-    return WRAPPED_DEVICE(d)->func(WRAPPED_DEVICE(d), ##__VA_ARGS__); \
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__); \
+    TRACE_SCOPE(TRACE_adev_##func, d); \
+    return TRACE_RETURN(WRAPPED_DEVICE(d)->func(WRAPPED_DEVICE(d), ##__VA_ARGS__)); \
+})
+
+/**
+ * Stream in macros.
+ */
+#define WRAPPED_STREAM_IN(p) (((struct wrapper_stream_in*) p)->wrapped_stream)
+#define WRAPPED_STREAM_IN_COMMON(s) (WRAPPED_STREAM_IN(s)->common)
+#define WRAPPED_STREAM_IN_COMMON_CALL(s, func, ...) ({\
+    WRAPPED_STREAM_IN_COMMON(s).func(&WRAPPED_STREAM_IN_COMMON(s), ##__VA_ARGS__); \
+})
+#define RETURN_WRAPPED_STREAM_IN_CALL(s, func, ...) ({\
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__); \
+    TRACE_SCOPE(TRACE_in_##func, s); \
+    return TRACE_RETURN(WRAPPED_STREAM_IN(s)->func(WRAPPED_STREAM_IN(s), ##__VA_ARGS__)); \
+})
+#define RETURN_WRAPPED_STREAM_IN_COMMON_CALL(s, func, ...) ({\
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__); \
+    TRACE_SCOPE(TRACE_in_##func, s); \
+    return TRACE_RETURN(WRAPPED_STREAM_IN_COMMON(s).func(&WRAPPED_STREAM_IN_COMMON(s), ##__VA_ARGS__)); \
+})
+
+
+/**
+ * Stream out macros.
+ */
+#define WRAPPED_STREAM_OUT(p) (((struct wrapper_stream_out*) p)->wrapped_stream)
+#define WRAPPED_STREAM_OUT_COMMON(s) (WRAPPED_STREAM_OUT(s)->common)
+#define WRAPPED_STREAM_OUT_COMMON_CALL(s, func, ...) ({\
+    WRAPPED_STREAM_OUT_COMMON(s).func(&WRAPPED_STREAM_OUT_COMMON(s), ##__VA_ARGS__); \
+})
+#define RETURN_WRAPPED_STREAM_OUT_CALL(s, func, ...) ({\
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__); \
+    TRACE_SCOPE(TRACE_out_##func, s); \
+    return TRACE_RETURN(WRAPPED_STREAM_OUT(s)->func(WRAPPED_STREAM_OUT(s), ##__VA_ARGS__)); \
+})
+#define RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(s, func, ...) ({\
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__); \
+    TRACE_SCOPE(TRACE_out_##func, s); \
+    return TRACE_RETURN(WRAPPED_STREAM_OUT_COMMON(s).func(&WRAPPED_STREAM_OUT_COMMON(s), ##__VA_ARGS__)); \
 })
 
 /**
- * Stream in macros.
+ * Returns true if setting kvpairs may change the cached stream attributes.
+ */
+static bool changes_stream_attributes(const char *kvpairs)
+{
+    static const char * const keys[] = {
+        android::AudioParameter::keyRouting,
+        android::AudioParameter::keySamplingRate,
+        android::AudioParameter::keyFormat,
+        android::AudioParameter::keyChannels,
+        android::AudioParameter::keyFrameCount,
+    };
+
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (has_audio_parameter(kvpairs, keys[i]))
+            return true;
+    }
+    return false;
+}
+
+#ifndef ICS_AUDIO_BLOB
+/**
+ * Keys AudioFlinger asks every new stream for. The answers only change with
+ * the stream's configuration, so they are cached when the stream is opened.
+ */
+static const char * const static_stream_keys[] = {
+    AUDIO_PARAMETER_STREAM_SUP_FORMATS,
+    AUDIO_PARAMETER_STREAM_SUP_CHANNELS,
+    AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES,
+};
+#endif
+
+static void routing_init(struct routing_state *state)
+{
+    memset(state, 0, sizeof(*state));
+    pthread_mutex_init(&state->lock, NULL);
+}
+
+/**
+ * Starts a set_parameters() call. Returns kvpairs or, if it routes to the
+ * devices the blob already uses, the other pairs of it in scratch memory.
+ * Returns NULL if out of memory. *routes is set if the call changes the
+ * routing. Has to be followed by routing_done() in any case.
+ */
+static const char * routing_filter(struct routing_state *state, const uint32_t *epoch,
+                                   const char *kvpairs, bool *routes)
+{
+    int value;
+
+    *routes = false;
+    pthread_mutex_lock(&state->lock);
+    if (!get_audio_parameter_int(kvpairs, android::AudioParameter::keyRouting, &value))
+        return kvpairs;
+
+    state->pending = lookup_audio_devices((uint32_t) value, JB_TO_ICS);
+    if (!state->known || state->epoch != __atomic_load_n(epoch, __ATOMIC_ACQUIRE) ||
+            state->devices != state->pending) {
+        *routes = true;
+        return kvpairs;
+    }
+
+    kvpairs = remove_audio_parameter(kvpairs, android::AudioParameter::keyRouting);
+    if (kvpairs) {
+        WLOGI(WRAPPER_LOG_HW, "%s: already routed to 0x%x", __FUNCTION__, state->devices);
+        STATS_ADD(state->dropped, 1);
+    }
+    return kvpairs;
+}
+
+/**
+ * Ends the call started by routing_filter(), ret is the blob's result. A
+ * forwarded routing change moves the device's epoch.
+ */
+static void routing_done(struct routing_state *state, uint32_t *epoch, bool routes, int ret)
+{
+    if (routes) {
+        STATS_ADD(state->forwarded, 1);
+        // After a failure the blob's routing is unknown
+        state->known = !ret;
+        state->devices = state->pending;
+        state->epoch = __atomic_add_fetch(epoch, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&state->lock);
+}
+
+static void routing_dump(const struct routing_state *state, int fd)
+{
+    dump_printf(fd, "    routing: %u changes forwarded, %u redundant dropped\n",
+                __atomic_load_n(&state->forwarded, __ATOMIC_RELAXED),
+                __atomic_load_n(&state->dropped, __ATOMIC_RELAXED));
+}
+
+static void attributes_init(struct attributes_cache *cache)
+{
+    pthread_mutex_init(&cache->lock, NULL);
+    // Differs from valid_generation, the first getter call reads the blob
+    cache->generation = 1;
+}
+
+/**
+ * Makes the next getter call read the attributes from the blob again. Has to
+ * be called after the blob applied the change.
+ */
+static inline void invalidate_stream_attributes(struct attributes_cache *cache)
+{
+    __atomic_fetch_add(&cache->generation, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copies the published attributes to attr. Returns false if they have to be
+ * refreshed, the caller then reads the blob under cache->lock and publishes
+ * the result with attributes_publish().
+ */
+static bool attributes_load(const struct attributes_cache *cache,
+                            struct stream_attributes *attr, uint32_t *generation)
+{
+    const struct stream_attributes *values = &cache->values;
+    uint32_t seq, valid;
+
+    do {
+        seq = __atomic_load_n(&cache->seq, __ATOMIC_ACQUIRE);
+        *generation = __atomic_load_n(&cache->generation, __ATOMIC_ACQUIRE);
+        valid = __atomic_load_n(&cache->valid_generation, __ATOMIC_RELAXED);
+        attr->sample_rate = __atomic_load_n(&values->sample_rate, __ATOMIC_RELAXED);
+        attr->blob_sample_rate = __atomic_load_n(&values->blob_sample_rate, __ATOMIC_RELAXED);
+        attr->channels = __atomic_load_n(&values->channels, __ATOMIC_RELAXED);
+        attr->format = __atomic_load_n(&values->format, __ATOMIC_RELAXED);
+        attr->latency = __atomic_load_n(&values->latency, __ATOMIC_RELAXED);
+        attr->buffer_size = __atomic_load_n(&values->buffer_size, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&cache->seq, __ATOMIC_RELAXED));
+    return valid == *generation;
+}
+
+/**
+ * Publishes attributes read from the blob for generation. Called with
+ * cache->lock held.
+ */
+static void attributes_publish(struct attributes_cache *cache,
+                               const struct stream_attributes *attr, uint32_t generation)
+{
+    struct stream_attributes *values = &cache->values;
+    uint32_t seq = cache->seq;
+
+    __atomic_store_n(&cache->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&values->sample_rate, attr->sample_rate, __ATOMIC_RELAXED);
+    __atomic_store_n(&values->blob_sample_rate, attr->blob_sample_rate, __ATOMIC_RELAXED);
+    __atomic_store_n(&values->channels, attr->channels, __ATOMIC_RELAXED);
+    __atomic_store_n(&values->format, attr->format, __ATOMIC_RELAXED);
+    __atomic_store_n(&values->latency, attr->latency, __ATOMIC_RELAXED);
+    __atomic_store_n(&values->buffer_size, attr->buffer_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&cache->valid_generation, generation, __ATOMIC_RELAXED);
+    __atomic_store_n(&cache->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Size of the buffer the blob is written with, one feeder period for outputs
+ * with a feeder.
+ */
+static size_t out_blob_buffer_size(const struct wrapper_stream_out *out,
+                                   const struct stream_attributes *blob)
+{
+    if (out->feeder)
+        return out->feeder->fast_period ? out->feeder->fast_period : out->feeder->period;
+    return blob->buffer_size;
+}
+
+/**
+ * Number of frames at rate that last as long as frames at blob_rate.
+ */
+static size_t resampled_buffer_frames(size_t frames, uint32_t rate, uint32_t blob_rate)
+{
+    frames = (uint64_t) frames * rate / blob_rate;
+    // AudioFlinger prefers multiples of 16 frames
+    if (frames > 16)
+        frames &= ~15;
+    return frames;
+}
+
+/**
+ * Buffer AudioFlinger writes: as many frames as the blob is written with,
+ * rescaled to the client rate when resampling, in the client format.
+ */
+static size_t out_buffer_size(const struct wrapper_stream_out *out,
+                              const struct stream_attributes *blob)
+{
+    size_t blob_frame_size = popcount(blob->channels) *
+        audio_bytes_per_sample((audio_format_t) blob->format);
+    audio_format_t format = (audio_format_t) blob->format;
+    size_t frames;
+
+    if (!blob_frame_size)
+        return out_blob_buffer_size(out, blob);
+
+    frames = out_blob_buffer_size(out, blob) / blob_frame_size;
+    if (out->resampler && blob->sample_rate)
+        frames = resampled_buffer_frames(frames, out->sample_rate, blob->sample_rate);
+    if (out->format != AUDIO_FORMAT_DEFAULT && blob->format == AUDIO_FORMAT_PCM_16_BIT)
+        format = out->format;
+    return frames * popcount(blob->channels) * audio_bytes_per_sample(format);
+}
+
+/**
+ * Outputs with a feeder report the time the steady state fill of the ring
+ * takes to play on top of the blob latency. The ring holds blob frames.
+ */
+static void out_feeder_attributes(const struct wrapper_stream_out *out,
+                                  const struct stream_attributes *blob,
+                                  struct stream_attributes *attr)
+{
+    struct out_feeder *feeder = out->feeder;
+    size_t frame_size;
+
+    if (!feeder)
+        return;
+
+    frame_size = popcount(blob->channels) * audio_bytes_per_sample((audio_format_t) blob->format);
+    __atomic_store_n(&feeder->blob_latency, blob->latency, __ATOMIC_RELAXED);
+    if (frame_size && blob->sample_rate)
+        attr->latency += (uint64_t) feeder->target / frame_size * 1000 / blob->sample_rate;
+}
+
+/**
+ * Outputs that convert to 16 bit report the format AudioFlinger writes.
+ */
+static void out_format_attributes(const struct wrapper_stream_out *out,
+                                  const struct stream_attributes *blob,
+                                  struct stream_attributes *attr)
+{
+    if (out->format == AUDIO_FORMAT_DEFAULT || blob->format != AUDIO_FORMAT_PCM_16_BIT)
+        return;
+
+    attr->format = out->format;
+}
+
+/**
+ * Resampling outputs report the rate AudioFlinger writes at and the filter
+ * delay on top of the latency.
+ */
+static void out_resampler_attributes(const struct wrapper_stream_out *out,
+                                     const struct stream_attributes *blob,
+                                     struct stream_attributes *attr)
+{
+    if (!out->resampler || !blob->sample_rate)
+        return;
+
+    attr->sample_rate = out->sample_rate;
+    attr->latency += (resampler_delay(out->resampler) * 1000 + blob->sample_rate - 1) /
+        blob->sample_rate;
+}
+
+static struct stream_attributes out_attributes(const struct audio_stream *stream)
+{
+    struct attributes_cache *cache = &((struct wrapper_stream_out *) stream)->attributes;
+    struct stream_attributes attr, blob;
+    uint32_t generation;
+
+    if (attributes_load(cache, &attr, &generation))
+        return attr;
+
+    pthread_mutex_lock(&cache->lock);
+    // Another getter may have refreshed them while we waited
+    if (!attributes_load(cache, &attr, &generation)) {
+        WLOGV(WRAPPER_LOG_HW, "%s: refreshing", __FUNCTION__);
+        blob.sample_rate = WRAPPED_STREAM_OUT_COMMON_CALL(stream, get_sample_rate);
+        blob.blob_sample_rate = blob.sample_rate;
+        blob.channels = WRAPPED_STREAM_OUT_COMMON_CALL(stream, get_channels);
+        blob.format = WRAPPED_STREAM_OUT_COMMON_CALL(stream, get_format);
+        blob.buffer_size = WRAPPED_STREAM_OUT_COMMON_CALL(stream, get_buffer_size);
+        blob.latency = WRAPPED_STREAM_OUT(stream)->get_latency(WRAPPED_STREAM_OUT(stream));
+        attr = blob;
+        out_feeder_attributes((struct wrapper_stream_out *) stream, &blob, &attr);
+        out_format_attributes((struct wrapper_stream_out *) stream, &blob, &attr);
+        out_resampler_attributes((struct wrapper_stream_out *) stream, &blob, &attr);
+        attr.buffer_size = out_buffer_size((struct wrapper_stream_out *) stream, &blob);
+        attributes_publish(cache, &attr, generation);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return attr;
+}
+
+/**
+ * Size of a frame written by AudioFlinger. Unlike audio_stream_frame_size()
+ * this knows the 32 bit formats.
+ */
+static size_t out_frame_size(const struct wrapper_stream_out *out)
+{
+    const struct stream_attributes attr = out_attributes(&out->stream.common);
+
+    return popcount(attr.channels) * audio_bytes_per_sample((audio_format_t) attr.format);
+}
+
+/**
+ * Size of a frame in the buffers passed to the blob, differs from
+ * out_frame_size() if out_write() converts the format.
+ */
+static size_t out_blob_frame_size(const struct wrapper_stream_out *out)
+{
+    if (out->format != AUDIO_FORMAT_DEFAULT)
+        return popcount(out_attributes(&out->stream.common).channels) * sizeof(int16_t);
+    return out_frame_size(out);
+}
+
+/**
+ * Buffer AudioFlinger reads: as many frames as the blob buffer, rescaled to
+ * the client rate when resampling, with the client's channels.
+ */
+static size_t in_buffer_size(const struct wrapper_stream_in *in,
+                             const struct stream_attributes *blob)
+{
+    size_t sample_size = audio_bytes_per_sample((audio_format_t) blob->format);
+    size_t frames;
+
+    if (!popcount(blob->channels) || !sample_size)
+        return blob->buffer_size;
+
+    frames = blob->buffer_size / (popcount(blob->channels) * sample_size);
+    if (in->resampler && blob->sample_rate)
+        frames = resampled_buffer_frames(frames, in->sample_rate, blob->sample_rate);
+    return frames * popcount(in->channels ? in->channels : blob->channels) * sample_size;
+}
+
+/**
+ * Inputs attached to a source with another channel count report their own.
+ */
+static void in_channel_attributes(const struct wrapper_stream_in *in,
+                                  const struct stream_attributes *blob,
+                                  struct stream_attributes *attr)
+{
+    if (!in->channels || !popcount(blob->channels))
+        return;
+
+    attr->channels = in->channels;
+}
+
+/**
+ * Resampling inputs report the rate AudioFlinger reads at.
+ */
+static void in_resampler_attributes(const struct wrapper_stream_in *in,
+                                    const struct stream_attributes *blob,
+                                    struct stream_attributes *attr)
+{
+    if (!in->resampler || !blob->sample_rate)
+        return;
+
+    attr->sample_rate = in->sample_rate;
+}
+
+static struct stream_attributes in_attributes(const struct audio_stream *stream)
+{
+    struct attributes_cache *cache = &((struct wrapper_stream_in *) stream)->attributes;
+    struct stream_attributes attr, blob;
+    uint32_t generation;
+
+    if (attributes_load(cache, &attr, &generation))
+        return attr;
+
+    pthread_mutex_lock(&cache->lock);
+    if (!attributes_load(cache, &attr, &generation)) {
+        WLOGV(WRAPPER_LOG_HW, "%s: refreshing", __FUNCTION__);
+        blob.sample_rate = WRAPPED_STREAM_IN_COMMON_CALL(stream, get_sample_rate);
+        blob.blob_sample_rate = blob.sample_rate;
+        blob.channels = WRAPPED_STREAM_IN_COMMON_CALL(stream, get_channels);
+        blob.format = WRAPPED_STREAM_IN_COMMON_CALL(stream, get_format);
+        blob.buffer_size = WRAPPED_STREAM_IN_COMMON_CALL(stream, get_buffer_size);
+        blob.latency = 0;
+        attr = blob;
+        in_channel_attributes((struct wrapper_stream_in *) stream, &blob, &attr);
+        in_resampler_attributes((struct wrapper_stream_in *) stream, &blob, &attr);
+        attr.buffer_size = in_buffer_size((struct wrapper_stream_in *) stream, &blob);
+        attributes_publish(cache, &attr, generation);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return attr;
+}
+
+static int64_t frames_to_ns(uint64_t frames, uint32_t rate)
+{
+    return (frames / rate) * 1000000000LL + (frames % rate) * 1000000000LL / rate;
+}
+
+/**
+ * Duration of the buffer AudioFlinger writes, the period the glitch detector
+ * measures the writes against.
+ */
+static int64_t out_period_ns(const struct wrapper_stream_out *out)
+{
+    const struct stream_attributes attr = out_attributes(&out->stream.common);
+    size_t frame_size = popcount(attr.channels) *
+        audio_bytes_per_sample((audio_format_t) attr.format);
+
+    if (!frame_size || !attr.sample_rate)
+        return 0;
+    return frames_to_ns(attr.buffer_size / frame_size, attr.sample_rate);
+}
+
+#ifndef ICS_AUDIO_BLOB
+/**
+ * Weight of a new observation in the drift correction, 1/2^shift.
+ */
+#define WRITE_CLOCK_GAIN_SHIFT 4
+
+static inline void write_clock_request_reset(struct write_clock *clock)
+{
+    __atomic_store_n(&clock->reset, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Advances the clock after a write of bytes that returned at now_ns.
+ *
+ * The nominal presentation time of the next write is the start of the stream
+ * plus the duration of all frames written so far. A blocking write returns
+ * once the blob has room again, so the next write will also be presented
+ * about one latency after the write returned. The start is slowly pulled
+ * towards that observation to follow the drift between the nominal rate and
+ * the real DAC clock, and moved at once if the stream underran.
+ */
+static void write_clock_update(struct wrapper_stream_out *out, size_t bytes, int64_t now_ns)
+{
+    struct write_clock *clock = &out->clock;
+    int64_t nominal_ns, error_ns;
+
+    if (__atomic_exchange_n(&clock->reset, 0, __ATOMIC_RELAXED))
+        clock->start_ns = 0;
+
+    if (!clock->start_ns) {
+        clock->sample_rate = out->stream.common.get_sample_rate(&out->stream.common);
+        clock->frame_size = out_frame_size(out);
+        clock->latency_ns = (int64_t) out->stream.get_latency(&out->stream) * 1000000LL;
+        if (!clock->sample_rate || !clock->frame_size)
+            return;
+        // The next buffer will be presented one latency from now
+        clock->frames = bytes / clock->frame_size;
+        clock->start_ns = now_ns + clock->latency_ns -
+            frames_to_ns(clock->frames, clock->sample_rate);
+        return;
+    }
+
+    clock->frames += bytes / clock->frame_size;
+    nominal_ns = clock->start_ns + frames_to_ns(clock->frames, clock->sample_rate);
+    error_ns = now_ns + clock->latency_ns - nominal_ns;
+
+    if (error_ns > clock->latency_ns / 2) {
+        WLOGV(WRAPPER_LOG_HW, "%s: resync after %lld us", __FUNCTION__,
+              (long long) (error_ns / 1000));
+        clock->start_ns += error_ns;
+    } else {
+        clock->start_ns += error_ns >> WRITE_CLOCK_GAIN_SHIFT;
+    }
+}
+
+#endif
+
+/**
+ * Called after the blob applied a change that may affect the stream
+ * attributes.
+ */
+static void out_reconfigured(struct audio_stream *stream)
+{
+    struct wrapper_stream_out *out = (struct wrapper_stream_out *) stream;
+
+    invalidate_stream_attributes(&out->attributes);
+    param_cache_clear(&out->parameters);
+#ifndef ICS_AUDIO_BLOB
+    write_clock_request_reset(&out->clock);
+#endif
+}
+
+/**
+ * Wakes up the other side of the ring if it waits. The fence orders the ring
+ * update before the load of the waiting flag, the waiting side does the
+ * opposite in out_feeder_wait().
+ */
+static void out_feeder_wake(struct out_feeder *feeder, int32_t *waiting)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(waiting, __ATOMIC_RELAXED))
+        return;
+    pthread_mutex_lock(&feeder->lock);
+    pthread_cond_signal(&feeder->cond);
+    pthread_mutex_unlock(&feeder->lock);
+}
+
+/**
+ * Returns true if the feeder has something to write to the blob, a whole blob
+ * buffer for fast outputs.
+ */
+static inline bool out_feeder_ready(const struct out_feeder *feeder)
+{
+    return ring_readable(&feeder->ring) >= (feeder->fast_period ? feeder->period : 1);
+}
+
+static bool out_feeder_exiting(struct out_feeder *feeder)
+{
+    pthread_mutex_lock(&feeder->lock);
+    bool exit = feeder->exit;
+    pthread_mutex_unlock(&feeder->lock);
+    return exit;
+}
+
+static const char *out_feeder_name(const struct out_feeder *feeder)
+{
+    if (!feeder->paced)
+        return "deep buffer";
+    return feeder->fast_period ? "fast" : "async";
+}
+
+/**
+ * Sleeps until the feeder has something to write (consumer) or the ring is
+ * not full (producer) or the feeder is told to exit.
+ */
+static void out_feeder_wait(struct out_feeder *feeder, bool consumer)
+{
+    int32_t *waiting = consumer ? &feeder->consumer_waiting : &feeder->producer_waiting;
+
+    pthread_mutex_lock(&feeder->lock);
+    __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!feeder->exit &&
+        !(consumer ? out_feeder_ready(feeder) : ring_writable(&feeder->ring)))
+        pthread_cond_wait(&feeder->cond, &feeder->lock);
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&feeder->lock);
+}
+
+/**
+ * Moves the calling wrapper thread to SCHED_FIFO priority, or to the nice
+ * value of the audio threads if priority is 0 or not permitted.
+ */
+static void set_audio_thread_priority(int priority)
+{
+    if (priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (!ret)
+            return;
+        ALOGW("%s: SCHED_FIFO priority %d failed: %d", __FUNCTION__, priority, ret);
+    }
+    // ANDROID_PRIORITY_AUDIO, like the AudioFlinger playback threads
+    setpriority(PRIO_PROCESS, 0, -16);
+}
+
+static void *out_feeder_thread(void *arg)
+{
+    struct wrapper_stream_out *out = (struct wrapper_stream_out *) arg;
+    struct out_feeder *feeder = out->feeder;
+    size_t bytes, done, frame_size, dropped;
+    ssize_t ret;
+
+    set_audio_thread_priority(feeder->priority);
+
+    while (!out_feeder_exiting(feeder)) {
+
+        if (!out_feeder_ready(feeder)) {
+            out_feeder_wait(feeder, true);
+            continue;
+        }
+
+        pthread_mutex_lock(&feeder->blob_lock);
+        bytes = ring_read(&feeder->ring, feeder->buffer, feeder->period);
+        out_feeder_wake(feeder, &feeder->producer_waiting);
+        // The data has left the ring, so retry short writes until all of it
+        // reached the blob
+        for (done = 0, ret = 0; done < bytes; done += ret) {
+            ret = WRAPPED_STREAM_OUT(out)->write(WRAPPED_STREAM_OUT(out),
+                                                 feeder->buffer + done, bytes - done);
+            if (ret <= 0)
+                break;
+        }
+        pthread_mutex_unlock(&feeder->blob_lock);
+
+        frame_size = out_blob_frame_size(out);
+        if (!frame_size)
+            continue;
+        __atomic_fetch_add(&feeder->frames_written, (uint64_t) done / frame_size,
+                           __ATOMIC_RELAXED);
+        if (done < bytes) {
+            // Don't spin on a broken blob, wait as long as the data would play
+            uint32_t rate = out_attributes(&out->stream.common).blob_sample_rate;
+            dropped = (bytes - done) / frame_size;
+            __atomic_fetch_add(&feeder->frames_dropped, (uint64_t) dropped, __ATOMIC_RELAXED);
+            ALOGE("%s: vendor write failed: %d, dropped %zu frames", __FUNCTION__, (int) ret,
+                  dropped);
+            if (rate)
+                usleep(frames_to_ns(dropped, rate) / 1000);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Lets out_write() of an async output return at the nominal rate of the
+ * stream once the ring reached target, writes below it return at once to fill
+ * it up. Above target + period each write is stretched by 1/8 so the fill
+ * follows the real rate of the blob. The time is kept as an absolute deadline
+ * so the mixer's own processing time doesn't add up. The fill of fast outputs
+ * drops by a whole blob buffer at once, they return at once while the feeder
+ * waits for data instead and are stretched two of their periods above target.
+ */
+static void out_feeder_pace(struct wrapper_stream_out *out, size_t bytes)
+{
+    struct out_feeder *feeder = out->feeder;
+    const struct stream_attributes attr = out_attributes(&out->stream.common);
+    size_t frame_size = out_blob_frame_size(out);
+    uint32_t fill = ring_readable(&feeder->ring);
+    int64_t now_ns = trace_now_ns(), duration_ns;
+    size_t slack = feeder->fast_period ? feeder->fast_period * 2 : feeder->period;
+    bool behind;
+    struct timespec ts;
+
+    if (!frame_size || !attr.blob_sample_rate)
+        return;
+
+    if (feeder->fast_period)
+        behind = __atomic_load_n(&feeder->consumer_waiting, __ATOMIC_RELAXED);
+    else
+        behind = fill < feeder->target;
+    if (behind) {
+        feeder->pace_ns = now_ns;
+        return;
+    }
+
+    duration_ns = frames_to_ns(bytes / frame_size, attr.blob_sample_rate);
+    // Don't catch up on time the mixer spent elsewhere, e.g. after a pause
+    if (feeder->pace_ns < now_ns - duration_ns)
+        feeder->pace_ns = now_ns;
+    feeder->pace_ns += duration_ns;
+    if (fill > feeder->target + slack)
+        feeder->pace_ns += duration_ns >> 3;
+
+    ts.tv_sec = feeder->pace_ns / 1000000000LL;
+    ts.tv_nsec = feeder->pace_ns % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/**
+ * Copies buffer into the ring, blocks while it is full. Returns the bytes
+ * copied so far, or -EPIPE if none, once the feeder is told to exit.
+ */
+static ssize_t out_feeder_write(struct wrapper_stream_out *out, const void *buffer,
+                                size_t bytes)
+{
+    struct out_feeder *feeder = out->feeder;
+    size_t written = 0;
+
+    while (written < bytes) {
+        written += ring_write(&feeder->ring, (const char *) buffer + written, bytes - written);
+        if (out_feeder_ready(feeder))
+            out_feeder_wake(feeder, &feeder->consumer_waiting);
+        if (written < bytes) {
+            if (out_feeder_exiting(feeder))
+                return written ? (ssize_t) written : -EPIPE;
+            out_feeder_wait(feeder, false);
+        }
+    }
+
+    if (feeder->paced)
+        out_feeder_pace(out, bytes);
+    return bytes;
+}
+
+/**
+ * Drops the data that has not been written to the blob yet and puts the blob
+ * into standby.
+ */
+static int out_feeder_standby(struct wrapper_stream_out *out)
+{
+    struct out_feeder *feeder = out->feeder;
+    int ret;
+
+    pthread_mutex_lock(&feeder->blob_lock);
+    ring_discard(&feeder->ring);
+    ret = WRAPPED_STREAM_OUT_COMMON_CALL(out, standby);
+    pthread_mutex_unlock(&feeder->blob_lock);
+    feeder->pace_ns = 0;
+    return ret;
+}
+
+/**
+ * Render position for blobs that don't report one: the frames the feeder
+ * wrote minus the ones the blob still buffers. Dropped frames count as
+ * rendered, AudioFlinger won't write them again.
+ */
+static int out_feeder_render_position(const struct wrapper_stream_out *out,
+                                      uint32_t *dsp_frames)
+{
+    const struct out_feeder *feeder = out->feeder;
+    uint64_t written = __atomic_load_n(&feeder->frames_written, __ATOMIC_RELAXED) +
+        __atomic_load_n(&feeder->frames_dropped, __ATOMIC_RELAXED);
+    uint64_t buffered = (uint64_t) __atomic_load_n(&feeder->blob_latency, __ATOMIC_RELAXED) *
+        out_attributes(&out->stream.common).blob_sample_rate / 1000;
+
+    *dsp_frames = written > buffered ? (uint32_t) (written - buffered) : 0;
+    return 0;
+}
+
+static void out_feeder_free(struct out_feeder *feeder)
+{
+    pthread_cond_destroy(&feeder->cond);
+    pthread_mutex_destroy(&feeder->lock);
+    pthread_mutex_destroy(&feeder->blob_lock);
+    ring_free(&feeder->ring);
+    free(feeder->buffer);
+    free(feeder);
+}
+
+/**
+ * Stops the feeder thread, everything still in the ring is dropped. Must not
+ * race with out_write().
+ */
+static void out_feeder_stop(struct wrapper_stream_out *out)
+{
+    struct out_feeder *feeder = out->feeder;
+
+    if (!feeder)
+        return;
+
+    pthread_mutex_lock(&feeder->lock);
+    feeder->exit = true;
+    pthread_cond_broadcast(&feeder->cond);
+    pthread_mutex_unlock(&feeder->lock);
+    pthread_join(feeder->thread, NULL);
+
+    out->feeder = NULL;
+    out_feeder_free(feeder);
+    out_reconfigured(&out->stream.common);
+}
+
+/**
+ * Puts a feeder with a period of period_buffers vendor buffers and a ring of
+ * periods periods between out and the blob. See struct out_feeder for paced.
+ * A split above 1 makes a fast output that reports a period of 1/split of
+ * that, rounded down to 16 frames.
+ */
+static int out_feeder_start(struct wrapper_stream_out *out, int period_buffers, int periods,
+                            int split, bool paced, int priority)
+{
+    struct out_feeder *feeder;
+    size_t period = WRAPPED_STREAM_OUT_COMMON_CALL(out, get_buffer_size) * period_buffers;
+    size_t frame_size = popcount(WRAPPED_STREAM_OUT_COMMON_CALL(out, get_channels)) *
+        audio_bytes_per_sample(WRAPPED_STREAM_OUT_COMMON_CALL(out, get_format));
+    size_t fast_frames = 0;
+    int ret;
+
+    if (out->feeder || period_buffers <= 0 || periods <= 0 || split <= 0 || !frame_size)
+        return -EINVAL;
+    if (split > 1) {
+        fast_frames = period / frame_size / split;
+        // AudioFlinger prefers multiples of 16 frames
+        if (fast_frames > 16)
+            fast_frames &= ~15;
+        if (!fast_frames)
+            return -EINVAL;
+    }
+
+    feeder = (struct out_feeder *) calloc(1, sizeof(*feeder));
+    if (!feeder)
+        return -ENOMEM;
+
+    feeder->period = period;
+    feeder->fast_period = fast_frames * frame_size;
+    feeder->paced = paced;
+    feeder->priority = priority;
+    feeder->target = paced ? period * ((periods + 1) / 2) : period * periods;
+    // A fast output's writes wait for the rest of their blob buffer, on
+    // average the last one doesn't
+    if (feeder->fast_period)
+        feeder->target = period - feeder->fast_period;
+    feeder->buffer = (char *) malloc(period);
+    ret = feeder->buffer ? ring_init(&feeder->ring, period * periods) : -ENOMEM;
+    if (ret) {
+        free(feeder->buffer);
+        free(feeder);
+        return ret;
+    }
+
+    pthread_mutex_init(&feeder->lock, NULL);
+    pthread_cond_init(&feeder->cond, NULL);
+    pthread_mutex_init(&feeder->blob_lock, NULL);
+    out->feeder = feeder;
+
+    ret = -pthread_create(&feeder->thread, NULL, out_feeder_thread, out);
+    if (ret) {
+        ALOGE("%s: failed to create feeder thread: %d", __FUNCTION__, ret);
+        out->feeder = NULL;
+        out_feeder_free(feeder);
+        return ret;
+    }
+
+    out_reconfigured(&out->stream.common);
+    ALOGI("%s: %s output, period %zu bytes, ring %zu bytes", __FUNCTION__,
+          out_feeder_name(feeder), period, period * periods);
+    return 0;
+}
+
+
+static uint32_t out_get_sample_rate(const struct audio_stream *stream)
+{
+    return out_attributes(stream).sample_rate;
+}
+
+static int out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
+{
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_out_set_sample_rate, stream);
+    int ret = WRAPPED_STREAM_OUT_COMMON_CALL(stream, set_sample_rate, rate);
+    out_reconfigured(stream);
+    return TRACE_RETURN(ret);
+}
+
+static size_t out_get_buffer_size(const struct audio_stream *stream)
+{
+    return out_attributes(stream).buffer_size;
+}
+
+static audio_channel_mask_t out_get_channels(const struct audio_stream *stream)
+{
+    return (audio_channel_mask_t) out_attributes(stream).channels;
+}
+
+static audio_format_t out_get_format(const struct audio_stream *stream)
+{
+    return (audio_format_t) out_attributes(stream).format;
+}
+
+static int out_set_format(struct audio_stream *stream, audio_format_t format)
+{
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_out_set_format, stream);
+    int ret = WRAPPED_STREAM_OUT_COMMON_CALL(stream, set_format, format);
+    out_reconfigured(stream);
+    return TRACE_RETURN(ret);
+}
+
+/**
+ * Accounts the first read or write after standby, state is the one the stream
+ * was in before it.
+ */
+static void standby_stats_resumed(struct standby_stats *stats, int state, int64_t start_ns,
+                                  int64_t end_ns)
+{
+    if (state == STREAM_STANDBY)
+        stats_histogram_add(&stats->cold_resume_us, stats_clamp((end_ns - start_ns) / 1000));
+    else if (state == STREAM_STANDBY_PENDING)
+        stats_histogram_add(&stats->warm_resume_us, stats_clamp((end_ns - start_ns) / 1000));
+}
+
+/**
+ * Puts the blob stream into standby. Called with out->standby_lock held.
+ */
+static int out_enter_standby(struct wrapper_stream_out *out)
+{
+    int ret;
+
+    if (out->feeder)
+        ret = out_feeder_standby(out);
+    else
+        ret = WRAPPED_STREAM_OUT_COMMON_CALL(out, standby);
+    STATS_ADD(out->standby_stats.entered, 1);
+    __atomic_store_n(&out->standby_state, STREAM_STANDBY, __ATOMIC_RELAXED);
+    return ret;
+}
+
+/**
+ * Marks out as playing before a write. Returns the state it was in.
+ */
+static int out_resume(struct wrapper_stream_out *out)
+{
+    int state = __atomic_load_n(&out->standby_state, __ATOMIC_RELAXED);
+
+    if (state == STREAM_ACTIVE)
+        return state;
+
+    pthread_mutex_lock(&out->standby_lock);
+    state = out->standby_state;
+    __atomic_store_n(&out->standby_state, STREAM_ACTIVE, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&out->standby_lock);
+    return state;
+}
+
+/**
+ * Puts the outputs whose standby delay passed into standby. Runs while the
+ * device is open if STANDBY_DELAY_PROPERTY is set. Holding standby_lock from
+ * the scan to the wait means a standby_thread_wake() can't get lost.
+ */
+static void *standby_thread(void *arg)
+{
+    struct wrapper_audio_device *adev = (struct wrapper_audio_device *) arg;
+    struct wrapper_stream_out *out;
+    int64_t now_ns, next_ns, wake_ns;
+    struct timespec ts;
+
+    pthread_mutex_lock(&adev->standby_lock);
+    while (!adev->standby_exit) {
+        now_ns = trace_now_ns();
+        next_ns = 0;
+        for (out = adev->delayed_outputs; out; out = out->next_delayed) {
+            pthread_mutex_lock(&out->standby_lock);
+            if (out->standby_state == STREAM_STANDBY_PENDING) {
+                if (out->standby_deadline_ns <= now_ns) {
+                    WLOGI(WRAPPER_LOG_HW, "%s: output %p", __FUNCTION__, out);
+                    out_enter_standby(out);
+                } else if (!next_ns || out->standby_deadline_ns < next_ns) {
+                    next_ns = out->standby_deadline_ns;
+                }
+            }
+            pthread_mutex_unlock(&out->standby_lock);
+        }
+
+        if (!next_ns) {
+            pthread_cond_wait(&adev->standby_cond, &adev->standby_lock);
+            continue;
+        }
+        // The condition variable waits on CLOCK_REALTIME
+        clock_gettime(CLOCK_REALTIME, &ts);
+        wake_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec + (next_ns - now_ns);
+        ts.tv_sec = wake_ns / 1000000000LL;
+        ts.tv_nsec = wake_ns % 1000000000LL;
+        pthread_cond_timedwait(&adev->standby_cond, &adev->standby_lock, &ts);
+    }
+    pthread_mutex_unlock(&adev->standby_lock);
+    return NULL;
+}
+
+static void standby_thread_wake(struct wrapper_audio_device *adev)
+{
+    pthread_mutex_lock(&adev->standby_lock);
+    pthread_cond_signal(&adev->standby_cond);
+    pthread_mutex_unlock(&adev->standby_lock);
+}
+
+/**
+ * Drops the call if out is in standby or about to enter it. Otherwise the
+ * blob goes to standby now or, with a standby delay, when the standby thread
+ * finds the delay passed without a write.
+ */
+static int out_standby(struct audio_stream *stream)
+{
+    struct wrapper_stream_out *out = (struct wrapper_stream_out *) stream;
+    int ret;
+
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_out_standby, stream);
+    pthread_mutex_lock(&out->standby_lock);
+    STATS_ADD(out->standby_stats.requests, 1);
+    if (out->standby_state != STREAM_ACTIVE) {
+        STATS_ADD(out->standby_stats.dropped, 1);
+        pthread_mutex_unlock(&out->standby_lock);
+        return TRACE_RETURN(0);
+    }
+
+    if (out->resampler)
+        resampler_reset(out->resampler);
+#ifndef ICS_AUDIO_BLOB
+    write_clock_request_reset(&out->clock);
+#endif
+    glitch_stats_restart(&out->glitch_stats);
+    if (out->dev->standby_delay_ms > 0) {
+        out->standby_deadline_ns = trace_now_ns() + out->dev->standby_delay_ms * 1000000LL;
+        __atomic_store_n(&out->standby_state, STREAM_STANDBY_PENDING, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&out->standby_lock);
+        standby_thread_wake(out->dev);
+        return TRACE_RETURN(0);
+    }
+    ret = out_enter_standby(out);
+    pthread_mutex_unlock(&out->standby_lock);
+    return TRACE_RETURN(ret);
+}
+
+static int out_dump(const struct audio_stream *stream, int fd)
+{
+    struct wrapper_stream_out *out = (struct wrapper_stream_out *) stream;
+
+    dump_printf(fd, "  Wrapper output stream %p:\n", stream);
+    if (out->format != AUDIO_FORMAT_DEFAULT)
+        dump_printf(fd, "    format 0x%x converted to 16 bit%s\n", out->format,
+                    out->dev->dither ? " with dither" : "");
+    if (out->resampler)
+        dump_printf(fd, "    resampling %u to %u Hz, %u taps, delay %u frames\n",
+                    out->sample_rate, out_attributes(stream).blob_sample_rate,
+                    resampler_taps(out->resampler), resampler_delay(out->resampler));
+    if (out->feeder)
+        dump_printf(fd, "    %s: period %zu bytes, ring %u/%u bytes, target %zu bytes\n",
+                    out_feeder_name(out->feeder), out->feeder->period,
+                    ring_readable(&out->feeder->ring), out->feeder->ring.capacity,
+                    out->feeder->target);
+    if (out->feeder && __atomic_load_n(&out->feeder->frames_dropped, __ATOMIC_RELAXED))
+        dump_printf(fd, "    dropped %llu frames the vendor HAL failed to accept\n",
+                    (unsigned long long) __atomic_load_n(&out->feeder->frames_dropped,
+                                                         __ATOMIC_RELAXED));
+    if (out->feeder && out->feeder->fast_period)
+        dump_printf(fd, "    fast: AudioFlinger writes %zu bytes\n", out->feeder->fast_period);
+    glitch_stats_dump(&out->glitch_stats, fd);
+    standby_stats_dump(&out->standby_stats, fd);
+    param_cache_dump(&out->parameters, fd);
+    routing_dump(&out->routing, fd);
+    stream_stats_dump(&out->write_stats, fd, "write");
+    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, dump, fd);
+}
+
+/**
+ * Turns async writes on or off for one output. AudioFlinger sets stream
+ * parameters from the playback thread between two writes, so the feeder can
+ * be swapped here. Data still in the ring is dropped.
+ */
+static int out_set_async_write(struct wrapper_stream_out *out, int periods)
+{
+    int ret = 0;
+
+    if (out->feeder && (!out->feeder->paced || out->feeder->fast_period))
+        return -EINVAL;
+
+    // The standby thread may use the feeder
+    pthread_mutex_lock(&out->standby_lock);
+    out_feeder_stop(out);
+    if (periods > 0)
+        ret = out_feeder_start(out, 1, periods, 1, true, out->dev->async_write_priority);
+    pthread_mutex_unlock(&out->standby_lock);
+    return ret;
+}
+
+/**
+ * Turns one output into a fast output with split periods per blob buffer or
+ * back (0), like out_set_async_write(). A ring of two blob buffers holds the
+ * one being collected and the one that waits for the blob.
+ */
+static int out_set_fast_output(struct wrapper_stream_out *out, int split)
+{
+    int ret = 0;
+
+    if (out->feeder && !out->feeder->fast_period)
+        return -EINVAL;
+
+    pthread_mutex_lock(&out->standby_lock);
+    out_feeder_stop(out);
+    if (split > 0)
+        ret = out_feeder_start(out, 1, 2, split < 2 ? 2 : split, true,
+                               out->dev->async_write_priority);
+    pthread_mutex_unlock(&out->standby_lock);
+    return ret;
+}
+
+/**
+ * Replaces the resampler of an output that resamples with one of another
+ * preset. Called from the playback thread like out_set_async_write().
+ */
+static int out_set_resampler_quality(struct wrapper_stream_out *out,
+                                     enum resampler_quality quality)
+{
+    const struct stream_attributes attr = out_attributes(&out->stream.common);
+    struct resampler *resampler;
+
+    if (!out->resampler || quality == RESAMPLER_QUALITY_OFF)
+        return -EINVAL;
+
+    resampler = resampler_create(out->sample_rate, attr.blob_sample_rate,
+                                 popcount(attr.channels), quality);
+    if (!resampler)
+        return -ENOMEM;
+    resampler_free(out->resampler);
+    out->resampler = resampler;
+    out_reconfigured(&out->stream.common);
+    return 0;
+}
+
+/**
+ * Applies the wrapper-private keys of *kvpairs and replaces it with the
+ * remaining pairs in scratch memory. Returns the error of the last key that
+ * failed. If out of memory *kvpairs is set to NULL and -ENOMEM returned.
+ */
+static int out_set_wrapper_parameters(struct wrapper_stream_out *out, const char **kvpairs)
+{
+    const char *value;
+    int periods, split, ret = 0, status;
+
+    if (has_audio_parameter(*kvpairs, ASYNC_WRITE_KEY)) {
+        if (get_audio_parameter_int(*kvpairs, ASYNC_WRITE_KEY, &periods))
+            status = out_set_async_write(out, periods);
+        else
+            status = -EINVAL;
+        ALOGW_IF(status, "%s: %s failed: %d", __FUNCTION__, ASYNC_WRITE_KEY, status);
+        ret = status ? status : ret;
+        *kvpairs = remove_audio_parameter(*kvpairs, ASYNC_WRITE_KEY);
+        if (!*kvpairs)
+            return -ENOMEM;
+    }
+
+    if (has_audio_parameter(*kvpairs, FAST_OUTPUT_KEY)) {
+        if (get_audio_parameter_int(*kvpairs, FAST_OUTPUT_KEY, &split))
+            status = out_set_fast_output(out, split);
+        else
+            status = -EINVAL;
+        ALOGW_IF(status, "%s: %s failed: %d", __FUNCTION__, FAST_OUTPUT_KEY, status);
+        ret = status ? status : ret;
+        *kvpairs = remove_audio_parameter(*kvpairs, FAST_OUTPUT_KEY);
+        if (!*kvpairs)
+            return -ENOMEM;
+    }
+
+    value = get_audio_parameter(*kvpairs, RESAMPLER_KEY);
+    if (value) {
+        status = out_set_resampler_quality(out, resampler_quality_from_string(value));
+        ALOGW_IF(status, "%s: %s failed: %d", __FUNCTION__, RESAMPLER_KEY, status);
+        ret = status ? status : ret;
+        *kvpairs = remove_audio_parameter(*kvpairs, RESAMPLER_KEY);
+        if (!*kvpairs)
+            return -ENOMEM;
+    }
+
+    return ret;
+}
+
+static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
+{
+    WLOGI(WRAPPER_LOG_HW, "%s: kvpairs: %s", __FUNCTION__, kvpairs);
+    TRACE_SCOPE(TRACE_out_set_parameters, stream);
+    SCRATCH_SCOPE();
+    const char * fixed_kvpairs;
+    struct wrapper_stream_out *out = (struct wrapper_stream_out *) stream;
+    uint32_t *epoch = &out->dev->routing_epoch;
+    bool routes;
+    int ret;
+
+    if (has_audio_parameter(kvpairs, ASYNC_WRITE_KEY) ||
+            has_audio_parameter(kvpairs, FAST_OUTPUT_KEY) ||
+            has_audio_parameter(kvpairs, RESAMPLER_KEY)) {
+        ret = out_set_wrapper_parameters(out, &kvpairs);
+        if (!kvpairs || !*kvpairs)
+            return TRACE_RETURN(ret);
+    }
+
+    kvpairs = routing_filter(&out->routing, epoch, kvpairs, &routes);
+    if (!kvpairs) {
+        routing_done(&out->routing, epoch, false, 0);
+        return TRACE_RETURN(-ENOMEM);
+    }
+    if (!*kvpairs) {
+        routing_done(&out->routing, epoch, routes, 0);
+        return TRACE_RETURN(0);
+    }
+    fixed_kvpairs = fixup_audio_parameters_scratch(kvpairs, JB_TO_ICS);
+    if (!fixed_kvpairs) {
+        routing_done(&out->routing, epoch, false, 0);
+        return TRACE_RETURN(-ENOMEM);
+    }
+    ret = WRAPPED_STREAM_OUT_COMMON_CALL(stream, set_parameters, fixed_kvpairs);
+    routing_done(&out->routing, epoch, routes, ret);
+    param_cache_invalidate(&out->parameters, kvpairs);
+    if (changes_stream_attributes(kvpairs))
+        out_reconfigured(stream);
+    return TRACE_RETURN(ret);
+}
+
+/**
+ * Answers the wrapper-private keys of keys and asks the blob for the others.
+ */
+static char * out_get_wrapper_parameters(const struct wrapper_stream_out *out,
+                                         const char *keys)
+{
+    SCRATCH_SCOPE();
+    const char * blob_keys = remove_audio_parameter(keys, GLITCH_STATS_KEY);
+    const char * fixed_kvpairs = NULL;
+    char value[128];
+    char * kvpairs = NULL;
+    char * reply;
+    size_t size;
+
+    if (!blob_keys)
+        return NULL;
+    if (*blob_keys) {
+        kvpairs = WRAPPED_STREAM_OUT_COMMON_CALL(out, get_parameters, blob_keys);
+        if (kvpairs)
+            fixed_kvpairs = fixup_audio_parameters_scratch(kvpairs, ICS_TO_JB);
+    }
+    if (!fixed_kvpairs)
+        fixed_kvpairs = "";
+
+    glitch_stats_format(&out->glitch_stats, value, sizeof(value));
+    size = strlen(fixed_kvpairs) + strlen(GLITCH_STATS_KEY) + strlen(value) + 3;
+    reply = (char *) malloc(size);
+    if (reply)
+        snprintf(reply, size, "%s%s%s=%s", fixed_kvpairs, *fixed_kvpairs ? ";" : "",
+                 GLITCH_STATS_KEY, value);
+    free(kvpairs);
+    return reply;
+}
+
+static char * out_get_parameters(const struct audio_stream *stream, const char *keys)
+{
+    WLOGI(WRAPPER_LOG_HW, "%s: keys: %s", __FUNCTION__, keys);
+    TRACE_SCOPE(TRACE_out_get_parameters, stream);
+    struct wrapper_stream_out *out = (struct wrapper_stream_out *) stream;
+    uint32_t generation;
+    char * kvpairs;
+
+    if (has_audio_parameter(keys, GLITCH_STATS_KEY))
+        return out_get_wrapper_parameters(out, keys);
+    kvpairs = param_cache_get(&out->parameters, keys, &generation);
+    if (kvpairs)
+        return kvpairs;
+    kvpairs = WRAPPED_STREAM_OUT_COMMON_CALL(stream, get_parameters, keys);
+    kvpairs = fixup_returned_audio_parameters(kvpairs, ICS_TO_JB);
+    param_cache_put(&out->parameters, keys, kvpairs, generation);
+    return kvpairs;
+}
+
+static uint32_t out_get_latency(const struct audio_stream_out *stream)
+{
+    return out_attributes(&stream->common).latency;
+}
+
+static int out_set_volume(struct audio_stream_out *stream, float left,
+                          float right)
+{
+    RETURN_WRAPPED_STREAM_OUT_CALL(stream, set_volume, left, right);
+}
+
+/**
+ * Converts a 32 or 8.24 bit buffer to 16 bit if the blob can't take the
+ * format of the stream. bytes is updated to the size of the returned buffer,
+ * which is buffer itself or owned by the stream. Returns NULL if out of
+ * memory.
+ */
+static const void * out_convert_to_16(struct wrapper_stream_out *out,
+                                      const void *buffer, size_t *bytes)
+{
+    size_t samples = *bytes / sizeof(int32_t);
+    struct pcm_dither *dither = out->dev->dither ? &out->dither : NULL;
+
+    if (out->format == AUDIO_FORMAT_DEFAULT)
+        return buffer;
+
+    if (samples * sizeof(int16_t) > out->convert_buffer_size) {
+        int16_t *convert_buffer = (int16_t *) realloc(out->convert_buffer,
+                                                      samples * sizeof(int16_t));
+        if (!convert_buffer)
+            return NULL;
+        out->convert_buffer = convert_buffer;
+        out->convert_buffer_size = samples * sizeof(int16_t);
+    }
+
+    if (out->format == AUDIO_FORMAT_PCM_8_24_BIT)
+        pcm_convert_8_24_to_16(out->convert_buffer, (const int32_t *) buffer, samples, dither);
+    else
+        pcm_convert_32_to_16(out->convert_buffer, (const int32_t *) buffer, samples, dither);
+    *bytes = samples * sizeof(int16_t);
+    return out->convert_buffer;
+}
+
+/**
+ * Resamples a 16 bit buffer to the rate of the blob if the stream was opened
+ * at another rate. Like out_convert_to_16() bytes is updated and NULL is
+ * returned if out of memory.
+ */
+static const void * out_resample(struct wrapper_stream_out *out,
+                                 const void *buffer, size_t *bytes)
+{
+    size_t frame_size, frames, size;
+
+    if (!out->resampler)
+        return buffer;
+
+    frame_size = out_blob_frame_size(out);
+    frames = *bytes / frame_size;
+    size = resampler_max_output(out->resampler, frames) * frame_size;
+    if (size > out->resample_buffer_size) {
+        int16_t *resample_buffer = (int16_t *) realloc(out->resample_buffer, size);
+        if (!resample_buffer)
+            return NULL;
+        out->resample_buffer = resample_buffer;
+        out->resample_buffer_size = size;
+    }
+
+    frames = resampler_process(out->resampler, (const int16_t *) buffer, frames,
+                               out->resample_buffer);
+    *bytes = frames * frame_size;
+    return out->resample_buffer;
+}
+
+/**
+ * Applies the master volume and mute to a 16 bit PCM buffer, i.e. after
+ * out_convert_to_16(). Returns buffer itself at unity gain, otherwise a buffer
+ * owned by the stream.
+ */
+static const void * out_apply_master_gain(struct wrapper_stream_out *out,
+                                          const void *buffer, size_t bytes)
+{
+    struct stream_attributes attr;
+    size_t frame_size, frames;
+    unsigned channels;
+    float target;
+
+    __atomic_load(&out->dev->master_gain, &target, __ATOMIC_RELAXED);
+    if (target == 1.0f && out->gain == 1.0f)
+        return buffer;
+
+    attr = out_attributes(&out->stream.common);
+    if (out->format == AUDIO_FORMAT_DEFAULT && attr.format != AUDIO_FORMAT_PCM_16_BIT)
+        return buffer;
+
+    if (bytes > out->gain_buffer_size) {
+        int16_t *gain_buffer = (int16_t *) realloc(out->gain_buffer, bytes);
+        if (!gain_buffer)
+            return buffer;
+        out->gain_buffer = gain_buffer;
+        out->gain_buffer_size = bytes;
+    }
+
+    channels = popcount(attr.channels);
+    frame_size = channels * sizeof(int16_t);
+    frames = bytes / frame_size;
+
+    if (target == 0.0f && out->gain == 0.0f) {
+        memset(out->gain_buffer, 0, bytes);
+    } else {
+        pcm_apply_gain_16(out->gain_buffer, (const int16_t *) buffer, frames, channels,
+                          out->gain, target);
+        // Partial frame, pass it through
+        memcpy((char *) out->gain_buffer + frames * frame_size,
+               (const char *) buffer + frames * frame_size, bytes - frames * frame_size);
+    }
+    out->gain = target;
+
+    return out->gain_buffer;
+}
+
+static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
+                         size_t bytes)
+{
+    struct wrapper_stream_out *out = (struct wrapper_stream_out *) stream;
+    int64_t start_ns = trace_now_ns(), end_ns;
+    size_t blob_bytes = bytes;
+    int resumed;
+    ssize_t ret;
+
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_out_write, stream);
+    resumed = out_resume(out);
+    buffer = out_convert_to_16(out, buffer, &blob_bytes);
+    if (buffer)
+        buffer = out_resample(out, buffer, &blob_bytes);
+    if (!buffer)
+        return TRACE_RETURN(-ENOMEM);
+    buffer = out_apply_master_gain(out, buffer, blob_bytes);
+    // The resampler may hold back all of a short write
+    if (!blob_bytes)
+        ret = 0;
+    else if (out->feeder)
+        ret = out_feeder_write(out, buffer, blob_bytes);
+    else
+        ret = WRAPPED_STREAM_OUT(stream)->write(WRAPPED_STREAM_OUT(stream), buffer, blob_bytes);
+    // Report the bytes of the buffer AudioFlinger passed in
+    if (ret >= 0 && blob_bytes != bytes)
+        ret = (size_t) ret == blob_bytes ? bytes : (uint64_t) ret * bytes / blob_bytes;
+    end_ns = trace_now_ns();
+    stream_stats_add(&out->write_stats, start_ns, end_ns, ret);
+    glitch_stats_add(&out->glitch_stats, start_ns, end_ns, out_period_ns(out));
+    standby_stats_resumed(&out->standby_stats, resumed, start_ns, end_ns);
+#ifndef ICS_AUDIO_BLOB
+    if (ret > 0)
+        write_clock_update(out, ret, end_ns);
+#endif
+    return TRACE_RETURN(ret);
+}
+
+static int out_get_render_position(const struct audio_stream_out *stream,
+                                   uint32_t *dsp_frames)
+{
+    const struct wrapper_stream_out *out = (const struct wrapper_stream_out *) stream;
+    int ret;
+
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_out_get_render_position, stream);
+    ret = WRAPPED_STREAM_OUT(stream)->get_render_position(WRAPPED_STREAM_OUT(stream), dsp_frames);
+
+    // The position of the blob counts what the feeder wrote to it, which is
+    // what is wanted. Emulate it for blobs that don't have one.
+    if (ret && out->feeder)
+        ret = out_feeder_render_position(out, dsp_frames);
+    if (!ret && out->resampler)
+        *dsp_frames = (uint64_t) *dsp_frames * out->sample_rate /
+            out_attributes(&stream->common).blob_sample_rate;
+    return TRACE_RETURN(ret);
+}
+
+static int out_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
+{
+    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, add_audio_effect, effect);
+}
+
+static int out_remove_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
+{
+    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, remove_audio_effect, effect);
+}
+
+#ifndef ICS_AUDIO_BLOB
+static int out_get_next_write_timestamp(const struct audio_stream_out *stream,
+                                        int64_t *timestamp)
+{
+    const struct write_clock *clock = &((const struct wrapper_stream_out *) stream)->clock;
+    TRACE_SCOPE(TRACE_out_get_next_write_timestamp, stream);
+
+    // Not running, AudioFlinger falls back to its own pacing
+    if (!clock->start_ns || __atomic_load_n(&clock->reset, __ATOMIC_RELAXED))
+        return TRACE_RETURN(-EINVAL);
+
+    *timestamp = (clock->start_ns + frames_to_ns(clock->frames, clock->sample_rate)) / 1000;
+    return TRACE_RETURN(0);
+}
+#endif
+
+/** audio_stream_in implementation **/
+
+/**
+ * Wakes up in_read() if it waits for data. See out_feeder_wake().
+ */
+static void in_prefetch_wake(struct in_prefetch *prefetch)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&prefetch->consumer_waiting, __ATOMIC_RELAXED))
+        return;
+    pthread_mutex_lock(&prefetch->lock);
+    pthread_cond_signal(&prefetch->cond);
+    pthread_mutex_unlock(&prefetch->lock);
+}
+
+/**
+ * Sleeps until the ring is not empty or a blob read failed.
+ */
+static void in_prefetch_wait(struct in_prefetch *prefetch)
+{
+    pthread_mutex_lock(&prefetch->lock);
+    __atomic_store_n(&prefetch->consumer_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!prefetch->exit && !ring_readable(&prefetch->ring) &&
+            !__atomic_load_n(&prefetch->error, __ATOMIC_RELAXED))
+        pthread_cond_wait(&prefetch->cond, &prefetch->lock);
+    __atomic_store_n(&prefetch->consumer_waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&prefetch->lock);
+}
+
+static void *in_prefetch_thread(void *arg)
+{
+    struct capture_source *source = (struct capture_source *) arg;
+    struct in_prefetch *prefetch = source->prefetch;
+    uint32_t fill, rate;
+    int64_t start_ns, period_ns;
+    ssize_t ret;
+
+    set_audio_thread_priority(prefetch->priority);
+
+    for (;;) {
+        pthread_mutex_lock(&prefetch->lock);
+        bool exit = prefetch->exit;
+        rate = prefetch->sample_rate;
+        pthread_mutex_unlock(&prefetch->lock);
+        if (exit)
+            break;
+
+        period_ns = rate ? frames_to_ns(prefetch->period / prefetch->frame_size, rate) : 0;
+        start_ns = trace_now_ns();
+        ret = source->wrapped_stream->read(source->wrapped_stream, prefetch->buffer,
+                                           prefetch->period);
+        if (ret < 0) {
+            // Hand the error to in_read() and don't spin on a broken blob
+            ALOGE("%s: vendor read failed: %d", __FUNCTION__, (int) ret);
+            __atomic_store_n(&prefetch->error, (int32_t) ret, __ATOMIC_RELAXED);
+            in_prefetch_wake(prefetch);
+            usleep(period_ns / 1000);
+            continue;
+        }
+
+        if ((size_t) ret > ring_writable(&prefetch->ring)) {
+            int64_t elapsed_ns = trace_now_ns() - start_ns;
+
+            __atomic_fetch_add(&prefetch->frames_lost, ret / prefetch->frame_size,
+                               __ATOMIC_RELAXED);
+            __atomic_fetch_add(&prefetch->frames_lost_total, (uint64_t) ret / prefetch->frame_size,
+                               __ATOMIC_RELAXED);
+            __atomic_fetch_add(&prefetch->overruns, 1, __ATOMIC_RELAXED);
+            // A blob that doesn't block in read would keep this real-time
+            // thread busy while in_read() can't run
+            if (elapsed_ns < period_ns / 2)
+                usleep((period_ns - elapsed_ns) / 1000);
+            continue;
+        }
+        ring_write(&prefetch->ring, prefetch->buffer, ret);
+        fill = ring_readable(&prefetch->ring);
+        if (fill > __atomic_load_n(&prefetch->high_water, __ATOMIC_RELAXED))
+            __atomic_store_n(&prefetch->high_water, fill, __ATOMIC_RELAXED);
+        in_prefetch_wake(prefetch);
+    }
+    return NULL;
+}
+
+/**
+ * Starts the prefetch thread when the first client of source leaves
+ * standby. Called with source->lock held.
+ */
+static int in_prefetch_run(struct capture_source *source)
+{
+    struct in_prefetch *prefetch = source->prefetch;
+    int ret;
+
+    if (!prefetch || prefetch->running)
+        return 0;
+
+    ret = -pthread_create(&prefetch->thread, NULL, in_prefetch_thread, source);
+    if (ret) {
+        ALOGE("%s: failed to create prefetch thread: %d", __FUNCTION__, ret);
+        return ret;
+    }
+    prefetch->running = true;
+    return 0;
+}
+
+/**
+ * Stops the prefetch thread and drops what it read. Called with source->lock
+ * held when the last client went to standby, i.e. nobody reads the ring.
  */
-#define WRAPPED_STREAM_IN(p) (((struct wrapper_stream_in*) p)->wrapped_stream)
-#define WRAPPED_STREAM_IN_COMMON(s) (WRAPPED_STREAM_IN(s)->common)
-#define WRAPPED_STREAM_IN_COMMON_CALL(s, func, ...) ({\
-    WRAPPED_STREAM_IN_COMMON(s).func(&WRAPPED_STREAM_IN_COMMON(s), ##__VA_ARGS__); \
-})
-#define RETURN_WRAPPED_STREAM_IN_CALL(s, func, ...) ({\
-    ALOGV("%s", __FUNCTION__); \
-    return WRAPPED_STREAM_IN(s)->func(WRAPPED_STREAM_IN(s), ##__VA_ARGS__); \
-})
-#define RETURN_WRAPPED_STREAM_IN_COMMON_CALL(s, func, ...) ({\
-    ALOGV("%s", __FUNCTION__); \
-    return WRAPPED_STREAM_IN_COMMON(s).func(&WRAPPED_STREAM_IN_COMMON(s), ##__VA_ARGS__); \
-})
+static void in_prefetch_halt(struct capture_source *source)
+{
+    struct in_prefetch *prefetch = source->prefetch;
 
+    if (!prefetch || !prefetch->running)
+        return;
 
-/**
- * Stream out macros.
- */
-#define WRAPPED_STREAM_OUT(p) (((struct wrapper_stream_out*) p)->wrapped_stream)
-#define WRAPPED_STREAM_OUT_COMMON(s) (WRAPPED_STREAM_OUT(s)->common)
-#define WRAPPED_STREAM_OUT_COMMON_CALL(s, func, ...) ({\
-    WRAPPED_STREAM_OUT_COMMON(s).func(&WRAPPED_STREAM_OUT_COMMON(s), ##__VA_ARGS__); \
-})
-#define RETURN_WRAPPED_STREAM_OUT_CALL(s, func, ...) ({\
-    ALOGV("%s", __FUNCTION__); \
-    return WRAPPED_STREAM_OUT(s)->func(WRAPPED_STREAM_OUT(s), ##__VA_ARGS__); \
-})
-#define RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(s, func, ...) ({\
-    ALOGV("%s", __FUNCTION__); \
-    return WRAPPED_STREAM_OUT_COMMON(s).func(&WRAPPED_STREAM_OUT_COMMON(s), ##__VA_ARGS__); \
-})
+    pthread_mutex_lock(&prefetch->lock);
+    prefetch->exit = true;
+    pthread_cond_broadcast(&prefetch->cond);
+    pthread_mutex_unlock(&prefetch->lock);
+    pthread_join(prefetch->thread, NULL);
 
-static uint32_t out_get_sample_rate(const struct audio_stream *stream)
-{
-    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, get_sample_rate);
+    prefetch->running = false;
+    prefetch->exit = false;
+    prefetch->error = 0;
+    ring_discard(&prefetch->ring);
 }
 
-static int out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
+static void in_prefetch_free(struct capture_source *source)
 {
-    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, set_sample_rate, rate);
+    struct in_prefetch *prefetch = source->prefetch;
+
+    if (!prefetch)
+        return;
+
+    in_prefetch_halt(source);
+    source->prefetch = NULL;
+    pthread_cond_destroy(&prefetch->cond);
+    pthread_mutex_destroy(&prefetch->lock);
+    ring_free(&prefetch->ring);
+    free(prefetch->buffer);
+    free(prefetch);
 }
 
-static size_t out_get_buffer_size(const struct audio_stream *stream)
+/**
+ * Sets up a prefetch ring of periods blob buffers for source. The thread runs
+ * while a client of source is not in standby.
+ */
+static int in_prefetch_init(struct capture_source *source, int periods, int priority)
 {
-    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, get_buffer_size);
+    struct in_prefetch *prefetch;
+    size_t period = source->buffer_size;
+    int ret;
+
+    if (source->prefetch || periods <= 0 || !source->frame_size || period < source->frame_size)
+        return -EINVAL;
+
+    prefetch = (struct in_prefetch *) calloc(1, sizeof(*prefetch));
+    if (!prefetch)
+        return -ENOMEM;
+
+    prefetch->period = period - period % source->frame_size;
+    prefetch->frame_size = source->frame_size;
+    prefetch->sample_rate = source->sample_rate;
+    prefetch->priority = priority;
+    prefetch->buffer = (char *) malloc(prefetch->period);
+    ret = prefetch->buffer ? ring_init(&prefetch->ring, prefetch->period * periods) : -ENOMEM;
+    if (ret) {
+        free(prefetch->buffer);
+        free(prefetch);
+        return ret;
+    }
+
+    pthread_mutex_init(&prefetch->lock, NULL);
+    pthread_cond_init(&prefetch->cond, NULL);
+    source->prefetch = prefetch;
+    ALOGI("%s: period %zu bytes, ring %zu bytes", __FUNCTION__, prefetch->period,
+          prefetch->period * periods);
+    return 0;
 }
 
-static audio_channel_mask_t out_get_channels(const struct audio_stream *stream)
+/**
+ * Copies bytes out of the prefetch ring. When the ring is too full to take
+ * the next blob buffer the record thread fell behind; the oldest data is
+ * dropped (and counted as lost) so the latency goes back to one read instead
+ * of staying at the ring length.
+ */
+static ssize_t in_prefetch_read(struct in_prefetch *prefetch, void *buffer, size_t bytes)
 {
-    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, get_channels);
+    size_t done = 0, skip;
+    uint32_t fill;
+    int32_t error;
+
+    fill = ring_readable(&prefetch->ring);
+    if (fill + prefetch->period > prefetch->ring.capacity && fill > bytes) {
+        skip = fill - bytes;
+        skip = ring_skip(&prefetch->ring, skip - skip % prefetch->frame_size);
+        __atomic_fetch_add(&prefetch->frames_lost, skip / prefetch->frame_size,
+                           __ATOMIC_RELAXED);
+        __atomic_fetch_add(&prefetch->frames_lost_total, (uint64_t) skip / prefetch->frame_size,
+                           __ATOMIC_RELAXED);
+    }
+
+    while (done < bytes) {
+        done += ring_read(&prefetch->ring, (char *) buffer + done, bytes - done);
+        if (done == bytes)
+            break;
+        error = __atomic_exchange_n(&prefetch->error, 0, __ATOMIC_RELAXED);
+        if (error)
+            return done ? (ssize_t) done : error;
+        in_prefetch_wait(prefetch);
+    }
+    return bytes;
 }
 
-static audio_format_t out_get_format(const struct audio_stream *stream)
+/**
+ * Reads from the prefetch ring if the source has one, from the blob
+ * otherwise. Only one client at a time, see struct capture_source.
+ */
+static ssize_t capture_source_read(struct capture_source *source, void *buffer, size_t bytes)
 {
-    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, get_format);
+    if (source->prefetch)
+        return in_prefetch_read(source->prefetch, buffer, bytes);
+    return source->wrapped_stream->read(source->wrapped_stream, buffer, bytes);
 }
 
-static int out_set_format(struct audio_stream *stream, audio_format_t format)
+/**
+ * Reads the attributes of the blob's input. Called with source->lock held
+ * or before other clients can see source.
+ */
+static void capture_source_refresh(struct capture_source *source)
 {
-    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, set_format, format);
+    struct wrapper::audio_stream *common = &source->wrapped_stream->common;
+
+    source->sample_rate = common->get_sample_rate(common);
+    source->channels = common->get_channels(common);
+    source->format = common->get_format(common);
+    source->buffer_size = common->get_buffer_size(common);
+    source->frame_size = popcount(source->channels) *
+        audio_bytes_per_sample((audio_format_t) source->format);
+    // The prefetch thread can't take source->lock, in_prefetch_halt() joins
+    // it with the lock held
+    if (source->prefetch) {
+        pthread_mutex_lock(&source->prefetch->lock);
+        source->prefetch->sample_rate = source->sample_rate;
+        pthread_mutex_unlock(&source->prefetch->lock);
+    }
 }
 
-static int out_standby(struct audio_stream *stream)
+/**
+ * Answers keys for all clients of source, from the cache if it can.
+ */
+static char * capture_source_get_parameters(struct capture_source *source, const char *keys)
 {
-    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, standby);
+    uint32_t generation;
+    char * kvpairs = param_cache_get(&source->parameters, keys, &generation);
+
+    if (kvpairs)
+        return kvpairs;
+    kvpairs = source->wrapped_stream->common.get_parameters(&source->wrapped_stream->common,
+                                                            keys);
+    kvpairs = fixup_returned_audio_parameters(kvpairs, ICS_TO_JB);
+    param_cache_put(&source->parameters, keys, kvpairs, generation);
+    return kvpairs;
 }
 
-static int out_dump(const struct audio_stream *stream, int fd)
+/**
+ * Makes in the first client of the blob input it opened.
+ */
+static int capture_source_create(struct wrapper_audio_device *adev,
+                                 struct wrapper_stream_in *in, uint32_t devices)
 {
-    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, dump, fd);
+    struct capture_source *source;
+    int ret;
+
+    source = (struct capture_source *) calloc(1, sizeof(*source));
+    if (!source)
+        return -ENOMEM;
+
+    source->dev = adev;
+    source->wrapped_stream = in->wrapped_stream;
+    source->devices = devices;
+    source->standby = true;
+    capture_source_refresh(source);
+    pthread_mutex_init(&source->lock, NULL);
+    pthread_cond_init(&source->cond, NULL);
+    param_cache_init(&source->parameters, adev->param_cache);
+    routing_init(&source->routing);
+
+    if (adev->capture_prefetch_periods > 0) {
+        ret = in_prefetch_init(source, adev->capture_prefetch_periods,
+                               adev->async_write_priority);
+        ALOGW_IF(ret, "%s: no capture prefetch, reading the blob directly (%d)", __FUNCTION__,
+                 ret);
+    }
+
+    source->clients = in;
+    source->client_count = 1;
+    in->source = source;
+    source->next = adev->capture_sources;
+    adev->capture_sources = source;
+#ifndef ICS_AUDIO_BLOB
+    for (size_t i = 0; i < sizeof(static_stream_keys) / sizeof(static_stream_keys[0]); i++)
+        free(capture_source_get_parameters(source, static_stream_keys[i]));
+#endif
+    return 0;
 }
 
-static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
+/**
+ * Frees source after its last client detached. The blob input is closed by
+ * the caller.
+ */
+static void capture_source_free(struct wrapper_audio_device *adev, struct capture_source *source)
 {
-    ALOGI("%s: kvpairs: %s", __FUNCTION__, kvpairs);
-    int ret;
-    char * fixed_kvpairs = fixup_audio_parameters(kvpairs, JB_TO_ICS);
-    ret = WRAPPED_STREAM_OUT_COMMON_CALL(stream, set_parameters, fixed_kvpairs);
-    free(fixed_kvpairs);
-    return ret;
+    struct capture_source **p;
+
+    for (p = &adev->capture_sources; *p; p = &(*p)->next) {
+        if (*p == source) {
+            *p = source->next;
+            break;
+        }
+    }
+    in_prefetch_free(source);
+    param_cache_free(&source->parameters);
+    pthread_mutex_destroy(&source->routing.lock);
+    pthread_cond_destroy(&source->cond);
+    pthread_mutex_destroy(&source->lock);
+    free(source->ring);
+    free(source->buffer);
+    free(source);
 }
 
-static char * out_get_parameters(const struct audio_stream *stream, const char *keys)
+static struct capture_source *capture_source_find(struct wrapper_audio_device *adev,
+                                                  uint32_t devices)
 {
-    ALOGI("%s: keys: %s", __FUNCTION__, keys);
-    char * kvpairs = WRAPPED_STREAM_OUT_COMMON_CALL(stream, get_parameters, keys);
-    char * fixed_kvpairs = fixup_audio_parameters(kvpairs, ICS_TO_JB);
-    free(kvpairs);
-    return fixed_kvpairs;
+    struct capture_source *source;
+
+    for (source = adev->capture_sources; source; source = source->next) {
+        if (source->devices == devices)
+            return source;
+    }
+    return NULL;
 }
 
-static uint32_t out_get_latency(const struct audio_stream_out *stream)
+/**
+ * Adds in as a client of source. The shared ring is allocated for the second
+ * client and the cursors start at the current position.
+ */
+static int capture_source_attach(struct capture_source *source, struct wrapper_stream_in *in)
 {
-    RETURN_WRAPPED_STREAM_OUT_CALL(stream, get_latency);
+    struct wrapper_stream_in *client;
+
+    pthread_mutex_lock(&source->lock);
+    if (!source->ring) {
+        size_t bytes = source->buffer_size - source->buffer_size % source->frame_size;
+
+        source->buffer = (char *) malloc(bytes);
+        source->ring = (char *) malloc(bytes * CAPTURE_SOURCE_RING_BUFFERS);
+        if (!bytes || !source->buffer || !source->ring) {
+            free(source->buffer);
+            free(source->ring);
+            source->buffer = source->ring = NULL;
+            pthread_mutex_unlock(&source->lock);
+            return bytes ? -ENOMEM : -EINVAL;
+        }
+        source->buffer_bytes = bytes;
+        source->ring_size = bytes * CAPTURE_SOURCE_RING_BUFFERS;
+    }
+    if (source->client_count == 1) {
+        for (client = source->clients; client; client = client->next)
+            client->cursor = source->write_pos;
+    }
+
+    in->source = source;
+    in->wrapped_stream = source->wrapped_stream;
+    in->cursor = source->write_pos;
+    in->next = source->clients;
+    source->clients = in;
+    source->client_count++;
+    pthread_mutex_unlock(&source->lock);
+    return 0;
 }
 
-static int out_set_volume(struct audio_stream_out *stream, float left,
-                          float right)
+/**
+ * Removes in from its source. Returns true if it was the last client and the
+ * blob input has to be closed.
+ */
+static bool capture_source_detach(struct wrapper_stream_in *in)
 {
-    RETURN_WRAPPED_STREAM_OUT_CALL(stream, set_volume, left, right);
+    struct capture_source *source = in->source;
+    struct wrapper_stream_in **p;
+    bool last;
+
+    pthread_mutex_lock(&source->lock);
+    if (in->active) {
+        in->active = false;
+        source->active--;
+    }
+    for (p = &source->clients; *p; p = &(*p)->next) {
+        if (*p == in) {
+            *p = in->next;
+            break;
+        }
+    }
+    source->client_count--;
+    last = !source->client_count;
+    if (!last && !source->active && !source->standby) {
+        in_prefetch_halt(source);
+        source->wrapped_stream->common.standby(&source->wrapped_stream->common);
+        source->standby = true;
+    }
+    pthread_mutex_unlock(&source->lock);
+    return last;
 }
 
-static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
-                         size_t bytes)
+/**
+ * Marks in as capturing before its first read after standby. The first active
+ * client starts the prefetch thread. state is set to the standby state the
+ * source was in, STREAM_ACTIVE if in was capturing already.
+ */
+static int in_activate(struct wrapper_stream_in *in, int *state)
 {
-    RETURN_WRAPPED_STREAM_OUT_CALL(stream, write, buffer, bytes);
+    struct capture_source *source = in->source;
+    int ret;
+
+    *state = STREAM_ACTIVE;
+    if (in->active)
+        return 0;
+
+    pthread_mutex_lock(&source->lock);
+    ret = source->active ? 0 : in_prefetch_run(source);
+    if (!ret) {
+        *state = source->standby ? STREAM_STANDBY : STREAM_STANDBY_PENDING;
+        source->standby = false;
+        in->active = true;
+        in->cursor = source->write_pos;
+        source->active++;
+    }
+    pthread_mutex_unlock(&source->lock);
+    return ret;
 }
 
-static int out_get_render_position(const struct audio_stream_out *stream,
-                                   uint32_t *dsp_frames)
+/**
+ * Copies bytes from the shared ring at the cursor of in. If the ring has
+ * nothing new and no other client reads the blob, in reads the next blob
+ * buffer into it. Called with source->lock held.
+ */
+static ssize_t in_read_shared(struct wrapper_stream_in *in, void *buffer, size_t bytes)
 {
-    RETURN_WRAPPED_STREAM_OUT_CALL(stream, get_render_position, dsp_frames);
+    struct capture_source *source = in->source;
+    size_t done = 0, n, offset, first;
+    ssize_t ret = 0;
+
+    while (done < bytes) {
+        if (source->write_pos - in->cursor > source->ring_size) {
+            uint64_t behind = source->write_pos - source->ring_size - in->cursor;
+            in->frames_lost += behind / source->frame_size;
+            in->cursor += behind;
+        }
+
+        if (in->cursor < source->write_pos) {
+            n = source->write_pos - in->cursor;
+            n = n < bytes - done ? n : bytes - done;
+            offset = in->cursor % source->ring_size;
+            first = source->ring_size - offset < n ? source->ring_size - offset : n;
+            memcpy((char *) buffer + done, source->ring + offset, first);
+            memcpy((char *) buffer + done + first, source->ring, n - first);
+            in->cursor += n;
+            done += n;
+            continue;
+        }
+
+        if (source->reading) {
+            pthread_cond_wait(&source->cond, &source->lock);
+            continue;
+        }
+
+        source->reading = true;
+        pthread_mutex_unlock(&source->lock);
+        ret = capture_source_read(source, source->buffer, source->buffer_bytes);
+        pthread_mutex_lock(&source->lock);
+        source->reading = false;
+        if (ret > 0) {
+            offset = source->write_pos % source->ring_size;
+            first = source->ring_size - offset < (size_t) ret ? source->ring_size - offset : ret;
+            memcpy(source->ring + offset, source->buffer, first);
+            memcpy(source->ring, source->buffer + first, ret - first);
+            source->write_pos += ret;
+        }
+        pthread_cond_broadcast(&source->cond);
+        if (ret <= 0)
+            break;
+    }
+
+    return done ? (ssize_t) done : ret;
 }
 
-static int out_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
+/**
+ * Reads bytes of blob frames for in, straight from the blob (zero copy) if
+ * it is the only client of the source and through the shared ring otherwise.
+ */
+static ssize_t in_read_source(struct wrapper_stream_in *in, void *buffer, size_t bytes)
 {
-    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, add_audio_effect, effect);
+    struct capture_source *source = in->source;
+    ssize_t ret;
+
+    pthread_mutex_lock(&source->lock);
+    if (source->client_count > 1) {
+        ret = in_read_shared(in, buffer, bytes);
+    } else {
+        // A client that just detached may still be reading
+        while (source->reading)
+            pthread_cond_wait(&source->cond, &source->lock);
+        source->reading = true;
+        pthread_mutex_unlock(&source->lock);
+        ret = capture_source_read(source, buffer, bytes);
+        pthread_mutex_lock(&source->lock);
+        source->reading = false;
+        pthread_cond_broadcast(&source->cond);
+    }
+    pthread_mutex_unlock(&source->lock);
+    return ret;
 }
 
-static int out_remove_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
+/**
+ * Reads bytes at the rate of the blob and the channel count of in, i.e.
+ * converts mono and stereo for clients that attached with the other one.
+ */
+static ssize_t in_read_blob(struct wrapper_stream_in *in, void *buffer, size_t bytes)
 {
-    RETURN_WRAPPED_STREAM_OUT_COMMON_CALL(stream, remove_audio_effect, effect);
+    struct capture_source *source = in->source;
+    unsigned channels = popcount(in->channels);
+    size_t frames, size;
+    ssize_t ret;
+
+    if (!in->channels)
+        return in_read_source(in, buffer, bytes);
+
+    frames = bytes / (channels * sizeof(int16_t));
+    size = frames * source->frame_size;
+    if (size > in->convert_buffer_size) {
+        int16_t *convert_buffer = (int16_t *) realloc(in->convert_buffer, size);
+        if (!convert_buffer)
+            return -ENOMEM;
+        in->convert_buffer = convert_buffer;
+        in->convert_buffer_size = size;
+    }
+
+    ret = in_read_source(in, in->convert_buffer, size);
+    if (ret <= 0)
+        return ret;
+    frames = ret / source->frame_size;
+    if (channels == 2)
+        pcm_mono_to_stereo_16((int16_t *) buffer, in->convert_buffer, frames);
+    else
+        pcm_stereo_to_mono_16((int16_t *) buffer, in->convert_buffer, frames);
+    return frames * channels * sizeof(int16_t);
 }
 
-#if 0
-#ifndef ICS_AUDIO_BLOB
-static int out_get_next_write_timestamp(const struct audio_stream_out *stream,
-                                        int64_t *timestamp)
+/**
+ * Called after a client changed the blob input. All clients of the source
+ * read their attributes again.
+ */
+static void in_reconfigured(struct wrapper_stream_in *in)
 {
-    ALOGD("%s", __FUNCTION__);
-    return android::INVALID_OPERATION;
-    //RETURN_WRAPPED_STREAM_OUT_CALL(stream, get_next_write_timestamp, timestamp);
+    struct capture_source *source = in->source;
+    struct wrapper_stream_in *client;
+
+    pthread_mutex_lock(&source->lock);
+    capture_source_refresh(source);
+    for (client = source->clients; client; client = client->next)
+        invalidate_stream_attributes(&client->attributes);
+    pthread_mutex_unlock(&source->lock);
+    param_cache_clear(&source->parameters);
 }
-#endif
-#endif
 
-/** audio_stream_in implementation **/
 static uint32_t in_get_sample_rate(const struct audio_stream *stream)
 {
-    RETURN_WRAPPED_STREAM_IN_COMMON_CALL(stream, get_sample_rate);
+    return in_attributes(stream).sample_rate;
 }
 
 static int in_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 {
-    RETURN_WRAPPED_STREAM_IN_COMMON_CALL(stream, set_sample_rate, rate);
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_in_set_sample_rate, stream);
+    int ret = WRAPPED_STREAM_IN_COMMON_CALL(stream, set_sample_rate, rate);
+    in_reconfigured((struct wrapper_stream_in *) stream);
+    return TRACE_RETURN(ret);
 }
 
 static size_t in_get_buffer_size(const struct audio_stream *stream)
 {
-    RETURN_WRAPPED_STREAM_IN_COMMON_CALL(stream, get_buffer_size);
+    return in_attributes(stream).buffer_size;
 }
 
 static audio_channel_mask_t in_get_channels(const struct audio_stream *stream)
 {
-    RETURN_WRAPPED_STREAM_IN_COMMON_CALL(stream, get_channels);
+    return (audio_channel_mask_t) in_attributes(stream).channels;
 }
 
 static audio_format_t in_get_format(const struct audio_stream *stream)
 {
-    RETURN_WRAPPED_STREAM_IN_COMMON_CALL(stream, get_format);
+    return (audio_format_t) in_attributes(stream).format;
 }
 
 static int in_set_format(struct audio_stream *stream, audio_format_t format)
 {
-    RETURN_WRAPPED_STREAM_IN_COMMON_CALL(stream, set_format, format);
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_in_set_format, stream);
+    int ret = WRAPPED_STREAM_IN_COMMON_CALL(stream, set_format, format);
+    in_reconfigured((struct wrapper_stream_in *) stream);
+    return TRACE_RETURN(ret);
 }
 
+/**
+ * The blob input only goes to standby with the last active client of the
+ * source.
+ */
 static int in_standby(struct audio_stream *stream)
 {
-    RETURN_WRAPPED_STREAM_IN_COMMON_CALL(stream, standby);
+    struct wrapper_stream_in *in = (struct wrapper_stream_in *) stream;
+    struct capture_source *source = in->source;
+    int ret = 0;
+
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_in_standby, stream);
+    if (in->resampler) {
+        resampler_reset(in->resampler);
+        in->resample_frames = 0;
+    }
+
+    pthread_mutex_lock(&source->lock);
+    STATS_ADD(in->standby_stats.requests, 1);
+    if (in->active) {
+        in->active = false;
+        source->active--;
+    } else if (source->standby) {
+        STATS_ADD(in->standby_stats.dropped, 1);
+    }
+    if (!source->active && !source->standby) {
+        in_prefetch_halt(source);
+        ret = WRAPPED_STREAM_IN_COMMON_CALL(stream, standby);
+        source->standby = true;
+        STATS_ADD(in->standby_stats.entered, 1);
+    }
+    pthread_mutex_unlock(&source->lock);
+    return TRACE_RETURN(ret);
 }
 
 static int in_dump(const struct audio_stream *stream, int fd)
 {
+    struct wrapper_stream_in *in = (struct wrapper_stream_in *) stream;
+    struct capture_source *source = in->source;
+    unsigned client_count, active;
+    uint32_t source_channels;
+    uint64_t unread;
+    size_t ring_size;
+
+    // The read path and other clients change these under the lock
+    pthread_mutex_lock(&source->lock);
+    client_count = source->client_count;
+    active = source->active;
+    source_channels = source->channels;
+    unread = source->write_pos - in->cursor;
+    ring_size = source->ring_size;
+    pthread_mutex_unlock(&source->lock);
+
+    dump_printf(fd, "  Wrapper input stream %p:\n", stream);
+    if (in->resampler)
+        dump_printf(fd, "    resampling %u to %u Hz, %u taps, delay %u frames\n",
+                    in_attributes(stream).blob_sample_rate, in->sample_rate,
+                    resampler_taps(in->resampler), resampler_delay(in->resampler));
+    if (in->channels)
+        dump_printf(fd, "    channels 0x%x converted from 0x%x\n", in->channels,
+                    source_channels);
+    if (client_count > 1)
+        dump_printf(fd, "    shared capture: %u clients, %u active, %llu of %zu ring bytes unread\n",
+                    client_count, active, (unsigned long long) unread, ring_size);
+    if (in->source->prefetch)
+        dump_printf(fd, "    prefetch: period %zu bytes, ring %u/%u bytes, high water %u bytes, "
+                    "%u overruns, %llu frames lost\n", in->source->prefetch->period,
+                    ring_readable(&in->source->prefetch->ring),
+                    in->source->prefetch->ring.capacity,
+                    __atomic_load_n(&in->source->prefetch->high_water, __ATOMIC_RELAXED),
+                    __atomic_load_n(&in->source->prefetch->overruns, __ATOMIC_RELAXED),
+                    (unsigned long long) __atomic_load_n(&in->source->prefetch->frames_lost_total,
+                                                         __ATOMIC_RELAXED));
+    standby_stats_dump(&in->standby_stats, fd);
+    param_cache_dump(&in->source->parameters, fd);
+    routing_dump(&in->source->routing, fd);
+    stream_stats_dump(&in->read_stats, fd, "read");
     RETURN_WRAPPED_STREAM_IN_COMMON_CALL(stream, dump, fd);
 }
 
 static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
 {
-    ALOGI("%s: kvpairs: %s", __FUNCTION__, kvpairs);
+    WLOGI(WRAPPER_LOG_HW, "%s: kvpairs: %s", __FUNCTION__, kvpairs);
+    TRACE_SCOPE(TRACE_in_set_parameters, stream);
+    SCRATCH_SCOPE();
+    const char * fixed_kvpairs;
+    struct capture_source *source = ((struct wrapper_stream_in *) stream)->source;
+    uint32_t *epoch = &source->dev->routing_epoch;
+    bool routes;
     int ret;
-    char * fixed_kvpairs = fixup_audio_parameters(kvpairs, JB_TO_ICS);
+
+    kvpairs = routing_filter(&source->routing, epoch, kvpairs, &routes);
+    if (!kvpairs) {
+        routing_done(&source->routing, epoch, false, 0);
+        return TRACE_RETURN(-ENOMEM);
+    }
+    if (!*kvpairs) {
+        routing_done(&source->routing, epoch, routes, 0);
+        return TRACE_RETURN(0);
+    }
+    fixed_kvpairs = fixup_audio_parameters_scratch(kvpairs, JB_TO_ICS);
+    if (!fixed_kvpairs) {
+        routing_done(&source->routing, epoch, false, 0);
+        return TRACE_RETURN(-ENOMEM);
+    }
     ret = WRAPPED_STREAM_IN_COMMON_CALL(stream, set_parameters, fixed_kvpairs);
-    free(fixed_kvpairs);
-    return ret;
+    routing_done(&source->routing, epoch, routes, ret);
+    param_cache_invalidate(&source->parameters, kvpairs);
+    if (changes_stream_attributes(kvpairs))
+        in_reconfigured((struct wrapper_stream_in *) stream);
+    return TRACE_RETURN(ret);
 }
 
 static char * in_get_parameters(const struct audio_stream *stream,
                                 const char *keys)
 {
-    ALOGI("%s: keys: %s", __FUNCTION__, keys);
-    char * kvpairs = WRAPPED_STREAM_IN_COMMON_CALL(stream, get_parameters, keys);
-    char * fixed_kvpairs = fixup_audio_parameters(kvpairs, ICS_TO_JB);
-    free(kvpairs);
-    return fixed_kvpairs;
+    WLOGI(WRAPPER_LOG_HW, "%s: keys: %s", __FUNCTION__, keys);
+    TRACE_SCOPE(TRACE_in_get_parameters, stream);
+    return capture_source_get_parameters(((const struct wrapper_stream_in *) stream)->source,
+                                         keys);
 }
 
 static int in_set_gain(struct audio_stream_in *stream, float gain)
@@ -263,15 +2648,112 @@ static int in_set_gain(struct audio_stream_in *stream, float gain)
     RETURN_WRAPPED_STREAM_IN_CALL(stream, set_gain, gain);
 }
 
+/**
+ * Fills buffer with bytes at the client rate. Reads one blob buffer at a time
+ * and keeps the resampled frames that didn't fit for the next call. Returns
+ * the bytes read or the error of the blob if nothing was read.
+ */
+static ssize_t in_read_resampled(struct wrapper_stream_in *in, void *buffer, size_t bytes)
+{
+    const struct stream_attributes attr = in_attributes(&in->stream.common);
+    size_t frame_size = popcount(attr.channels) * sizeof(int16_t);
+    size_t frames = bytes / frame_size, done = 0, blob_bytes, size;
+    ssize_t ret;
+
+    // One blob buffer, at the channel count of in
+    if (!in->source->frame_size)
+        return -EINVAL;
+    blob_bytes = in->source->buffer_size / in->source->frame_size * frame_size;
+    if (!blob_bytes)
+        return -EINVAL;
+
+    if (blob_bytes > in->read_buffer_size) {
+        int16_t *read_buffer = (int16_t *) realloc(in->read_buffer, blob_bytes);
+        if (!read_buffer)
+            return -ENOMEM;
+        in->read_buffer = read_buffer;
+        in->read_buffer_size = blob_bytes;
+    }
+    size = resampler_max_output(in->resampler, blob_bytes / frame_size) * frame_size;
+    if (size > in->resample_buffer_size) {
+        int16_t *resample_buffer = (int16_t *) realloc(in->resample_buffer, size);
+        if (!resample_buffer)
+            return -ENOMEM;
+        in->resample_buffer = resample_buffer;
+        in->resample_buffer_size = size;
+    }
+
+    while (done < frames) {
+        size_t n;
+
+        if (!in->resample_frames) {
+            ret = in_read_blob(in, in->read_buffer, blob_bytes);
+            if (ret <= 0)
+                return done ? (ssize_t) (done * frame_size) : ret;
+            in->resample_offset = 0;
+            in->resample_frames = resampler_process(in->resampler, in->read_buffer,
+                                                    ret / frame_size, in->resample_buffer);
+            continue;
+        }
+
+        n = frames - done < in->resample_frames ? frames - done : in->resample_frames;
+        memcpy((char *) buffer + done * frame_size,
+               (const char *) in->resample_buffer + in->resample_offset * frame_size,
+               n * frame_size);
+        in->resample_offset += n;
+        in->resample_frames -= n;
+        done += n;
+    }
+
+    return done * frame_size;
+}
+
 static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
                        size_t bytes)
 {
-    RETURN_WRAPPED_STREAM_IN_CALL(stream, read, buffer, bytes);
+    struct wrapper_stream_in *in = (struct wrapper_stream_in *) stream;
+    int64_t start_ns = trace_now_ns(), end_ns;
+    int resumed;
+    ssize_t ret;
+
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_in_read, stream);
+    ret = in_activate(in, &resumed);
+    if (!ret && in->resampler)
+        ret = in_read_resampled(in, buffer, bytes);
+    else if (!ret)
+        ret = in_read_blob(in, buffer, bytes);
+    end_ns = trace_now_ns();
+    stream_stats_add(&in->read_stats, start_ns, end_ns, ret);
+    standby_stats_resumed(&in->standby_stats, resumed, start_ns, end_ns);
+    return TRACE_RETURN(ret);
 }
 
 static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
 {
-    RETURN_WRAPPED_STREAM_IN_CALL(stream, get_input_frames_lost);
+    struct wrapper_stream_in *in = (struct wrapper_stream_in *) stream;
+    struct stream_attributes attr;
+    uint32_t lost;
+
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_in_get_input_frames_lost, stream);
+    lost = WRAPPED_STREAM_IN(stream)->get_input_frames_lost(WRAPPED_STREAM_IN(stream));
+
+    // The blob doesn't know about the buffers the prefetch thread dropped or
+    // this input missed in the shared ring. What the blob and the prefetch
+    // thread lost goes to the first client that asks.
+    if (in->source->prefetch)
+        lost += __atomic_exchange_n(&in->source->prefetch->frames_lost, 0, __ATOMIC_RELAXED);
+    // in_read_shared() counts under the lock
+    pthread_mutex_lock(&in->source->lock);
+    lost += in->frames_lost;
+    in->frames_lost = 0;
+    pthread_mutex_unlock(&in->source->lock);
+    if (!in->resampler || !lost)
+        return TRACE_RETURN(lost);
+    // The blob counts at its own rate
+    attr = in_attributes(&stream->common);
+    return TRACE_RETURN((uint32_t) ((uint64_t) lost * in->sample_rate / attr.blob_sample_rate));
 }
 
 static int in_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
@@ -298,25 +2780,67 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
                               struct audio_stream_out **stream_out)
 #endif
 {
+    struct wrapper_audio_device *adev = (struct wrapper_audio_device *) dev;
     struct wrapper_stream_out *out;
+#ifndef ICS_AUDIO_BLOB
+    int *format = (int *) &config->format;
+    uint32_t *channels = &config->channel_mask;
+    uint32_t *sample_rate = &config->sample_rate;
+#endif
+    uint32_t requested_rate = *sample_rate;
     int ret;
     ALOGI("%s: devices 0x%x", __FUNCTION__, devices);
+    TRACE_SCOPE(TRACE_adev_open_output_stream, dev);
 
     out = (struct wrapper_stream_out *)calloc(1, sizeof(struct wrapper_stream_out));
     if (!out)
-        return -ENOMEM;
+        return TRACE_RETURN(-ENOMEM);
+    pthread_mutex_init(&out->standby_lock, NULL);
+    attributes_init(&out->attributes);
+    out->standby_state = STREAM_STANDBY;
+    param_cache_init(&out->parameters, adev->param_cache);
+    routing_init(&out->routing);
 
 
     devices = convert_audio_devices(devices, JB_TO_ICS);
 
-#ifdef ICS_AUDIO_BLOB
+    // ICS blobs only take 16 bit PCM, out_write() converts the higher
+    // precision formats
+    if (*format == AUDIO_FORMAT_PCM_32_BIT || *format == AUDIO_FORMAT_PCM_8_24_BIT) {
+        out->format = (audio_format_t) *format;
+        *format = AUDIO_FORMAT_PCM_16_BIT;
+    }
+
     ret = WRAPPED_DEVICE_CALL(dev, open_output_stream, devices, format, channels, sample_rate,
                               &WRAPPED_STREAM_OUT(out));
-#else
-    ret = WRAPPED_DEVICE_CALL(dev, open_output_stream, devices, (int *)&config->format,
-                              &config->channel_mask, &config->sample_rate,
-                              &WRAPPED_STREAM_OUT(out));
-#endif
+
+    // The blob rejected the rate and suggested its own or silently replaced
+    // it. Open it at its rate and resample in out_write() instead of letting
+    // AudioFlinger resample every track.
+    if (requested_rate && *sample_rate && *sample_rate != requested_rate &&
+            *format == AUDIO_FORMAT_PCM_16_BIT &&
+            adev->resampler_quality != RESAMPLER_QUALITY_OFF) {
+        if (ret < 0)
+            ret = WRAPPED_DEVICE_CALL(dev, open_output_stream, devices, format, channels,
+                                      sample_rate, &WRAPPED_STREAM_OUT(out));
+        if (!ret) {
+            out->resampler = resampler_create(requested_rate, *sample_rate, popcount(*channels),
+                                              adev->resampler_quality);
+            ALOGW_IF(!out->resampler, "%s: can't resample %u to %u Hz", __FUNCTION__,
+                     requested_rate, *sample_rate);
+        }
+        if (out->resampler) {
+            out->sample_rate = requested_rate;
+            *sample_rate = requested_rate;
+        }
+    }
+
+    if (out->format != AUDIO_FORMAT_DEFAULT) {
+        if (*format == AUDIO_FORMAT_PCM_16_BIT)
+            *format = out->format;
+        else
+            out->format = AUDIO_FORMAT_DEFAULT;
+    }
 
     if(ret < 0)
         goto err_open;
@@ -338,48 +2862,141 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->stream.write = out_write;
     out->stream.get_render_position = out_get_render_position;
 #ifndef ICS_AUDIO_BLOB
-    out->stream.get_next_write_timestamp = NULL; //out_get_next_write_timestamp;
+    out->stream.get_next_write_timestamp = out_get_next_write_timestamp;
+#endif
+
+    out->dev = (struct wrapper_audio_device *) dev;
+    __atomic_load(&out->dev->master_gain, &out->gain, __ATOMIC_RELAXED);
+    pcm_dither_init(&out->dither, (uint32_t) (uintptr_t) out);
+
+#ifndef ICS_AUDIO_BLOB
+    // The ICS API has no output flags, every output is a separate output
+    // stream of the blob. Deep buffer and fast outputs only change how the
+    // wrapper buffers the writes to that stream.
+    if ((flags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) && out->dev->deep_buffer_periods > 0) {
+        ret = out_feeder_start(out, out->dev->deep_buffer_periods, 2, 1, false, 0);
+        ALOGW_IF(ret, "%s: no deep buffer, using the blob directly (%d)", __FUNCTION__, ret);
+    }
+    if ((flags & AUDIO_OUTPUT_FLAG_FAST) && out->dev->fast_output_split > 0) {
+        ret = out_set_fast_output(out, out->dev->fast_output_split);
+        ALOGW_IF(ret, "%s: no fast output, using the blob directly (%d)", __FUNCTION__, ret);
+    }
+#endif
+    if (!out->feeder && out->dev->async_write_periods > 0) {
+        ret = out_feeder_start(out, 1, out->dev->async_write_periods, 1, true,
+                               out->dev->async_write_priority);
+        ALOGW_IF(ret, "%s: no async writes, using the blob directly (%d)", __FUNCTION__, ret);
+    }
+
+    // Drop what was read while the stream was set up
+    invalidate_stream_attributes(&out->attributes);
+    out_attributes(&out->stream.common);
+#ifndef ICS_AUDIO_BLOB
+    for (size_t i = 0; i < sizeof(static_stream_keys) / sizeof(static_stream_keys[0]); i++)
+        free(out_get_parameters(&out->stream.common, static_stream_keys[i]));
 #endif
 
+    if (adev->standby_delay_ms > 0) {
+        pthread_mutex_lock(&adev->standby_lock);
+        out->next_delayed = adev->delayed_outputs;
+        adev->delayed_outputs = out;
+        pthread_mutex_unlock(&adev->standby_lock);
+    }
+
     *stream_out = &out->stream;
     return 0;
 
 err_open:
+    param_cache_free(&out->parameters);
+    pthread_mutex_destroy(&out->routing.lock);
+    pthread_mutex_destroy(&out->standby_lock);
+    pthread_mutex_destroy(&out->attributes.lock);
     free(out);
     *stream_out = NULL;
-    return ret;
+    return TRACE_RETURN(ret);
 }
 
 static void adev_close_output_stream(struct audio_hw_device *dev,
                                      struct audio_stream_out *stream)
 {
+    struct wrapper_audio_device *adev = (struct wrapper_audio_device *) dev;
+    struct wrapper_stream_out **p;
+
+    TRACE_SCOPE(TRACE_adev_close_output_stream, stream);
+    pthread_mutex_lock(&adev->standby_lock);
+    for (p = &adev->delayed_outputs; *p; p = &(*p)->next_delayed) {
+        if (*p == (struct wrapper_stream_out *) stream) {
+            *p = (*p)->next_delayed;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&adev->standby_lock);
+    out_feeder_stop((struct wrapper_stream_out *) stream);
     WRAPPED_DEVICE_CALL(dev, close_output_stream, WRAPPED_STREAM_OUT(stream));
+    pthread_mutex_destroy(&((struct wrapper_stream_out *) stream)->attributes.lock);
+    free(((struct wrapper_stream_out *) stream)->gain_buffer);
+    free(((struct wrapper_stream_out *) stream)->convert_buffer);
+    resampler_free(((struct wrapper_stream_out *) stream)->resampler);
+    free(((struct wrapper_stream_out *) stream)->resample_buffer);
+    pthread_mutex_destroy(&((struct wrapper_stream_out *) stream)->standby_lock);
+    param_cache_free(&((struct wrapper_stream_out *) stream)->parameters);
+    pthread_mutex_destroy(&((struct wrapper_stream_out *) stream)->routing.lock);
     free(stream);
 }
 
 static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
 {
-    ALOGI("%s: kvpairs: %s", __FUNCTION__, kvpairs);
-    char *fixed_kvpairs = fixup_audio_parameters(kvpairs, JB_TO_ICS);
-    int ret = WRAPPED_DEVICE_CALL(dev, set_parameters, fixed_kvpairs);
-    free(fixed_kvpairs);
-    return ret;
+    WLOGI(WRAPPER_LOG_HW, "%s: kvpairs: %s", __FUNCTION__, kvpairs);
+    TRACE_SCOPE(TRACE_adev_set_parameters, dev);
+    SCRATCH_SCOPE();
+    struct wrapper_audio_device *adev = (struct wrapper_audio_device *) dev;
+    const char *fixed_kvpairs;
+    uint32_t *epoch = &adev->routing_epoch;
+    bool routes;
+    int ret;
+
+    kvpairs = routing_filter(&adev->routing, epoch, kvpairs, &routes);
+    if (!kvpairs) {
+        routing_done(&adev->routing, epoch, false, 0);
+        return TRACE_RETURN(-ENOMEM);
+    }
+    if (!*kvpairs) {
+        routing_done(&adev->routing, epoch, routes, 0);
+        return TRACE_RETURN(0);
+    }
+    fixed_kvpairs = fixup_audio_parameters_scratch(kvpairs, JB_TO_ICS);
+    if (!fixed_kvpairs) {
+        routing_done(&adev->routing, epoch, false, 0);
+        return TRACE_RETURN(-ENOMEM);
+    }
+    ret = WRAPPED_DEVICE_CALL(dev, set_parameters, fixed_kvpairs);
+    routing_done(&adev->routing, epoch, routes, ret);
+    param_cache_invalidate(&adev->parameters, kvpairs);
+    return TRACE_RETURN(ret);
 }
 
 static char * adev_get_parameters(const struct audio_hw_device *dev,
                                   const char *keys)
 {
-    ALOGI("%s: keys: %s", __FUNCTION__, keys);
-    char *kvpairs = WRAPPED_DEVICE_CALL(dev, get_parameters, keys);
-    char *fixed_kvpairs = fixup_audio_parameters(kvpairs, ICS_TO_JB);
-    free(kvpairs);
-    return fixed_kvpairs;
+    WLOGI(WRAPPER_LOG_HW, "%s: keys: %s", __FUNCTION__, keys);
+    TRACE_SCOPE(TRACE_adev_get_parameters, dev);
+    struct param_cache *cache = &((struct wrapper_audio_device *) dev)->parameters;
+    uint32_t generation;
+    char *kvpairs = param_cache_get(cache, keys, &generation);
+
+    if (kvpairs)
+        return kvpairs;
+    kvpairs = WRAPPED_DEVICE_CALL(dev, get_parameters, keys);
+    kvpairs = fixup_returned_audio_parameters(kvpairs, ICS_TO_JB);
+    param_cache_put(cache, keys, kvpairs, generation);
+    return kvpairs;
 }
 
 static uint32_t adev_get_supported_devices(const struct audio_hw_device *dev)
 {
+    TRACE_SCOPE(TRACE_adev_get_supported_devices, dev);
     uint32_t devices = WRAPPED_DEVICE_CALL(dev, get_supported_devices);
-    return convert_audio_devices(devices, ICS_TO_JB);
+    return TRACE_RETURN(convert_audio_devices(devices, ICS_TO_JB));
 }
 
 static int adev_init_check(const struct audio_hw_device *dev)
@@ -392,38 +3009,77 @@ static int adev_set_voice_volume(struct audio_hw_device *dev, float volume)
     RETURN_WRAPPED_DEVICE_CALL(dev, set_voice_volume, volume);
 }
 
+/**
+ * Computes the gain of the output streams from the master volume and mute.
+ * AudioFlinger serializes the master volume calls, the streams only read
+ * master_gain.
+ */
+static void update_master_gain(struct wrapper_audio_device *adev)
+{
+    float gain = adev->master_mute ? 0.0f :
+        adev->hw_master_volume ? 1.0f : adev->master_volume;
+
+    WLOGI(WRAPPER_LOG_HW, "%s: volume %f%s, mute %d -> gain %f", __FUNCTION__,
+          adev->master_volume, adev->hw_master_volume ? " (blob)" : "",
+          adev->master_mute, gain);
+    __atomic_store(&adev->master_gain, &gain, __ATOMIC_RELAXED);
+}
+
+/**
+ * Lets the blob apply the master volume if it can, otherwise the output
+ * streams do. Either way AudioFlinger doesn't have to apply it per track.
+ */
 static int adev_set_master_volume(struct audio_hw_device *dev, float volume)
 {
-    RETURN_WRAPPED_DEVICE_CALL(dev, set_master_volume, volume);
+    struct wrapper_audio_device *adev = (struct wrapper_audio_device *) dev;
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_adev_set_master_volume, dev);
+
+    if (volume < 0.0f)
+        volume = 0.0f;
+    if (volume > 1.0f)
+        volume = 1.0f;
+
+    adev->hw_master_volume = WRAPPED_DEVICE_CALL(dev, set_master_volume, volume) == 0;
+    adev->master_volume = volume;
+    update_master_gain(adev);
+    return 0;
 }
 
-#if 0
 #ifndef ICS_AUDIO_BLOB
 static int adev_get_master_volume(struct audio_hw_device *dev, float *volume)
 {
-    ALOGI("%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_adev_get_master_volume, dev);
+    *volume = ((struct wrapper_audio_device *) dev)->master_volume;
     return 0;
-    //RETURN_WRAPPED_DEVICE_CALL(dev, get_master_volume, volume);
 }
 
 static int adev_set_master_mute(struct audio_hw_device *dev, bool muted)
 {
-    ALOGI("%s", __FUNCTION__);
+    struct wrapper_audio_device *adev = (struct wrapper_audio_device *) dev;
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_adev_set_master_mute, dev);
+
+    adev->master_mute = muted;
+    update_master_gain(adev);
     return 0;
-    //RETURN_WRAPPED_DEVICE_CALL(dev, set_master_mute, muted);
 }
 
 static int adev_get_master_mute(struct audio_hw_device *dev, bool *muted)
 {
-    ALOGI("%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_adev_get_master_mute, dev);
+    *muted = ((struct wrapper_audio_device *) dev)->master_mute;
     return 0;
-    //RETURN_WRAPPED_DEVICE_CALL(dev, get_master_mute, muted);
 }
 #endif
-#endif
 
 static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
 {
+    struct wrapper_audio_device *adev = (struct wrapper_audio_device *) dev;
+
+    // The blob may answer differently and reroute on its own during a call
+    param_cache_clear(&adev->parameters);
+    __atomic_add_fetch(&adev->routing_epoch, 1, __ATOMIC_RELEASE);
     RETURN_WRAPPED_DEVICE_CALL(dev, set_mode, mode);
 }
 
@@ -438,23 +3094,135 @@ static int adev_get_mic_mute(const struct audio_hw_device *dev, bool *state)
 }
 
 
+/**
+ * Returns the capture rate the blob is opened at for a client that wants
+ * sample_rate and the blob doesn't take, or 0 if the wrapper doesn't resample
+ * it. The lowest supported rate above sample_rate loses nothing, otherwise the
+ * highest one is used. Only asks get_input_buffer_size(), which ICS blobs
+ * answer with 0 for rates they can't capture at.
+ */
+static uint32_t in_native_rate(const struct audio_hw_device *dev, uint32_t sample_rate,
+                               int format, int channel_count)
+{
+    static const uint32_t rates[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000 };
+    const struct wrapper_audio_device *adev = (const struct wrapper_audio_device *) dev;
+    uint32_t native = 0;
+
+    if (adev->resampler_quality == RESAMPLER_QUALITY_OFF || !sample_rate ||
+            format != AUDIO_FORMAT_PCM_16_BIT)
+        return 0;
+
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        if (rates[i] == sample_rate ||
+                !WRAPPED_DEVICE_CALL(dev, get_input_buffer_size, rates[i], format, channel_count))
+            continue;
+        native = rates[i];
+        if (native > sample_rate)
+            break;
+    }
+    return native;
+}
+
+/**
+ * Buffer size for a capture at sample_rate. If the blob can't capture at the
+ * rate but in_native_rate() finds one, the size of the resampling input
+ * stream is returned, so AudioRecord's rate probing succeeds without an open.
+ */
+static size_t input_buffer_size(const struct audio_hw_device *dev, uint32_t sample_rate,
+                                int format, int channel_count)
+{
+    size_t size, frame_size, frames;
+    uint32_t native;
+
+    size = WRAPPED_DEVICE_CALL(dev, get_input_buffer_size, sample_rate, format, channel_count);
+    if (size)
+        return size;
+
+    native = in_native_rate(dev, sample_rate, format, channel_count);
+    if (!native)
+        return 0;
+    size = WRAPPED_DEVICE_CALL(dev, get_input_buffer_size, native, format, channel_count);
+    frame_size = channel_count * sizeof(int16_t);
+    frames = (uint64_t) (size / frame_size) * sample_rate / native;
+    if (frames > 16)
+        frames &= ~15;
+    return frames * frame_size;
+}
+
 #ifndef ICS_AUDIO_BLOB
 static size_t adev_get_input_buffer_size(const struct audio_hw_device *dev,
                                     const struct audio_config *config)
 {
-    RETURN_WRAPPED_DEVICE_CALL(dev, get_input_buffer_size, config->sample_rate,
-                               config->format, popcount(config->channel_mask));
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_adev_get_input_buffer_size, dev);
+    return TRACE_RETURN(input_buffer_size(dev, config->sample_rate, config->format,
+                                          popcount(config->channel_mask)));
 }
 #else
 static size_t adev_get_input_buffer_size(const struct audio_hw_device *dev,
                                     uint32_t sample_rate, int format,
                                     int channel_count)
 {
-    RETURN_WRAPPED_DEVICE_CALL(dev, get_input_buffer_size, sample_rate, format,
-                               channel_count);
+    WLOGV(WRAPPER_LOG_HW, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_adev_get_input_buffer_size, dev);
+    return TRACE_RETURN(input_buffer_size(dev, sample_rate, format, channel_count));
 }
 #endif
 
+/**
+ * Attaches in to source after the blob refused to open another input.
+ * format, channels and sample_rate hold the request. The client gets its rate
+ * through a resampler and mono or stereo through a channel conversion,
+ * anything else fails with the source's configuration suggested like a blob
+ * would.
+ */
+static int in_open_shared(struct wrapper_audio_device *adev, struct capture_source *source,
+                          struct wrapper_stream_in *in, int *format, uint32_t *channels,
+                          uint32_t *sample_rate)
+{
+    unsigned count = *channels ? popcount(*channels) : popcount(source->channels);
+    unsigned source_count = popcount(source->channels);
+    uint32_t rate = *sample_rate ? *sample_rate : source->sample_rate;
+    int ret;
+
+    if ((*format && *format != AUDIO_FORMAT_PCM_16_BIT) ||
+            source->format != AUDIO_FORMAT_PCM_16_BIT ||
+            (count != source_count && (count > 2 || source_count > 2)))
+        goto err_config;
+
+    if (rate != source->sample_rate) {
+        if (adev->resampler_quality == RESAMPLER_QUALITY_OFF)
+            goto err_config;
+        in->resampler = resampler_create(source->sample_rate, rate, count,
+                                         adev->resampler_quality);
+        if (!in->resampler)
+            goto err_config;
+        in->sample_rate = rate;
+    }
+    if (count != source_count)
+        in->channels = *channels;
+
+    ret = capture_source_attach(source, in);
+    if (ret) {
+        resampler_free(in->resampler);
+        in->resampler = NULL;
+        return ret;
+    }
+
+    ALOGI("%s: sharing the input of devices 0x%x with %u other inputs", __FUNCTION__,
+          source->devices, source->client_count - 1);
+    *format = AUDIO_FORMAT_PCM_16_BIT;
+    *channels = in->channels ? in->channels : source->channels;
+    *sample_rate = rate;
+    return 0;
+
+err_config:
+    *format = AUDIO_FORMAT_PCM_16_BIT;
+    *channels = source->channels;
+    *sample_rate = source->sample_rate;
+    return -EINVAL;
+}
+
 #ifndef ICS_AUDIO_BLOB
 static int adev_open_input_stream(struct audio_hw_device *dev,
                              audio_io_handle_t handle,
@@ -469,28 +3237,77 @@ static int adev_open_input_stream(struct audio_hw_device *dev, uint32_t devices,
                              struct audio_stream_in **stream_in)
 #endif
 {
+    struct wrapper_audio_device *adev = (struct wrapper_audio_device *) dev;
     struct wrapper_stream_in *in;
+#ifndef ICS_AUDIO_BLOB
+    int *format = (int *) &config->format;
+    uint32_t *channels = &config->channel_mask;
+    uint32_t *sample_rate = &config->sample_rate;
+    audio_in_acoustics_t acoustics = (audio_in_acoustics_t) 0;
+#endif
+    struct capture_source *source;
+    uint32_t requested_rate = *sample_rate, requested_channels = *channels, native;
+    int requested_format = *format;
     int ret;
 
     ALOGI("%s: devices 0x%x", __FUNCTION__, devices);
+    TRACE_SCOPE(TRACE_adev_open_input_stream, dev);
 
     in = (struct wrapper_stream_in *)calloc(1, sizeof(struct wrapper_stream_in));
     if (!in)
-        return -ENOMEM;
+        return TRACE_RETURN(-ENOMEM);
+    attributes_init(&in->attributes);
 
     devices = convert_audio_devices(devices, JB_TO_ICS);
 
-#ifndef ICS_AUDIO_BLOB
-    ret = WRAPPED_DEVICE_CALL(dev, open_input_stream, devices, (int *)&config->format,
-                              &config->channel_mask, &config->sample_rate,
-                              (audio_in_acoustics_t)0, &WRAPPED_STREAM_IN(in));
-#else
     ret = WRAPPED_DEVICE_CALL(dev, open_input_stream, devices, format, channels,
                               sample_rate, acoustics, &WRAPPED_STREAM_IN(in));
-#endif
+
+    // Like outputs, capture at the blob's rate and resample in in_read()
+    // instead of failing. Blobs that don't suggest a rate are asked for the
+    // ones they support.
+    if (ret < 0 && *sample_rate == requested_rate) {
+        native = in_native_rate(dev, requested_rate, *format, popcount(*channels));
+        if (native)
+            *sample_rate = native;
+    }
+    if (requested_rate && *sample_rate && *sample_rate != requested_rate &&
+            *format == AUDIO_FORMAT_PCM_16_BIT &&
+            adev->resampler_quality != RESAMPLER_QUALITY_OFF) {
+        if (ret < 0)
+            ret = WRAPPED_DEVICE_CALL(dev, open_input_stream, devices, format, channels,
+                                      sample_rate, acoustics, &WRAPPED_STREAM_IN(in));
+        if (!ret) {
+            in->resampler = resampler_create(*sample_rate, requested_rate, popcount(*channels),
+                                             adev->resampler_quality);
+            ALOGW_IF(!in->resampler, "%s: can't resample %u to %u Hz", __FUNCTION__,
+                     *sample_rate, requested_rate);
+        }
+        if (in->resampler) {
+            in->sample_rate = requested_rate;
+            *sample_rate = requested_rate;
+        }
+    }
+
+    // The blob probably allows only one input at a time
+    if (ret < 0 && adev->shared_capture && (source = capture_source_find(adev, devices))) {
+        *format = requested_format;
+        *channels = requested_channels;
+        *sample_rate = requested_rate;
+        ret = in_open_shared(adev, source, in, format, channels, sample_rate);
+    }
     if(ret < 0)
         goto err_open;
 
+    if (!in->source) {
+        ret = capture_source_create(adev, in, devices);
+        if (ret) {
+            WRAPPED_DEVICE_CALL(dev, close_input_stream, WRAPPED_STREAM_IN(in));
+            resampler_free(in->resampler);
+            goto err_open;
+        }
+    }
+
     in->stream.common.get_sample_rate = in_get_sample_rate;
     in->stream.common.set_sample_rate = in_set_sample_rate;
     in->stream.common.get_buffer_size = in_get_buffer_size;
@@ -507,31 +3324,63 @@ static int adev_open_input_stream(struct audio_hw_device *dev, uint32_t devices,
     in->stream.read = in_read;
     in->stream.get_input_frames_lost = in_get_input_frames_lost;
 
+    in_attributes(&in->stream.common);
+
     *stream_in = &in->stream;
     return 0;
 
 err_open:
+    pthread_mutex_destroy(&in->attributes.lock);
     free(in);
     *stream_in = NULL;
-    return ret;
+    return TRACE_RETURN(ret);
 }
 
 static void adev_close_input_stream(struct audio_hw_device *dev,
                                    struct audio_stream_in *in)
 {
-    WRAPPED_DEVICE_CALL(dev, close_input_stream, WRAPPED_STREAM_IN(in));
+    struct capture_source *source = ((struct wrapper_stream_in *) in)->source;
+
+    TRACE_SCOPE(TRACE_adev_close_input_stream, in);
+    if (capture_source_detach((struct wrapper_stream_in *) in)) {
+        // Stop the prefetch thread before the blob input goes away
+        capture_source_free((struct wrapper_audio_device *) dev, source);
+        WRAPPED_DEVICE_CALL(dev, close_input_stream, WRAPPED_STREAM_IN(in));
+    }
+    resampler_free(((struct wrapper_stream_in *) in)->resampler);
+    free(((struct wrapper_stream_in *) in)->read_buffer);
+    free(((struct wrapper_stream_in *) in)->resample_buffer);
+    free(((struct wrapper_stream_in *) in)->convert_buffer);
+    pthread_mutex_destroy(&((struct wrapper_stream_in *) in)->attributes.lock);
     free(in);
 }
 
 static int adev_dump(const audio_hw_device_t *dev, int fd)
 {
+    trace_dump(fd);
+    param_cache_dump(&((struct wrapper_audio_device *) dev)->parameters, fd);
+    routing_dump(&((struct wrapper_audio_device *) dev)->routing, fd);
     RETURN_WRAPPED_DEVICE_CALL(dev, dump, fd);
 }
 
 static int adev_close(hw_device_t *dev)
 {
+    struct wrapper_audio_device *adev = (struct wrapper_audio_device *) dev;
+
     ALOGI("%s", __FUNCTION__);
-    WRAPPED_DEVICE(dev)->common.close((hw_device_t*)&(WRAPPED_DEVICE(dev)));
+    TRACE_SCOPE(TRACE_adev_close, dev);
+    if (adev->standby_delay_ms > 0) {
+        pthread_mutex_lock(&adev->standby_lock);
+        adev->standby_exit = true;
+        pthread_cond_signal(&adev->standby_cond);
+        pthread_mutex_unlock(&adev->standby_lock);
+        pthread_join(adev->standby_thread, NULL);
+    }
+    pthread_cond_destroy(&adev->standby_cond);
+    pthread_mutex_destroy(&adev->standby_lock);
+    param_cache_free(&adev->parameters);
+    pthread_mutex_destroy(&adev->routing.lock);
+    WRAPPED_DEVICE(dev)->common.close((hw_device_t*)WRAPPED_DEVICE(dev));
     free(dev);
     return 0;
 }
@@ -542,20 +3391,59 @@ static int adev_open(const hw_module_t* module, const char* name,
     struct wrapper_audio_device *adev;
     int ret;
 
+    wrapper_log_init();
+    trace_init();
     ALOGI("Wrapping vendor audio primary");
+    TRACE_SCOPE(TRACE_adev_open, module);
 
     if (strcmp(name, AUDIO_HARDWARE_INTERFACE) != 0)
-        return -EINVAL;
+        return TRACE_RETURN(-EINVAL);
 
     adev = (struct wrapper_audio_device *) calloc(1, sizeof(struct wrapper_audio_device));
     if (!adev)
-        return -ENOMEM;
+        return TRACE_RETURN(-ENOMEM);
 
     ret = load_vendor_module(module, name, (hw_device_t**) &adev->wrapped_device,
                              AUDIO_HARDWARE_MODULE_ID_PRIMARY);
     if(ret) {
         free(adev);
-        return ret;
+        return TRACE_RETURN(ret);
+    }
+
+    adev->master_volume = 1.0f;
+    adev->master_gain = 1.0f;
+    char value[PROPERTY_VALUE_MAX];
+#ifndef ICS_AUDIO_BLOB
+    property_get(DEEP_BUFFER_PROPERTY, value, "0");
+    adev->deep_buffer_periods = atoi(value);
+#endif
+    property_get(ASYNC_WRITE_PROPERTY, value, "0");
+    adev->async_write_periods = atoi(value);
+    property_get(ASYNC_WRITE_PRIORITY_PROPERTY, value, "2");
+    adev->async_write_priority = atoi(value);
+    property_get(FAST_OUTPUT_PROPERTY, value, "0");
+    adev->fast_output_split = atoi(value);
+    property_get(CAPTURE_PREFETCH_PROPERTY, value, "0");
+    adev->capture_prefetch_periods = atoi(value);
+    property_get(SHARED_CAPTURE_PROPERTY, value, "1");
+    adev->shared_capture = atoi(value) != 0;
+    property_get(PARAM_CACHE_PROPERTY, value, "1");
+    adev->param_cache = atoi(value) != 0;
+    property_get(DITHER_PROPERTY, value, "0");
+    adev->dither = atoi(value) != 0;
+    property_get(RESAMPLER_PROPERTY, value, "off");
+    adev->resampler_quality = resampler_quality_from_string(value);
+    property_get(STANDBY_DELAY_PROPERTY, value, "0");
+    adev->standby_delay_ms = atoi(value);
+
+    param_cache_init(&adev->parameters, adev->param_cache);
+    routing_init(&adev->routing);
+    pthread_mutex_init(&adev->standby_lock, NULL);
+    pthread_cond_init(&adev->standby_cond, NULL);
+    if (adev->standby_delay_ms > 0 &&
+            pthread_create(&adev->standby_thread, NULL, standby_thread, adev)) {
+        ALOGW("%s: no standby thread, standby is not delayed", __FUNCTION__);
+        adev->standby_delay_ms = 0;
     }
 
     adev->device.common.tag = HARDWARE_DEVICE_TAG;
@@ -572,9 +3460,9 @@ static int adev_open(const hw_module_t* module, const char* name,
     adev->device.set_voice_volume = adev_set_voice_volume;
     adev->device.set_master_volume = adev_set_master_volume;
 #ifndef ICS_AUDIO_BLOB
-    adev->device.get_master_volume = NULL; //adev_get_master_volume;
-    adev->device.set_master_mute = NULL; //adev_set_master_mute;
-    adev->device.get_master_mute = NULL; //adev_get_master_mute;
+    adev->device.get_master_volume = adev_get_master_volume;
+    adev->device.set_master_mute = adev_set_master_mute;
+    adev->device.get_master_mute = adev_get_master_mute;
 #endif
     adev->device.set_mode = adev_set_mode;
     adev->device.set_mic_mute = adev_set_mic_mute;
@@ -34,6 +34,8 @@
 #include "include/4.0/hardware/audio_policy.h"
 #include "aps_wrapper.h"
 #include "common.h"
+#include "stats.h"
+#include "trace.h"
 
 struct wrapper_ap_module {
     struct audio_policy_module module;
@@ -44,10 +46,47 @@ struct wrapper_ap_device {
     struct wrapper::audio_policy_device *wrapped_device;
 };
 
+#ifndef ICS_AUDIO_BLOB
+/**
+ * One slot per audio_devices_t bit of the output devices.
+ */
+#define VOLUME_DEVICE_SLOTS 32
+
+#define VOLUME_INDEX_UNSET -1
+
+/**
+ * Emulates the volume index per stream and device of the 4.2 policy manager
+ * on top of the single index per stream of the ICS policy. AudioService sets
+ * the index of every stream for every device, the indexes are kept here and
+ * only the one of the device a stream is routed to is passed on. When the
+ * routing changes the index of the new device is replayed. AudioPolicyService
+ * serializes the policy calls, so there is no lock.
+ */
+struct volume_table {
+    int16_t index[AUDIO_STREAM_CNT][VOLUME_DEVICE_SLOTS];
+    int16_t index_min[AUDIO_STREAM_CNT];
+    int16_t index_max[AUDIO_STREAM_CNT];
+    // Index the vendor policy has, VOLUME_INDEX_UNSET if unknown
+    int16_t forwarded[AUDIO_STREAM_CNT];
+    // Output devices of each stream as of routing_changes
+    audio_devices_t devices[AUDIO_STREAM_CNT];
+    uint32_t routing_changes;
+    // The devices haven't been read yet
+    bool stale;
+    uint32_t forwarded_sets;
+    uint32_t stored_sets;
+    uint32_t answered_gets;
+    uint32_t replays;
+};
+#endif
+
 struct wrapper_audio_policy {
     struct audio_policy policy;
     struct wrapper::audio_policy *wrapped_policy;
     void * aps_wrapper;
+#ifndef ICS_AUDIO_BLOB
+    struct volume_table volumes;
+#endif
 };
 
 /**
@@ -64,18 +103,146 @@ struct wrapper_audio_policy {
  * Calls func on the wrapped wrapped audio policy and returns the result.
  */
 #define RETURN_WRAPPED_CALL(policy, func, ...) ({\
-    ALOGV("%s", __FUNCTION__); \
-    return WRAPPED_POLICY(policy)->func(WRAPPED_POLICY(policy), ##__VA_ARGS__); \
+    WLOGV(WRAPPER_LOG_POLICY, "%s", __FUNCTION__); \
+    TRACE_SCOPE(TRACE_ap_##func, policy); \
+    return TRACE_RETURN(WRAPPED_POLICY(policy)->func(WRAPPED_POLICY(policy), ##__VA_ARGS__)); \
 })
 
 /**
  * Calls func on the wrapped wrapped audio policy.
  */
 #define WRAPPED_CALL(policy, func, ...) ({\
-    ALOGV("%s", __FUNCTION__); \
+    WLOGV(WRAPPER_LOG_POLICY, "%s", __FUNCTION__); \
+    TRACE_SCOPE(TRACE_ap_##func, policy); \
     WRAPPED_POLICY(policy)->func(WRAPPED_POLICY(policy), ##__VA_ARGS__); \
 })
 
+#ifndef ICS_AUDIO_BLOB
+static void volume_init(struct volume_table *v)
+{
+    memset(v, 0, sizeof(*v));
+    for (int stream = 0; stream < AUDIO_STREAM_CNT; stream++) {
+        for (int slot = 0; slot < VOLUME_DEVICE_SLOTS; slot++)
+            v->index[stream][slot] = VOLUME_INDEX_UNSET;
+        v->index_max[stream] = INT16_MAX;
+        v->forwarded[stream] = VOLUME_INDEX_UNSET;
+    }
+    v->stale = true;
+}
+
+/**
+ * Returns the slot of the device whose index applies to devices, -1 for none.
+ */
+static int volume_slot(audio_devices_t devices)
+{
+    // Like AudioPolicyManagerBase::getDeviceForVolume()
+    if (devices & (devices - 1) && devices & AUDIO_DEVICE_OUT_SPEAKER)
+        devices = AUDIO_DEVICE_OUT_SPEAKER;
+    return devices ? __builtin_ctz(devices) : -1;
+}
+
+/**
+ * Returns the index set for devices or, if there is none, the one set for
+ * AUDIO_DEVICE_OUT_DEFAULT.
+ */
+static int volume_index(const struct volume_table *v, audio_stream_type_t stream,
+                        audio_devices_t devices)
+{
+    int slot = volume_slot(devices);
+
+    if (slot >= 0 && v->index[stream][slot] != VOLUME_INDEX_UNSET)
+        return v->index[stream][slot];
+    return v->index[stream][volume_slot(AUDIO_DEVICE_OUT_DEFAULT)];
+}
+
+/**
+ * Passes the index of the device stream is routed to on to the vendor policy
+ * unless it has it already.
+ */
+static int volume_apply(struct wrapper_audio_policy *dap, audio_stream_type_t stream)
+{
+    struct volume_table *v = &dap->volumes;
+    int index = volume_index(v, stream, v->devices[stream]);
+    int ret;
+
+    if (index == VOLUME_INDEX_UNSET || index == v->forwarded[stream])
+        return 0;
+
+    ret = dap->wrapped_policy->set_stream_volume_index(dap->wrapped_policy, stream, index);
+    v->forwarded[stream] = ret ? VOLUME_INDEX_UNSET : index;
+    WLOGI(WRAPPER_LOG_POLICY, "%s: stream %d, index %d, devices 0x%x: %d", __FUNCTION__,
+          stream, index, v->devices[stream], ret);
+    return ret;
+}
+
+/**
+ * Reads the devices of all streams again if the routing changed since the
+ * last time and replays the index of the devices that changed. Has to be
+ * called after every policy call that can change the routing, with stale set
+ * for the ones that can do it without a set_parameters() (e.g. a headset
+ * plugged in while nothing plays).
+ */
+static void volume_rerouted(struct wrapper_audio_policy *dap, bool stale)
+{
+    struct volume_table *v = &dap->volumes;
+    uint32_t routing_changes = aps_wrapper_routing_changes(dap->aps_wrapper);
+    int index;
+
+    if (!stale && !v->stale && routing_changes == v->routing_changes)
+        return;
+
+    v->stale = false;
+    v->routing_changes = routing_changes;
+    for (int stream = 0; stream < AUDIO_STREAM_CNT; stream++) {
+        audio_devices_t devices = convert_audio_devices(
+            dap->wrapped_policy->get_devices_for_stream(dap->wrapped_policy,
+                                                        (audio_stream_type_t) stream),
+            ICS_TO_JB);
+
+        if (devices == v->devices[stream])
+            continue;
+        v->devices[stream] = devices;
+        index = volume_index(v, (audio_stream_type_t) stream, devices);
+        if (index != VOLUME_INDEX_UNSET && index != v->forwarded[stream]) {
+            STATS_ADD(v->replays, 1);
+            volume_apply(dap, (audio_stream_type_t) stream);
+        }
+    }
+}
+
+static void volume_dump(const struct volume_table *v, int fd)
+{
+    dump_printf(fd, "Wrapper volume indexes: %u sets forwarded, %u stored, %u gets answered, "
+                "%u replayed after routing changes\n",
+                __atomic_load_n(&v->forwarded_sets, __ATOMIC_RELAXED),
+                __atomic_load_n(&v->stored_sets, __ATOMIC_RELAXED),
+                __atomic_load_n(&v->answered_gets, __ATOMIC_RELAXED),
+                __atomic_load_n(&v->replays, __ATOMIC_RELAXED));
+    for (int stream = 0; stream < AUDIO_STREAM_CNT; stream++) {
+        char line[512];
+        int len = 0;
+
+        for (int slot = 0; slot < VOLUME_DEVICE_SLOTS; slot++) {
+            if (v->index[stream][slot] == VOLUME_INDEX_UNSET)
+                continue;
+            len += snprintf(line + len, sizeof(line) - len, " 0x%x=%d", 1u << slot,
+                            v->index[stream][slot]);
+            if (len >= (int) sizeof(line))
+                break;
+        }
+        if (len)
+            dump_printf(fd, "  stream %d (devices 0x%x, index %d):%s\n", stream,
+                        v->devices[stream], v->forwarded[stream], line);
+    }
+}
+#else
+static inline void volume_rerouted(struct wrapper_audio_policy *dap, bool stale)
+{
+    (void)(dap);
+    (void)(stale);
+}
+#endif
+
 
 static int ap_set_device_connection_state(struct audio_policy *pol,
                                           audio_devices_t device,
@@ -84,9 +251,14 @@ static int ap_set_device_connection_state(struct audio_policy *pol,
 {
     ALOGI("%s: device: 0x%x, state: %d, address: %s", __FUNCTION__, device, state,
           device_address);
+    TRACE_SCOPE(TRACE_ap_set_device_connection_state, pol);
+    int ret;
     device = convert_audio_devices(device, JB_TO_ICS);
-    RETURN_WRAPPED_CALL(pol, set_device_connection_state, (wrapper::audio_devices_t) device,
-                        state, device_address);
+    ret = WRAPPED_POLICY(pol)->set_device_connection_state(WRAPPED_POLICY(pol),
+                                                           (wrapper::audio_devices_t) device,
+                                                           state, device_address);
+    volume_rerouted((struct wrapper_audio_policy *) pol, true);
+    return TRACE_RETURN(ret);
 }
 
 static audio_policy_dev_state_t ap_get_device_connection_state(
@@ -94,7 +266,7 @@ static audio_policy_dev_state_t ap_get_device_connection_state(
                                             audio_devices_t device,
                                             const char *device_address)
 {
-    ALOGI("%s: device: 0x%x, address: %s", __FUNCTION__, device, device_address);
+    WLOGI(WRAPPER_LOG_POLICY, "%s: device: 0x%x, address: %s", __FUNCTION__, device, device_address);
     device = convert_audio_devices(device, JB_TO_ICS);
     RETURN_WRAPPED_CALL(pol, get_device_connection_state, (wrapper::audio_devices_t) device,
                         device_address);
@@ -102,7 +274,8 @@ static audio_policy_dev_state_t ap_get_device_connection_state(
 
 static void ap_set_phone_state(struct audio_policy *pol, audio_mode_t state)
 {
-    WRAPPED_POLICY(pol)->set_phone_state(WRAPPED_POLICY(pol), state);
+    WRAPPED_CALL(pol, set_phone_state, state);
+    volume_rerouted((struct wrapper_audio_policy *) pol, true);
 }
 
 // deprecated, never called
@@ -117,6 +290,7 @@ static void ap_set_force_use(struct audio_policy *pol,
                           audio_policy_forced_cfg_t config)
 {
     WRAPPED_CALL(pol, set_force_use, usage, config);
+    volume_rerouted((struct wrapper_audio_policy *) pol, true);
 }
 
 /* retreive current device category forced for a given usage */
@@ -153,19 +327,28 @@ static audio_io_handle_t ap_get_output(struct audio_policy *pol,
 static int ap_start_output(struct audio_policy *pol, audio_io_handle_t output,
                            audio_stream_type_t stream, int session)
 {
-    RETURN_WRAPPED_CALL(pol, start_output, output, stream, session);
+    WLOGV(WRAPPER_LOG_POLICY, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_ap_start_output, pol);
+    int ret = WRAPPED_POLICY(pol)->start_output(WRAPPED_POLICY(pol), output, stream, session);
+    volume_rerouted((struct wrapper_audio_policy *) pol, false);
+    return TRACE_RETURN(ret);
 }
 
 static int ap_stop_output(struct audio_policy *pol, audio_io_handle_t output,
                           audio_stream_type_t stream, int session)
 {
-    RETURN_WRAPPED_CALL(pol, stop_output, output, stream, session);
+    WLOGV(WRAPPER_LOG_POLICY, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_ap_stop_output, pol);
+    int ret = WRAPPED_POLICY(pol)->stop_output(WRAPPED_POLICY(pol), output, stream, session);
+    volume_rerouted((struct wrapper_audio_policy *) pol, false);
+    return TRACE_RETURN(ret);
 }
 
 static void ap_release_output(struct audio_policy *pol,
                               audio_io_handle_t output)
 {
     WRAPPED_CALL(pol, release_output, output);
+    volume_rerouted((struct wrapper_audio_policy *) pol, false);
 }
 
 static audio_io_handle_t ap_get_input(struct audio_policy *pol, audio_source_t inputSource,
@@ -197,6 +380,13 @@ static void ap_init_stream_volume(struct audio_policy *pol,
                                   int index_max)
 {
     ALOGI("%s: stream %d, index_min %d, index_max: %d", __FUNCTION__, stream, index_min, index_max);
+#ifndef ICS_AUDIO_BLOB
+    struct volume_table *v = &((struct wrapper_audio_policy *) pol)->volumes;
+    if (stream >= 0 && stream < AUDIO_STREAM_CNT) {
+        v->index_min[stream] = index_min;
+        v->index_max[stream] = index_max;
+    }
+#endif
     WRAPPED_CALL(pol, init_stream_volume, stream, index_min, index_max);
 }
 
@@ -204,17 +394,25 @@ static int ap_set_stream_volume_index(struct audio_policy *pol,
                                       audio_stream_type_t stream,
                                       int index)
 {
-    ALOGI("%s: stream %d, index %d", __FUNCTION__, stream, index);
-    RETURN_WRAPPED_CALL(pol, set_stream_volume_index, stream, index);
+    WLOGI(WRAPPER_LOG_POLICY, "%s: stream %d, index %d", __FUNCTION__, stream, index);
+    TRACE_SCOPE(TRACE_ap_set_stream_volume_index, pol);
+    int ret = WRAPPED_POLICY(pol)->set_stream_volume_index(WRAPPED_POLICY(pol), stream, index);
+#ifndef ICS_AUDIO_BLOB
+    // Bypasses the table, it no longer knows what the vendor policy has
+    if (stream >= 0 && stream < AUDIO_STREAM_CNT)
+        ((struct wrapper_audio_policy *) pol)->volumes.forwarded[stream] = VOLUME_INDEX_UNSET;
+#endif
+    return TRACE_RETURN(ret);
 }
 
 static int ap_get_stream_volume_index(const struct audio_policy *pol,
                                       audio_stream_type_t stream,
                                       int *index)
 {
+    TRACE_SCOPE(TRACE_ap_get_stream_volume_index, pol);
     int ret = WRAPPED_POLICY(pol)->get_stream_volume_index(WRAPPED_POLICY(pol), stream, index);
-    ALOGI("%s: stream %d, index %d", __FUNCTION__, stream, *index);
-    return ret;
+    WLOGI(WRAPPER_LOG_POLICY, "%s: stream %d, index %d", __FUNCTION__, stream, *index);
+    return TRACE_RETURN(ret);
 }
 
 #ifndef ICS_AUDIO_BLOB
@@ -223,14 +421,28 @@ static int ap_set_stream_volume_index_for_device(struct audio_policy *pol,
                                       int index,
                                       audio_devices_t device)
 {
-    ALOGI("%s: stream %d, index %d, device: 0x%x", __FUNCTION__, stream, index, device);
-    device = convert_audio_devices(device, JB_TO_ICS);
-    // This function does not exist for ICS audio HALs so the have to call the
-    // old function that doesn't differentiate between devices.
-    // TODO: Somehow track the current active devices and only allow to set
-    // volumes for those devices.
-    RETURN_WRAPPED_CALL(pol, set_stream_volume_index, stream, index);
-    //RETURN_WRAPPED_POLICY(pol, set_stream_volume_index_for_device, stream, index, device);
+    WLOGI(WRAPPER_LOG_POLICY, "%s: stream %d, index %d, device: 0x%x", __FUNCTION__, stream, index, device);
+    TRACE_SCOPE(TRACE_ap_set_stream_volume_index_for_device, pol);
+    struct wrapper_audio_policy *dap = (struct wrapper_audio_policy *) pol;
+    struct volume_table *v = &dap->volumes;
+    int slot = volume_slot(device);
+    int ret;
+
+    // The ICS policy has one index per stream, the one of the device the
+    // stream is routed to is passed on by volume_apply()
+    if (stream < 0 || stream >= AUDIO_STREAM_CNT || slot < 0 ||
+            index < v->index_min[stream] || index > v->index_max[stream])
+        return TRACE_RETURN(-EINVAL);
+
+    volume_rerouted(dap, false);
+    v->index[stream][slot] = index;
+    if (volume_index(v, stream, v->devices[stream]) == v->forwarded[stream]) {
+        STATS_ADD(v->stored_sets, 1);
+        return TRACE_RETURN(0);
+    }
+    STATS_ADD(v->forwarded_sets, 1);
+    ret = volume_apply(dap, stream);
+    return TRACE_RETURN(ret);
 }
 
 static int ap_get_stream_volume_index_for_device(const struct audio_policy *pol,
@@ -238,12 +450,27 @@ static int ap_get_stream_volume_index_for_device(const struct audio_policy *pol,
                                       int *index,
                                       audio_devices_t device)
 {
-    int ret;
-    device = convert_audio_devices(device, JB_TO_ICS);
-    ret = WRAPPED_POLICY(pol)->get_stream_volume_index(WRAPPED_POLICY(pol), stream, index);
-    //ret = WRAPPED_POLICY(pol)->get_stream_volume_index_for_device(WRAPPED_POLICY(pol), stream, index, device);
-    ALOGI("%s: stream %d, index %d, device: 0x%x", __FUNCTION__, stream, *index, device);
-    return ret;
+    TRACE_SCOPE(TRACE_ap_get_stream_volume_index_for_device, pol);
+    struct wrapper_audio_policy *dap = (struct wrapper_audio_policy *) pol;
+    struct volume_table *v = &dap->volumes;
+    int ret = 0;
+
+    if (stream < 0 || stream >= AUDIO_STREAM_CNT || !index)
+        return TRACE_RETURN(-EINVAL);
+
+    // Like the 4.2 policy manager the default device stands for the one the
+    // stream is routed to
+    if (device == AUDIO_DEVICE_OUT_DEFAULT) {
+        volume_rerouted(dap, false);
+        device = v->devices[stream];
+    }
+    *index = volume_index(v, stream, device);
+    if (*index != VOLUME_INDEX_UNSET)
+        STATS_ADD(v->answered_gets, 1);
+    else
+        ret = WRAPPED_POLICY(pol)->get_stream_volume_index(WRAPPED_POLICY(pol), stream, index);
+    WLOGI(WRAPPER_LOG_POLICY, "%s: stream %d, index %d, device: 0x%x", __FUNCTION__, stream, *index, device);
+    return TRACE_RETURN(ret);
 }
 #endif
 
@@ -256,10 +483,11 @@ static uint32_t ap_get_strategy_for_stream(const struct audio_policy *pol,
 static audio_devices_t ap_get_devices_for_stream(const struct audio_policy *pol,
                                           audio_stream_type_t stream)
 {
-    ALOGI("%s: stream_type: %d", __FUNCTION__, stream);
+    WLOGI(WRAPPER_LOG_POLICY, "%s: stream_type: %d", __FUNCTION__, stream);
+    TRACE_SCOPE(TRACE_ap_get_devices_for_stream, pol);
     wrapper::audio_devices_t result;
     result = WRAPPED_POLICY(pol)->get_devices_for_stream(WRAPPED_POLICY(pol), stream);
-    return convert_audio_devices(result, ICS_TO_JB);
+    return TRACE_RETURN(convert_audio_devices(result, ICS_TO_JB));
 }
 
 static audio_io_handle_t ap_get_output_for_effect(struct audio_policy *pol,
@@ -298,7 +526,8 @@ static bool ap_is_stream_active(const struct audio_policy *pol, audio_stream_typ
 static bool ap_is_stream_active_remotely(const struct audio_policy *pol, audio_stream_type_t stream,
                                              uint32_t in_past_ms)
 {
-    ALOGV("%s", __FUNCTION__);
+    WLOGV(WRAPPER_LOG_POLICY, "%s", __FUNCTION__);
+    TRACE_SCOPE(TRACE_ap_is_stream_active_remotely, pol);
     // Don't warn about unused parameters
     (void)(pol);
     (void)(stream);
@@ -311,6 +540,10 @@ static bool ap_is_stream_active_remotely(const struct audio_policy *pol, audio_s
 
 static int ap_dump(const struct audio_policy *pol, int fd)
 {
+    trace_dump(fd);
+#ifndef ICS_AUDIO_BLOB
+    volume_dump(&((const struct wrapper_audio_policy *) pol)->volumes, fd);
+#endif
     RETURN_WRAPPED_CALL(pol, dump, fd);
 }
 
@@ -323,6 +556,7 @@ static int create_wrapper_ap(const struct audio_policy_device *device,
     struct wrapper_ap_device *dev;
     struct wrapper_audio_policy *dap;
     struct wrapper::audio_policy *iap;
+    TRACE_SCOPE(TRACE_ap_create, service);
 
     *ap = NULL;
 
@@ -349,6 +583,9 @@ static int create_wrapper_ap(const struct audio_policy_device *device,
     }
 
     dap->aps_wrapper = aps_wrapper;
+#ifndef ICS_AUDIO_BLOB
+    volume_init(&dap->volumes);
+#endif
     ret = dev->wrapped_device->create_audio_policy(dev->wrapped_device, aps_wrapper_ops,
                                                   aps_wrapper, &iap);
     if(ret) {
@@ -401,7 +638,7 @@ static int create_wrapper_ap(const struct audio_policy_device *device,
 fail:
     free(dap);
 fail_alloc:
-    return ret;
+    return TRACE_RETURN(ret);
 }
 
 static int destroy_wrapper_ap(const struct audio_policy_device *ap_dev,
@@ -409,6 +646,7 @@ static int destroy_wrapper_ap(const struct audio_policy_device *ap_dev,
 {
     struct wrapper_ap_device *dev = (struct wrapper_ap_device *)ap_dev;
     struct wrapper_audio_policy *policy = (struct wrapper_audio_policy *)ap;
+    TRACE_SCOPE(TRACE_ap_destroy, ap);
 
     dev->wrapped_device->destroy_audio_policy(dev->wrapped_device,
                                             policy->wrapped_policy);
@@ -419,7 +657,7 @@ static int destroy_wrapper_ap(const struct audio_policy_device *ap_dev,
 
 static int wrapper_ap_dev_close(hw_device_t* device)
 {
-    WRAPPED_DEVICE(device)->common.close((hw_device_t*)&(WRAPPED_DEVICE(device)));
+    WRAPPED_DEVICE(device)->common.close((hw_device_t*)WRAPPED_DEVICE(device));
     free(device);
     return 0;
 }
@@ -430,6 +668,8 @@ static int wrapper_ap_dev_open(const hw_module_t* module, const char* name,
     struct wrapper_ap_device *dev;
     int ret = 0;
 
+    wrapper_log_init();
+    trace_init();
     ALOGI("Wrapping vendor audio policy");
 
     *device = NULL;
@@ -17,12 +17,56 @@
 #define LOG_TAG "AudioWrapperCommon"
 // #define LOG_NDEBUG 0
 
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include "common.h"
+#include "scratch.h"
+
+#define LOG_PROPERTY "persist.audiowrap.log"
+
+int32_t wrapper_log_levels[WRAPPER_LOG_SUBSYSTEM_CNT];
+
+static const char * const log_subsystem_names[WRAPPER_LOG_SUBSYSTEM_CNT] = {
+    "hw",
+    "policy",
+    "service",
+    "common",
+};
+
+static int parse_log_level(const char *value, int default_level)
+{
+    if (!value[0])
+        return default_level;
+    if (!strcmp(value, "off"))
+        return WRAPPER_LOG_OFF;
+    if (!strcmp(value, "info"))
+        return WRAPPER_LOG_INFO;
+    if (!strcmp(value, "verbose"))
+        return WRAPPER_LOG_VERBOSE;
+    return atoi(value);
+}
+
+void wrapper_log_init()
+{
+    char key[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    int default_level;
+
+    property_get(LOG_PROPERTY, value, "");
+    default_level = parse_log_level(value, WRAPPER_LOG_OFF);
+
+    for (int i = 0; i < WRAPPER_LOG_SUBSYSTEM_CNT; i++) {
+        snprintf(key, sizeof(key), "%s.%s", LOG_PROPERTY, log_subsystem_names[i]);
+        property_get(key, value, "");
+        __atomic_store_n(&wrapper_log_levels[i], parse_log_level(value, default_level),
+                         __ATOMIC_RELAXED);
+    }
+}
 
 int load_vendor_module(const hw_module_t* wrapper_module, const char* name,
                        hw_device_t** device, const char* inst)
@@ -56,146 +100,498 @@ int load_vendor_module(const hw_module_t* wrapper_module, const char* name,
     return ret;
 }
 
-#ifdef CONVERT_AUDIO_DEVICES_T
-static audio_devices_t convert_ics_to_jb(const wrapper::audio_devices_t wrapped_devices)
+/*
+ * All conversions below only move single bits around (and set a constant
+ * AUDIO_DEVICE_BIT_IN). That means they can be applied to each byte of the
+ * input independently and the results ORed together. The per-byte results are
+ * computed at compile time into device_table lookup tables so the conversion
+ * itself is four table loads.
+ *
+ * The constexpr functions are the bit mappings of the original conversion
+ * code. host/convert_audio_devices_test.cpp checks the tables against that
+ * code for every possible input.
+ */
+struct device_table {
+    uint32_t bytes[4][256];
+};
+
+#define DEVICE_TABLE_1(f, b, v) f((uint32_t) (v) << (8 * (b)))
+#define DEVICE_TABLE_4(f, b, v) \
+    DEVICE_TABLE_1(f, b, v), DEVICE_TABLE_1(f, b, (v) + 1), \
+    DEVICE_TABLE_1(f, b, (v) + 2), DEVICE_TABLE_1(f, b, (v) + 3)
+#define DEVICE_TABLE_16(f, b, v) \
+    DEVICE_TABLE_4(f, b, v), DEVICE_TABLE_4(f, b, (v) + 4), \
+    DEVICE_TABLE_4(f, b, (v) + 8), DEVICE_TABLE_4(f, b, (v) + 12)
+#define DEVICE_TABLE_64(f, b, v) \
+    DEVICE_TABLE_16(f, b, v), DEVICE_TABLE_16(f, b, (v) + 16), \
+    DEVICE_TABLE_16(f, b, (v) + 32), DEVICE_TABLE_16(f, b, (v) + 48)
+#define DEVICE_TABLE_256(f, b) { \
+    DEVICE_TABLE_64(f, b, 0), DEVICE_TABLE_64(f, b, 64), \
+    DEVICE_TABLE_64(f, b, 128), DEVICE_TABLE_64(f, b, 192) }
+#define DEVICE_TABLE(f) {{ \
+    DEVICE_TABLE_256(f, 0), DEVICE_TABLE_256(f, 1), \
+    DEVICE_TABLE_256(f, 2), DEVICE_TABLE_256(f, 3) }}
+
+static inline uint32_t lookup_device_table(const struct device_table& table,
+                                           uint32_t devices)
 {
-    audio_devices_t devices = 0;
+    return table.bytes[0][devices & 0xff] |
+           table.bytes[1][(devices >> 8) & 0xff] |
+           table.bytes[2][(devices >> 16) & 0xff] |
+           table.bytes[3][devices >> 24];
+}
 
-    if((wrapped_devices & ~wrapper::AUDIO_DEVICE_OUT_ALL) == 0) {
-        // The first 15 AUDIO_DEVICE_OUT bits are equal. Exception is
-        // wrapper::AUDIO_DEVICE_OUT_DEFAULT / AUDIO_DEVICE_OUT_REMOTE_SUBMIX.
-        devices = wrapped_devices & ~wrapper::AUDIO_DEVICE_OUT_DEFAULT;
+/**
+ * audio_policy.default wants to open BUILTIN_MIC for some input source which
+ * results in silence. The HTC audio_policy uses VOICE_CALL instead. Also the
+ * BUILTIN_MIC bit of get_supported_devices() is not set. So this seems the
+ * correct thing to do.
+ */
+static constexpr uint32_t fixup_audio_devices(uint32_t device)
+{
+#ifdef NO_HTC_POLICY_MANAGER
+    return (device & wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC) == wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC ?
+        ((device & ~(uint32_t) wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC) |
+         wrapper::AUDIO_DEVICE_IN_VOICE_CALL) :
+        device;
+#else
+    return device;
+#endif
+}
 
-        // Set the correct DEFAULT bit
-        if(wrapped_devices & wrapper::AUDIO_DEVICE_OUT_DEFAULT) {
-            devices |= AUDIO_DEVICE_OUT_DEFAULT;
-        }
-    } else if((wrapped_devices & ~wrapper::AUDIO_DEVICE_IN_ALL) == 0) {
-        // Bits needs to be shifted 16 bits to the right and the IN bit must be
-        // set.
-        devices = ((wrapped_devices & ~wrapper::AUDIO_DEVICE_IN_DEFAULT) >> 16) | AUDIO_DEVICE_BIT_IN;
-
-        // Set the correct DEFAULT bit
-        if((wrapped_devices & wrapper::AUDIO_DEVICE_IN_DEFAULT) == wrapper::AUDIO_DEVICE_IN_DEFAULT) {
-            devices |= AUDIO_DEVICE_IN_DEFAULT;
-        }
-    } else {
-        // wrapped_devices has bits for input and output devices set and cannot be
-        // properly converted to a JB 4.2 representation.
-        ALOGW("%s: 0x%x has no proper representation", __FUNCTION__, wrapped_devices);
-        devices = wrapped_devices;
-    }
+#ifdef CONVERT_AUDIO_DEVICES_T
+/**
+ * Output devices: the first 15 AUDIO_DEVICE_OUT bits are equal. Exception is
+ * wrapper::AUDIO_DEVICE_OUT_DEFAULT / AUDIO_DEVICE_OUT_REMOTE_SUBMIX.
+ */
+static constexpr uint32_t ics_to_jb_out(uint32_t wrapped_devices)
+{
+    return (wrapped_devices & ~(uint32_t) wrapper::AUDIO_DEVICE_OUT_DEFAULT) |
+        ((wrapped_devices & wrapper::AUDIO_DEVICE_OUT_DEFAULT) ?
+         (uint32_t) AUDIO_DEVICE_OUT_DEFAULT : 0);
+}
 
-    return devices;
+/**
+ * Input devices: bits need to be shifted 16 bits to the right. The IN bit is
+ * set by the caller.
+ */
+static constexpr uint32_t ics_to_jb_in(uint32_t wrapped_devices)
+{
+    return ((wrapped_devices & ~(uint32_t) wrapper::AUDIO_DEVICE_IN_DEFAULT) >> 16) |
+        ((wrapped_devices & wrapper::AUDIO_DEVICE_IN_DEFAULT) ?
+         ((uint32_t) AUDIO_DEVICE_IN_DEFAULT & ~(uint32_t) AUDIO_DEVICE_BIT_IN) : 0);
 }
 
 #define DEVICE_OUT_MASK 0x3FFF
 #define DEVICE_IN_MASK 0xFF
 
-static wrapper::audio_devices_t convert_jb_to_ics(const audio_devices_t devices)
-{
-    wrapper::audio_devices_t wrapped_devices;
-
-    if(audio_is_output_devices(devices)) {
-        // We care only about the first 15 bits since the others cannot be
-        // mapped to the old enum.
-        wrapped_devices = (devices & DEVICE_OUT_MASK);
-        // Set the correct DEFAULT bit
-        if(devices & AUDIO_DEVICE_OUT_DEFAULT)
-            wrapped_devices |= wrapper::AUDIO_DEVICE_OUT_DEFAULT;
-    } else if((devices & AUDIO_DEVICE_BIT_IN) == AUDIO_DEVICE_BIT_IN) {
-        // We care only about the first 8 bits since the other cannot be
-        // mapped to the old enum.
-        wrapped_devices = (devices & DEVICE_IN_MASK) << 16;
-        if((devices & AUDIO_DEVICE_IN_DEFAULT) == AUDIO_DEVICE_IN_DEFAULT)
-            wrapped_devices |= wrapper::AUDIO_DEVICE_IN_DEFAULT;
-    } else {
-        // I guess we should never land here
-        ALOGW("%s: audio_devices_t is neither input nor output: 0x%x",
-              __FUNCTION__, devices);
-        wrapped_devices = devices;
-    }
+/**
+ * Output devices: we care only about the first 15 bits since the others
+ * cannot be mapped to the old enum.
+ */
+static constexpr uint32_t jb_to_ics_out(uint32_t devices)
+{
+    return fixup_audio_devices((devices & DEVICE_OUT_MASK) |
+        ((devices & AUDIO_DEVICE_OUT_DEFAULT) ?
+         (uint32_t) wrapper::AUDIO_DEVICE_OUT_DEFAULT : 0));
+}
 
-    return wrapped_devices;
+/**
+ * Input devices: we care only about the first 8 bits since the other cannot
+ * be mapped to the old enum. AUDIO_DEVICE_BIT_IN is known to be set.
+ */
+static constexpr uint32_t jb_to_ics_in(uint32_t devices)
+{
+    return fixup_audio_devices(((devices & DEVICE_IN_MASK) << 16) |
+        ((devices & (AUDIO_DEVICE_IN_DEFAULT & ~AUDIO_DEVICE_BIT_IN)) ?
+         (uint32_t) wrapper::AUDIO_DEVICE_IN_DEFAULT : 0));
+}
+
+static constexpr struct device_table ics_to_jb_out_table = DEVICE_TABLE(ics_to_jb_out);
+static constexpr struct device_table ics_to_jb_in_table = DEVICE_TABLE(ics_to_jb_in);
+static constexpr struct device_table jb_to_ics_out_table = DEVICE_TABLE(jb_to_ics_out);
+static constexpr struct device_table jb_to_ics_in_table = DEVICE_TABLE(jb_to_ics_in);
+
+/**
+ * Returns true if wrapped_devices has bits for input and output devices set
+ * and cannot be properly converted to a JB 4.2 representation.
+ */
+static inline bool is_mixed_ics_devices(uint32_t wrapped_devices)
+{
+    return (wrapped_devices & ~wrapper::AUDIO_DEVICE_OUT_ALL) != 0 &&
+           (wrapped_devices & ~wrapper::AUDIO_DEVICE_IN_ALL) != 0;
 }
+#elif defined(NO_HTC_POLICY_MANAGER)
+static constexpr struct device_table fixup_table = DEVICE_TABLE(fixup_audio_devices);
 #endif
 
-static wrapper::audio_devices_t fixup_audio_devices(wrapper::audio_devices_t device)
+uint32_t lookup_audio_devices(const uint32_t devices, flags_conversion_mode_t mode)
 {
-#ifdef NO_HTC_POLICY_MANAGER
-    // audio_policy.default wants to open BUILTIN_MIC for some input source
-    // which results in silence. The HTC audio_policy uses VOICE_CALL
-    // instead. Also the BUILTIN_MIC bit of get_supported_devices() is not
-    // set. So this seems the correct thing to do.
-    if((device & wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC) == wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC) {
-        ALOGI("%s: BUILTIN_MIC set, setting VOICE_CALL instead", __FUNCTION__);
-        device &= ~wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC;
-        device |= wrapper::AUDIO_DEVICE_IN_VOICE_CALL;
-    }
+    switch(mode) {
+    case ICS_TO_JB:
+#ifdef CONVERT_AUDIO_DEVICES_T
+        if((devices & ~wrapper::AUDIO_DEVICE_OUT_ALL) == 0)
+            return lookup_device_table(ics_to_jb_out_table, devices);
+        if((devices & ~wrapper::AUDIO_DEVICE_IN_ALL) == 0)
+            return lookup_device_table(ics_to_jb_in_table, devices) | AUDIO_DEVICE_BIT_IN;
 #endif
-    return device;
+        return devices;
+    case JB_TO_ICS:
+#ifdef CONVERT_AUDIO_DEVICES_T
+        if(audio_is_output_devices(devices))
+            return lookup_device_table(jb_to_ics_out_table, devices);
+        return lookup_device_table(jb_to_ics_in_table, devices);
+#elif defined(NO_HTC_POLICY_MANAGER)
+        return lookup_device_table(fixup_table, devices);
+#else
+        return devices;
+#endif
+    default:
+        return devices;
+    }
 }
 
 uint32_t convert_audio_devices(const uint32_t devices, flags_conversion_mode_t mode)
 {
-    uint32_t ret;
+    uint32_t ret = lookup_audio_devices(devices, mode);
+
     switch(mode) {
     case ICS_TO_JB:
 #ifdef CONVERT_AUDIO_DEVICES_T
-        ret = convert_ics_to_jb(devices);
-#else
-        ret = devices;
+        ALOGW_IF(is_mixed_ics_devices(devices), "%s: 0x%x has no proper representation",
+                 __FUNCTION__, devices);
 #endif
-        ALOGI("%s: ICS_TO_JB (0x%x -> 0x%x)", __FUNCTION__, devices, ret);
+        WLOGV(WRAPPER_LOG_COMMON, "%s: ICS_TO_JB (0x%x -> 0x%x)", __FUNCTION__, devices, ret);
         break;
     case JB_TO_ICS:
-#ifdef CONVERT_AUDIO_DEVICES_T
-        ret = convert_jb_to_ics(devices);
-#else
-        ret = devices;
-#endif
-        ret = fixup_audio_devices(ret);
-        ALOGI("%s: JB_TO_ICS (0x%x -> 0x%x)", __FUNCTION__, devices, ret);
+        WLOGV(WRAPPER_LOG_COMMON, "%s: JB_TO_ICS (0x%x -> 0x%x)", __FUNCTION__, devices, ret);
         break;
     default:
         ALOGE("%s: Invalid conversion mode %d", __FUNCTION__, mode);
-        ret = devices;
     }
 
     return ret;
 }
 
-char * fixup_audio_parameters(const char *kv_pairs, flags_conversion_mode_t mode)
+/*
+ * Keys whose values have a different encoding for the ICS blob and the JB 4.2
+ * framework. The format, channel mask and input source values of the 4.0 and
+ * 4.3 headers are the same (include/4.0 only redefines the devices), so for
+ * now routing is the only one. Adding a key is one line here.
+ *
+ * A key is found with a hash of its length and its first and last character.
+ * param_translation_slots maps every hash to the entry with that hash and is
+ * computed at compile time, the static_assert below makes sure no two keys
+ * share a hash. Pairs with other keys are mostly rejected without a compare.
+ */
+struct param_translation {
+    const char *key;
+    size_t key_len;
+    uint32_t (*convert)(uint32_t value, flags_conversion_mode_t mode);
+};
+
+#define PARAM_TRANSLATION(key, convert) { key, sizeof(key) - 1, convert }
+
+static constexpr struct param_translation param_translations[] = {
+    PARAM_TRANSLATION(AUDIO_PARAMETER_STREAM_ROUTING, convert_audio_devices),
+};
+
+#define PARAM_TRANSLATION_CNT \
+    (int) (sizeof(param_translations) / sizeof(param_translations[0]))
+#define PARAM_TRANSLATION_SLOTS 16
+
+static constexpr unsigned param_key_hash(const char *key, size_t len)
 {
-    int value;
-    size_t len;
-    char *out;
+    return (len + 3 * (unsigned char) key[0] + (unsigned char) key[len - 1]) &
+        (PARAM_TRANSLATION_SLOTS - 1);
+}
 
-    android::AudioParameter param = android::AudioParameter(android::String8(kv_pairs));
-    android::String8 key = android::String8(android::AudioParameter::keyRouting);
-
-    if (param.getInt(key, value) == android::NO_ERROR) {
-        ALOGI("%s: Fixing routing value (value: %x, mode: %d)", __FUNCTION__,
-              value, mode);
-        value = convert_audio_devices(value, mode);
-
-        // Adds value as a singed int that might be negative. Doesn't cause any
-        // problems because the bit representation is the same.
-        param.addInt(key, value);
-
-        // When param is freed the string returned by param.toString() seems to
-        // be freed as well, so copy it.
-        android::String8 fixed_kv_pairs = param.toString();
-        len = fixed_kv_pairs.length();
-        out = (char *) malloc(len + 1);
-        strcpy(out, fixed_kv_pairs.string());
-
-        ALOGI("%s: fixed_kv_pairs: %s (%d)", __FUNCTION__, out, strlen(out));
-    } else {
-        len = strlen(kv_pairs);
-        out = (char *) malloc(len + 1);
-        strcpy(out, kv_pairs);
+static constexpr unsigned param_translation_hash(int i)
+{
+    return param_key_hash(param_translations[i].key, param_translations[i].key_len);
+}
+
+static constexpr int param_translation_find(unsigned hash, int i)
+{
+    return i == PARAM_TRANSLATION_CNT ? -1 :
+        param_translation_hash(i) == hash ? i : param_translation_find(hash, i + 1);
+}
+
+static constexpr bool param_translations_unique(int i, int j)
+{
+    return i == PARAM_TRANSLATION_CNT ? true :
+        j == PARAM_TRANSLATION_CNT ? param_translations_unique(i + 1, i + 2) :
+        param_translation_hash(i) != param_translation_hash(j) &&
+        param_translations_unique(i, j + 1);
+}
+
+static_assert(param_translations_unique(0, 1),
+              "two translated parameter keys share a hash, change param_key_hash()");
+
+#define PARAM_SLOTS_1(h) param_translation_find(h, 0)
+#define PARAM_SLOTS_4(h) \
+    PARAM_SLOTS_1(h), PARAM_SLOTS_1((h) + 1), PARAM_SLOTS_1((h) + 2), PARAM_SLOTS_1((h) + 3)
+
+static constexpr int8_t param_translation_slots[PARAM_TRANSLATION_SLOTS] = {
+    PARAM_SLOTS_4(0), PARAM_SLOTS_4(4), PARAM_SLOTS_4(8), PARAM_SLOTS_4(12),
+};
+
+static inline const struct param_translation *find_param_translation(const char *key,
+                                                                      size_t len)
+{
+    int i;
+
+    if (!len)
+        return NULL;
+    i = param_translation_slots[param_key_hash(key, len)];
+    if (i < 0 || param_translations[i].key_len != len ||
+            memcmp(param_translations[i].key, key, len) != 0)
+        return NULL;
+    return &param_translations[i];
+}
+
+/**
+ * Writes value in decimal to buf, which needs room for 12 bytes. Returns the
+ * length without the terminating null byte.
+ */
+static size_t format_int(char *buf, int value)
+{
+    uint32_t magnitude = value < 0 ? 0U - (uint32_t) value : (uint32_t) value;
+    char digits[10];
+    size_t n = 0, len = 0;
+
+    do {
+        digits[n++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+        buf[len++] = '-';
+    while (n)
+        buf[len++] = digits[--n];
+    buf[len] = '\0';
+    return len;
+}
+
+/**
+ * Appends n bytes of src to buf at *len like snprintf, *len counts all bytes.
+ */
+static inline void append_bytes(char *buf, size_t size, size_t *len, const char *src, size_t n)
+{
+    if (*len < size)
+        memcpy(buf + *len, src, n < size - *len ? n : size - *len);
+    *len += n;
+}
+
+/**
+ * Copies kv_pairs to buf and converts the values of the keys in
+ * param_translations on the way, in one pass for any number of them. Works
+ * like snprintf: at most size bytes including the terminating null byte are
+ * written and the length of the full converted string is returned. Returns -1
+ * if kv_pairs has no such key or if converting does not change the string.
+ * The unchanged parts are copied in one go when a value changes, so nothing
+ * is copied in the -1 case. With size 0 only the length is measured and the
+ * conversions are not logged.
+ */
+static ssize_t convert_parameter_values(const char *kv_pairs,
+                                        flags_conversion_mode_t mode,
+                                        char *buf, size_t size)
+{
+    const char *pair = kv_pairs;
+    // kv_pairs is in buf up to here
+    const char *copied = kv_pairs;
+    size_t len = 0;
+
+    while (*pair) {
+        const char *end = strchr(pair, ';');
+        const char *key_end, *value;
+        const struct param_translation *translation;
+        char fixed_value[16];
+        char *value_end;
+        size_t value_len;
+
+        if (!end)
+            end = pair + strlen(pair);
+        key_end = (const char *) memchr(pair, '=', end - pair);
+
+        // Keep the same semantics as AudioParameter::getInt(): the key must
+        // match exactly and the value must start with a number.
+        if (key_end && (translation = find_param_translation(pair, key_end - pair))) {
+            value = key_end + 1;
+            long long number = strtoll(value, &value_end, 10);
+            if (value_end != value && value_end <= end) {
+                uint32_t fixed = translation->convert((uint32_t) number, mode);
+                // Written as a signed int like AudioParameter::addInt(). The
+                // bit representation is the same.
+                value_len = format_int(fixed_value, (int) fixed);
+                if (size)
+                    WLOGI(WRAPPER_LOG_COMMON, "%s: Fixing %s value (%.*s -> %s, mode: %d)",
+                          __FUNCTION__, translation->key, (int) (end - value), value,
+                          fixed_value, mode);
+                // Nothing to do if the value is already written that way.
+                if (value_len != (size_t) (end - value) ||
+                        strncmp(fixed_value, value, value_len) != 0) {
+                    append_bytes(buf, size, &len, copied, value - copied);
+                    append_bytes(buf, size, &len, fixed_value, value_len);
+                    copied = end;
+                }
+            }
+        }
+        pair = *end ? end + 1 : end;
+    }
+
+    if (copied == kv_pairs)
+        return -1;
+
+    append_bytes(buf, size, &len, copied, pair - copied);
+    if (size)
+        buf[len < size ? len : size - 1] = '\0';
+    return len;
+}
+
+bool has_audio_parameter(const char *kv_pairs, const char *key)
+{
+    size_t key_len = strlen(key);
+    const char *pair = kv_pairs;
+
+    while (*pair) {
+        const char *end = strchr(pair, ';');
+
+        if (!end)
+            end = pair + strlen(pair);
+        if ((size_t) (end - pair) >= key_len && strncmp(pair, key, key_len) == 0 &&
+                (pair + key_len == end || pair[key_len] == '='))
+            return true;
+        pair = *end ? end + 1 : end;
+    }
+
+    return false;
+}
+
+/**
+ * Returns the end of the pair at pair if its key is key, NULL otherwise.
+ */
+static const char * match_audio_parameter(const char *pair, const char *key, size_t key_len)
+{
+    const char *end = pair + strcspn(pair, ";");
+
+    if ((size_t) (end - pair) < key_len || strncmp(pair, key, key_len) != 0 ||
+            (pair + key_len != end && pair[key_len] != '='))
+        return NULL;
+    return end;
+}
+
+const char * get_audio_parameter(const char *kv_pairs, const char *key)
+{
+    size_t key_len = strlen(key);
+    const char *pair = kv_pairs, *value = NULL, *value_end = NULL;
+
+    while (*pair) {
+        const char *end = match_audio_parameter(pair, key, key_len);
+
+        if (end) {
+            value = pair + key_len + (pair + key_len != end);
+            value_end = end;
+        } else {
+            end = pair + strcspn(pair, ";");
+        }
+        pair = *end ? end + 1 : end;
+    }
+    return value ? scratch_strndup(value, value_end - value) : NULL;
+}
+
+bool get_audio_parameter_int(const char *kv_pairs, const char *key, int *value)
+{
+    size_t key_len = strlen(key);
+    const char *pair = kv_pairs;
+    bool found = false;
+
+    // Like AudioParameter the last pair with key wins
+    while (*pair) {
+        const char *end = match_audio_parameter(pair, key, key_len);
+
+        if (end) {
+            const char *number = pair + key_len + 1;
+            char *number_end;
+            long parsed = number <= end ? strtol(number, &number_end, 10) : 0;
+
+            found = number <= end && number_end != number && number_end <= end;
+            if (found)
+                *value = (int) parsed;
+        } else {
+            end = pair + strcspn(pair, ";");
+        }
+        pair = *end ? end + 1 : end;
+    }
+    return found;
+}
+
+const char * remove_audio_parameter(const char *kv_pairs, const char *key)
+{
+    size_t key_len = strlen(key);
+    const char *pair = kv_pairs, *copied = kv_pairs;
+    char *out = NULL;
+    size_t len = 0;
+
+    while (*pair) {
+        const char *end = match_audio_parameter(pair, key, key_len);
+        const char *next;
+
+        if (!end) {
+            end = pair + strcspn(pair, ";");
+            pair = *end ? end + 1 : end;
+            continue;
+        }
+        next = *end ? end + 1 : end;
+        if (!out) {
+            out = (char *) scratch_alloc(strlen(kv_pairs) + 1);
+            if (!out)
+                return NULL;
+        }
+        memcpy(out + len, copied, pair - copied);
+        len += pair - copied;
+        copied = pair = next;
     }
+    if (!out)
+        return kv_pairs;
+
+    memcpy(out + len, copied, pair - copied);
+    len += pair - copied;
+    // Drop the separators a removed last pair leaves behind
+    while (len && out[len - 1] == ';')
+        len--;
+    out[len] = '\0';
+    return out;
+}
+
+const char * fixup_audio_parameters_scratch(const char *kv_pairs, flags_conversion_mode_t mode)
+{
+    ssize_t len = convert_parameter_values(kv_pairs, mode, NULL, 0);
+    char *buf;
+
+    if (len < 0)
+        return kv_pairs;
+
+    buf = (char *) scratch_alloc(len + 1);
+    if (buf)
+        convert_parameter_values(kv_pairs, mode, buf, len + 1);
+    return buf;
+}
+
+char * fixup_returned_audio_parameters(char *kv_pairs, flags_conversion_mode_t mode)
+{
+    SCRATCH_SCOPE();
+    const char *fixed_kv_pairs;
+    char *out;
+
+    if (!kv_pairs)
+        return NULL;
+
+    fixed_kv_pairs = fixup_audio_parameters_scratch(kv_pairs, mode);
+    if (fixed_kv_pairs == kv_pairs)
+        return kv_pairs;
 
+    // The only heap copy, it is handed over to the caller
+    out = fixed_kv_pairs ? strdup(fixed_kv_pairs) : NULL;
+    free(kv_pairs);
     return out;
 }
@@ -17,6 +17,9 @@
 #ifndef AUDIO_WRAPPER_COMMON_H
 #define AUDIO_WRAPPER_COMMON_H
 
+#include <sys/types.h>
+
+#include <cutils/log.h>
 #include <media/AudioParameter.h>
 #include <hardware/audio.h>
 #include <hardware/hardware.h>
@@ -30,6 +33,47 @@
 #define WRAPPED_AUDIO_POLICY_VERSION ANDROID_VERSION(4, 0)
 #define WRAPPED_AUDIO_HAL_VERSION ANDROID_VERSION(4, 0)
 
+/**
+ * Subsystems with their own runtime log level. The levels are read from the
+ * persist.audiowrap.log property (all subsystems) and
+ * persist.audiowrap.log.<name> (hw, policy, service, common) when a wrapper
+ * module is opened. Values are 0/off, 1/info or 2/verbose.
+ */
+enum wrapper_log_subsystem {
+    WRAPPER_LOG_HW,
+    WRAPPER_LOG_POLICY,
+    WRAPPER_LOG_SERVICE,
+    WRAPPER_LOG_COMMON,
+    WRAPPER_LOG_SUBSYSTEM_CNT,
+};
+
+enum wrapper_log_level {
+    WRAPPER_LOG_OFF = 0,
+    WRAPPER_LOG_INFO = 1,
+    WRAPPER_LOG_VERBOSE = 2,
+};
+
+extern int32_t wrapper_log_levels[WRAPPER_LOG_SUBSYSTEM_CNT];
+
+void wrapper_log_init();
+
+#define WLOG_ENABLED(subsystem, level) \
+    (__atomic_load_n(&wrapper_log_levels[subsystem], __ATOMIC_RELAXED) >= (level))
+
+/**
+ * Log macros for hot paths. Unlike ALOGV they are not compiled out, when the
+ * level of the subsystem is too low only a relaxed load and a branch remain.
+ */
+#define WLOGI(subsystem, ...) do { \
+    if (WLOG_ENABLED(subsystem, WRAPPER_LOG_INFO)) \
+        ALOG(LOG_INFO, LOG_TAG, __VA_ARGS__); \
+} while (0)
+
+#define WLOGV(subsystem, ...) do { \
+    if (WLOG_ENABLED(subsystem, WRAPPER_LOG_VERBOSE)) \
+        ALOG(LOG_VERBOSE, LOG_TAG, __VA_ARGS__); \
+} while (0)
+
 enum flags_conversion_mode {
     ICS_TO_JB,
     JB_TO_ICS,
@@ -38,8 +82,54 @@ typedef enum flags_conversion_mode flags_conversion_mode_t;
 
 int load_vendor_module(const hw_module_t* wrapper_module, const char* name,
                        hw_device_t** device, const char* inst);
-char* fixup_audio_parameters(const char* kv_pairs, flags_conversion_mode_t mode);
 
+/**
+ * Converts the values of kv_pairs whose encoding differs between ICS and JB.
+ * Returns kv_pairs itself if there is nothing to convert, otherwise the
+ * converted string in scratch memory (see scratch.h), valid until the
+ * caller's ScratchScope ends. Returns NULL if out of memory.
+ */
+const char* fixup_audio_parameters_scratch(const char* kv_pairs, flags_conversion_mode_t mode);
+
+/**
+ * Converts a malloc'ed string returned by a get_parameters() call. Returns
+ * kv_pairs unchanged if there is nothing to convert, otherwise kv_pairs is
+ * freed and a newly allocated string is returned.
+ */
+char* fixup_returned_audio_parameters(char* kv_pairs, flags_conversion_mode_t mode);
+
+/**
+ * Returns true if kv_pairs contains key, with or without a value.
+ */
+bool has_audio_parameter(const char* kv_pairs, const char* key);
+
+/**
+ * Returns the value of key in scratch memory (see scratch.h), the last pair
+ * with key counts and a key without '=' has an empty value. Returns NULL if
+ * there is no such pair (or if out of memory).
+ */
+const char* get_audio_parameter(const char* kv_pairs, const char* key);
+
+/**
+ * Parses the value of key like AudioParameter::getInt(), the last pair with
+ * key counts. Returns false if there is none or its value is no number.
+ */
+bool get_audio_parameter_int(const char* kv_pairs, const char* key, int* value);
+
+/**
+ * Returns kv_pairs without the pairs with key, in scratch memory. Returns
+ * kv_pairs itself if it has no such pair and NULL if out of memory.
+ */
+const char* remove_audio_parameter(const char* kv_pairs, const char* key);
+
+/**
+ * Converts an audio_devices_t bit mask between the ICS and JB 4.2 API values.
+ */
 uint32_t convert_audio_devices(uint32_t devices, flags_conversion_mode_t mode);
 
+/**
+ * Same as convert_audio_devices() but without any logging.
+ */
+uint32_t lookup_audio_devices(uint32_t devices, flags_conversion_mode_t mode);
+
 #endif // AUDIO_WRAPPER_COMMON_H
@@ -10,3 +10,7 @@ HTC_ICS_AUDIO_BLOB := true
 
 BUILD_AUDIO_POLICY_WRAPPER := false
 BUILD_AUDIO_HW_WRAPPER := true
+
+# Builds host executables that link the wrappers against fake vendor HALs for
+# benchmarking the wrapper overhead. See host/Android.mk.
+BUILD_AUDIO_WRAPPER_HOST_TOOLS := false
@@ -0,0 +1,230 @@
+LOCAL_PATH := $(call my-dir)
+
+# Included from ../Android.mk, L_CFLAGS holds the processed config.mk flags.
+H_CFLAGS := $(L_CFLAGS) -O2
+H_C_INCLUDES := $(LOCAL_PATH)/..
+
+#
+# AudioParameter for the host. libmedia_helper is only built for the target so
+# build the same source file into a host library.
+#
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libaudio_wrapper_media_helper_host
+LOCAL_MODULE_CLASS := STATIC_LIBRARIES
+LOCAL_IS_HOST_MODULE := true
+
+intermediates := $(call local-intermediates-dir)
+GEN := $(intermediates)/AudioParameter.cpp
+$(GEN): $(TOP)/frameworks/av/media/libmedia/AudioParameter.cpp
+	$(copy-file-to-target)
+LOCAL_GENERATED_SOURCES := $(GEN)
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+#
+# audio.primary wrapper benchmark
+#
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    ../common.cpp \
+    ../param_cache.cpp \
+    ../pcm.cpp \
+    ../resampler.cpp \
+    ../ring.cpp \
+    ../scratch.cpp \
+    ../stats.cpp \
+    ../trace.cpp \
+    ../audio_hw.cpp \
+    mock_hardware.cpp \
+    mock_audio_hw.cpp \
+    audio_hw_benchmark.cpp
+
+LOCAL_C_INCLUDES := $(H_C_INCLUDES)
+LOCAL_STATIC_LIBRARIES := \
+    libaudio_wrapper_media_helper_host libutils liblog libcutils
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_CFLAGS := $(H_CFLAGS)
+LOCAL_CPPFLAGS := $(L_CPPFLAGS)
+
+LOCAL_MODULE := audio_hw_wrapper_benchmark
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+#
+# audio_policy wrapper benchmark
+#
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    ../common.cpp \
+    ../scratch.cpp \
+    ../stats.cpp \
+    ../trace.cpp \
+    ../aps_wrapper.cpp \
+    ../audio_policy.cpp \
+    mock_hardware.cpp \
+    mock_audio_policy.cpp \
+    audio_policy_benchmark.cpp
+
+LOCAL_C_INCLUDES := $(H_C_INCLUDES)
+LOCAL_STATIC_LIBRARIES := \
+    libaudio_wrapper_media_helper_host libutils liblog libcutils
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_CFLAGS := $(H_CFLAGS)
+LOCAL_CPPFLAGS := $(L_CPPFLAGS)
+
+LOCAL_MODULE := audio_policy_wrapper_benchmark
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+#
+# Decoder for trace files pulled from a device
+#
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    ../stats.cpp \
+    ../trace.cpp \
+    trace_dump.cpp
+
+LOCAL_C_INCLUDES := $(H_C_INCLUDES)
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_CFLAGS := $(H_CFLAGS)
+LOCAL_CPPFLAGS := $(L_CPPFLAGS)
+
+LOCAL_MODULE := audio_wrapper_trace_dump
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+#
+# Resampler cost per preset and rate pair
+#
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    ../resampler.cpp \
+    mock_hardware.cpp \
+    resampler_benchmark.cpp
+
+LOCAL_C_INCLUDES := $(H_C_INCLUDES)
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lpthread -lrt -lm
+
+LOCAL_CFLAGS := $(H_CFLAGS)
+LOCAL_CPPFLAGS := $(L_CPPFLAGS)
+
+LOCAL_MODULE := audio_wrapper_resampler_benchmark
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+#
+# Parameter string conversion throughput
+#
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    ../common.cpp \
+    ../scratch.cpp \
+    mock_hardware.cpp \
+    param_benchmark.cpp
+
+LOCAL_C_INCLUDES := $(H_C_INCLUDES)
+LOCAL_STATIC_LIBRARIES := \
+    libaudio_wrapper_media_helper_host libutils liblog libcutils
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_CFLAGS := $(H_CFLAGS)
+LOCAL_CPPFLAGS := $(L_CPPFLAGS)
+
+LOCAL_MODULE := audio_wrapper_param_benchmark
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+#
+# Output latency of plain, async and fast outputs against a fake blob that
+# plays in real time
+#
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    ../common.cpp \
+    ../param_cache.cpp \
+    ../pcm.cpp \
+    ../resampler.cpp \
+    ../ring.cpp \
+    ../scratch.cpp \
+    ../stats.cpp \
+    ../trace.cpp \
+    ../audio_hw.cpp \
+    mock_hardware.cpp \
+    mock_audio_hw.cpp \
+    latency_benchmark.cpp
+
+LOCAL_C_INCLUDES := $(H_C_INCLUDES)
+LOCAL_STATIC_LIBRARIES := \
+    libaudio_wrapper_media_helper_host libutils liblog libcutils
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_CFLAGS := $(H_CFLAGS)
+LOCAL_CPPFLAGS := $(L_CPPFLAGS)
+
+LOCAL_MODULE := audio_wrapper_latency_benchmark
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+#
+# Exhaustive check of the audio_devices_t lookup tables, once for each
+# conversion mode of config.mk.
+#
+CONVERT_TEST_CFLAGS := $(filter-out -DICS_AUDIO_BLOB -DCONVERT_AUDIO_DEVICES_T,$(H_CFLAGS))
+CONVERT_TEST_SRC_FILES := \
+    ../common.cpp \
+    ../scratch.cpp \
+    mock_hardware.cpp \
+    convert_audio_devices_test.cpp
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(CONVERT_TEST_SRC_FILES)
+LOCAL_C_INCLUDES := $(H_C_INCLUDES)
+LOCAL_STATIC_LIBRARIES := \
+    libaudio_wrapper_media_helper_host libutils liblog libcutils
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_CFLAGS := $(CONVERT_TEST_CFLAGS) -DCONVERT_AUDIO_DEVICES_T
+LOCAL_CPPFLAGS := $(L_CPPFLAGS)
+
+LOCAL_MODULE := audio_wrapper_convert_test
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(CONVERT_TEST_SRC_FILES)
+LOCAL_C_INCLUDES := $(H_C_INCLUDES)
+LOCAL_STATIC_LIBRARIES := \
+    libaudio_wrapper_media_helper_host libutils liblog libcutils
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_CFLAGS := $(CONVERT_TEST_CFLAGS) -DICS_AUDIO_BLOB
+LOCAL_CPPFLAGS := $(L_CPPFLAGS)
+
+LOCAL_MODULE := audio_wrapper_convert_test_ics
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,459 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the per call cost of the audio.primary wrapper. Every operation is
+ * run through the wrapper and, where possible, directly against the fake
+ * vendor HAL so the difference is the overhead added by the wrapper.
+ *
+ * Usage: audio_hw_wrapper_benchmark [-n iterations] [-w write_delay_us]
+ *                                   [-r read_delay_us] [-s stall_us]
+ *                                   [-S stall_every]
+ *
+ * The stall runs let the fake blob block for the duration of every buffer like
+ * a real one and additionally for stall_us on every stall_every-th write. They
+ * compare the write latency AudioFlinger sees with and without async writes.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/audio.h>
+
+#include "include/4.0/system/audio.h"
+#include "include/4.0/hardware/audio.h"
+#include "mock_hardware.h"
+
+extern struct audio_module HAL_MODULE_INFO_SYM;
+
+struct bench_context {
+    struct audio_hw_device *adev;
+    struct audio_stream_out *out;
+    struct audio_stream_in *in;
+    struct audio_stream_out *deep_out;
+    struct audio_stream_out *out_32;
+    struct wrapper::audio_hw_device *vendor_adev;
+    struct wrapper::audio_stream_out *vendor_out;
+    struct wrapper::audio_stream_in *vendor_in;
+    void *buffer;
+    size_t out_bytes;
+    size_t in_bytes;
+    size_t deep_out_bytes;
+    size_t out_32_bytes;
+};
+
+typedef void (*bench_func_t)(struct bench_context *ctx);
+
+static size_t max(size_t a, size_t b)
+{
+    return a > b ? a : b;
+}
+
+/**
+ * Runs func iterations times and prints per call and aggregate timings and
+ * the heap allocations per call.
+ */
+static void run_bench(const char *name, bench_func_t func,
+                      struct bench_context *ctx, int iterations)
+{
+    int64_t *samples = (int64_t *) malloc(iterations * sizeof(int64_t));
+    struct mock_sample_summary summary;
+    int64_t start, end;
+    unsigned long allocs;
+
+    if (!samples) {
+        fprintf(stderr, "%s: out of memory\n", name);
+        return;
+    }
+
+    // Warm up caches and lazily initialized state.
+    for (int i = 0; i < iterations / 100 + 1; i++)
+        func(ctx);
+
+    allocs = __atomic_load_n(&mock_heap_allocs, __ATOMIC_RELAXED);
+    start = mock_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        int64_t t0 = mock_now_ns();
+        func(ctx);
+        samples[i] = mock_now_ns() - t0;
+    }
+    end = mock_now_ns();
+    allocs = __atomic_load_n(&mock_heap_allocs, __ATOMIC_RELAXED) - allocs;
+
+    mock_summarize_samples(samples, iterations, &summary);
+    printf("%-32s %9d %10.3f %9lld %9lld %9lld %9lld %9lld %7.2f\n", name, iterations,
+           (end - start) / 1e6, (long long) summary.mean, (long long) summary.min,
+           (long long) summary.p50, (long long) summary.p99, (long long) summary.max,
+           (double) allocs / iterations);
+    free(samples);
+}
+
+/** Wrapper calls **/
+static void bench_out_write(struct bench_context *ctx)
+{
+    ctx->out->write(ctx->out, ctx->buffer, ctx->out_bytes);
+}
+
+static void bench_deep_out_write(struct bench_context *ctx)
+{
+    ctx->deep_out->write(ctx->deep_out, ctx->buffer, ctx->deep_out_bytes);
+}
+
+static void bench_out_32_write(struct bench_context *ctx)
+{
+    ctx->out_32->write(ctx->out_32, ctx->buffer, ctx->out_32_bytes);
+}
+
+static void bench_in_read(struct bench_context *ctx)
+{
+    ctx->in->read(ctx->in, ctx->buffer, ctx->in_bytes);
+}
+
+static void bench_adev_set_parameters(struct bench_context *ctx)
+{
+    ctx->adev->set_parameters(ctx->adev, "screen_state=on");
+}
+
+static void bench_adev_set_parameters_routing(struct bench_context *ctx)
+{
+    ctx->adev->set_parameters(ctx->adev, "routing=2");
+}
+
+static void bench_out_set_parameters_routing(struct bench_context *ctx)
+{
+    ctx->out->common.set_parameters(&ctx->out->common, "routing=2");
+}
+
+static void bench_out_set_parameters_route_change(struct bench_context *ctx)
+{
+    static unsigned int calls;
+
+    ctx->out->common.set_parameters(&ctx->out->common, calls++ & 1 ?
+                                    "routing=2;screen_state=on" : "routing=8;screen_state=on");
+}
+
+static void bench_out_get_parameters(struct bench_context *ctx)
+{
+    free(ctx->out->common.get_parameters(&ctx->out->common, "routing"));
+}
+
+static void bench_out_get_sample_rate(struct bench_context *ctx)
+{
+    ctx->out->common.get_sample_rate(&ctx->out->common);
+}
+
+static void bench_out_get_latency(struct bench_context *ctx)
+{
+    ctx->out->get_latency(ctx->out);
+}
+
+static void bench_open_close_output(struct bench_context *ctx)
+{
+    struct audio_stream_out *out;
+    struct audio_config config;
+    int ret;
+
+    memset(&config, 0, sizeof(config));
+#ifndef ICS_AUDIO_BLOB
+    ret = ctx->adev->open_output_stream(ctx->adev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                        AUDIO_OUTPUT_FLAG_PRIMARY, &config, &out);
+#else
+    int format = 0;
+    uint32_t channels = 0, rate = 0;
+    ret = ctx->adev->open_output_stream(ctx->adev, AUDIO_DEVICE_OUT_SPEAKER,
+                                        &format, &channels, &rate, &out);
+#endif
+    if (!ret)
+        ctx->adev->close_output_stream(ctx->adev, out);
+}
+
+static void bench_open_close_input(struct bench_context *ctx)
+{
+    struct audio_stream_in *in;
+    struct audio_config config;
+    int ret;
+
+    memset(&config, 0, sizeof(config));
+#ifndef ICS_AUDIO_BLOB
+    ret = ctx->adev->open_input_stream(ctx->adev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                                       &config, &in);
+#else
+    int format = 0;
+    uint32_t channels = 0, rate = 0;
+    ret = ctx->adev->open_input_stream(ctx->adev, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                                       &format, &channels, &rate,
+                                       (audio_in_acoustics_t) 0, &in);
+#endif
+    if (!ret)
+        ctx->adev->close_input_stream(ctx->adev, in);
+}
+
+/** Direct vendor calls for comparison **/
+static void bench_vendor_out_write(struct bench_context *ctx)
+{
+    ctx->vendor_out->write(ctx->vendor_out, ctx->buffer, ctx->out_bytes);
+}
+
+static void bench_vendor_in_read(struct bench_context *ctx)
+{
+    ctx->vendor_in->read(ctx->vendor_in, ctx->buffer, ctx->in_bytes);
+}
+
+static void bench_vendor_adev_set_parameters(struct bench_context *ctx)
+{
+    ctx->vendor_adev->set_parameters(ctx->vendor_adev, "screen_state=on");
+}
+
+static void bench_vendor_out_get_parameters(struct bench_context *ctx)
+{
+    free(ctx->vendor_out->common.get_parameters(&ctx->vendor_out->common, "routing"));
+}
+
+static int open_streams(struct bench_context *ctx)
+{
+    int ret;
+#ifndef ICS_AUDIO_BLOB
+    struct audio_config config;
+
+    memset(&config, 0, sizeof(config));
+    ret = ctx->adev->open_output_stream(ctx->adev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                        AUDIO_OUTPUT_FLAG_PRIMARY, &config, &ctx->out);
+    if (ret)
+        return ret;
+    memset(&config, 0, sizeof(config));
+    ret = ctx->adev->open_input_stream(ctx->adev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                                       &config, &ctx->in);
+    if (ret)
+        return ret;
+    memset(&config, 0, sizeof(config));
+    ret = ctx->adev->open_output_stream(ctx->adev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                        AUDIO_OUTPUT_FLAG_DEEP_BUFFER, &config,
+                                        &ctx->deep_out);
+    if (ret)
+        return ret;
+    memset(&config, 0, sizeof(config));
+    config.format = AUDIO_FORMAT_PCM_32_BIT;
+    ret = ctx->adev->open_output_stream(ctx->adev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                        AUDIO_OUTPUT_FLAG_PRIMARY, &config, &ctx->out_32);
+#else
+    int format = 0;
+    uint32_t channels = 0, rate = 0;
+
+    ret = ctx->adev->open_output_stream(ctx->adev, AUDIO_DEVICE_OUT_SPEAKER,
+                                        &format, &channels, &rate, &ctx->out);
+    if (ret)
+        return ret;
+    format = 0;
+    channels = 0;
+    rate = 0;
+    ret = ctx->adev->open_input_stream(ctx->adev, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                                       &format, &channels, &rate,
+                                       (audio_in_acoustics_t) 0, &ctx->in);
+    if (ret)
+        return ret;
+    format = AUDIO_FORMAT_PCM_32_BIT;
+    channels = 0;
+    rate = 0;
+    ret = ctx->adev->open_output_stream(ctx->adev, AUDIO_DEVICE_OUT_SPEAKER,
+                                        &format, &channels, &rate, &ctx->out_32);
+#endif
+    return ret;
+}
+
+static int open_vendor_streams(struct bench_context *ctx)
+{
+    const struct hw_module_t *module;
+    int format = 0;
+    uint32_t channels = 0, rate = 0;
+    int ret;
+
+    ret = hw_get_module("vendor-audio.primary", &module);
+    if (ret)
+        return ret;
+    ret = module->methods->open(module, AUDIO_HARDWARE_INTERFACE,
+                                (hw_device_t **) &ctx->vendor_adev);
+    if (ret)
+        return ret;
+
+    ret = ctx->vendor_adev->open_output_stream(ctx->vendor_adev,
+                                               wrapper::AUDIO_DEVICE_OUT_SPEAKER,
+                                               &format, &channels, &rate,
+                                               &ctx->vendor_out);
+    if (ret)
+        return ret;
+
+    format = 0;
+    channels = 0;
+    rate = 0;
+    return ctx->vendor_adev->open_input_stream(ctx->vendor_adev,
+                                               wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC,
+                                               &format, &channels, &rate,
+                                               (audio_in_acoustics_t) 0,
+                                               &ctx->vendor_in);
+}
+
+/**
+ * Runs out_write against a blob that blocks like a real one and stalls now and
+ * then, once directly and once with async writes. At most 200 writes each,
+ * they take real time.
+ */
+static void run_stall_benchmarks(struct bench_context *ctx, int iterations,
+                                 unsigned int stall_us, unsigned int stall_every)
+{
+    struct mock_audio_hw_config saved = mock_audio_hw_config;
+    uint32_t rate = ctx->out->common.get_sample_rate(&ctx->out->common);
+    size_t frame_size = audio_stream_frame_size(&ctx->out->common);
+    int writes = iterations < 200 ? iterations : 200;
+    int ret;
+
+    if (!rate || !frame_size)
+        return;
+
+    mock_audio_hw_config.write_delay_us = ctx->out_bytes / frame_size * 1000000 / rate;
+    mock_audio_hw_config.stall_us = stall_us;
+    mock_audio_hw_config.stall_every = stall_every;
+
+    run_bench("out_write (blob stalls)", bench_out_write, ctx, writes);
+    ret = ctx->out->common.set_parameters(&ctx->out->common, "audiowrap_async_write=8");
+    if (!ret) {
+        run_bench("out_write (async, blob stalls)", bench_out_write, ctx, writes);
+        ctx->out->common.standby(&ctx->out->common);
+        ctx->out->common.set_parameters(&ctx->out->common, "audiowrap_async_write=0");
+    } else {
+        fprintf(stderr, "Failed to enable async writes: %s\n", strerror(-ret));
+    }
+
+    mock_audio_hw_config = saved;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-w write_delay_us] [-r read_delay_us]\n"
+            "       [-s stall_us] [-S stall_every]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_context ctx;
+    int iterations = 100000;
+    unsigned int stall_us = 20000, stall_every = 16;
+    int opt;
+    int ret;
+
+    while ((opt = getopt(argc, argv, "n:w:r:s:S:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'w':
+            mock_audio_hw_config.write_delay_us = atoi(optarg);
+            break;
+        case 'r':
+            mock_audio_hw_config.read_delay_us = atoi(optarg);
+            break;
+        case 's':
+            stall_us = atoi(optarg);
+            break;
+        case 'S':
+            stall_every = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (iterations <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    mock_audio_hw_register();
+
+    ret = HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common,
+                                                   AUDIO_HARDWARE_INTERFACE,
+                                                   (hw_device_t **) &ctx.adev);
+    if (ret) {
+        fprintf(stderr, "Failed to open wrapper device: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    ret = open_streams(&ctx);
+    if (!ret)
+        ret = open_vendor_streams(&ctx);
+    if (ret) {
+        fprintf(stderr, "Failed to open streams: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    ctx.out_bytes = ctx.out->common.get_buffer_size(&ctx.out->common);
+    ctx.in_bytes = ctx.in->common.get_buffer_size(&ctx.in->common);
+    if (ctx.deep_out)
+        ctx.deep_out_bytes = ctx.deep_out->common.get_buffer_size(&ctx.deep_out->common);
+    ctx.out_32_bytes = ctx.out_32->common.get_buffer_size(&ctx.out_32->common);
+    ctx.buffer = calloc(1, max(max(ctx.deep_out_bytes, ctx.out_32_bytes),
+                               max(ctx.out_bytes, ctx.in_bytes)));
+    if (!ctx.buffer)
+        return 1;
+
+    printf("%-32s %9s %10s %9s %9s %9s %9s %9s %7s\n", "operation (ns)", "calls",
+           "total ms", "mean", "min", "p50", "p99", "max", "allocs");
+
+    run_bench("out_write", bench_out_write, &ctx, iterations);
+    // Software master volume, the fake blob rejects set_master_volume
+    ctx.adev->set_master_volume(ctx.adev, 0.5f);
+    run_bench("out_write (master volume)", bench_out_write, &ctx, iterations);
+    ctx.adev->set_master_volume(ctx.adev, 1.0f);
+    run_bench("vendor out_write", bench_vendor_out_write, &ctx, iterations);
+    if (ctx.deep_out)
+        run_bench("out_write (deep buffer)", bench_deep_out_write, &ctx, iterations);
+    run_bench("out_write (32 bit)", bench_out_32_write, &ctx, iterations);
+    run_bench("in_read", bench_in_read, &ctx, iterations);
+    run_bench("vendor in_read", bench_vendor_in_read, &ctx, iterations);
+    run_bench("adev_set_parameters", bench_adev_set_parameters, &ctx, iterations);
+    run_bench("adev_set_parameters (routing)", bench_adev_set_parameters_routing,
+              &ctx, iterations);
+    run_bench("vendor adev_set_parameters", bench_vendor_adev_set_parameters,
+              &ctx, iterations);
+    run_bench("out_set_parameters (routing)", bench_out_set_parameters_routing,
+              &ctx, iterations);
+    run_bench("out_set_parameters (new route)", bench_out_set_parameters_route_change,
+              &ctx, iterations);
+    run_bench("out_get_parameters", bench_out_get_parameters, &ctx, iterations);
+    run_bench("vendor out_get_parameters", bench_vendor_out_get_parameters,
+              &ctx, iterations);
+    run_bench("out_get_sample_rate", bench_out_get_sample_rate, &ctx, iterations);
+    run_bench("out_get_latency", bench_out_get_latency, &ctx, iterations);
+    run_bench("open/close output stream", bench_open_close_output, &ctx, iterations);
+    run_bench("open/close input stream", bench_open_close_input, &ctx, iterations);
+    run_stall_benchmarks(&ctx, iterations, stall_us, stall_every);
+
+    if (ctx.deep_out)
+        ctx.adev->close_output_stream(ctx.adev, ctx.deep_out);
+    ctx.adev->close_output_stream(ctx.adev, ctx.out_32);
+    ctx.adev->close_input_stream(ctx.adev, ctx.in);
+    ctx.adev->close_output_stream(ctx.adev, ctx.out);
+    ctx.adev->common.close(&ctx.adev->common);
+    ctx.vendor_adev->close_input_stream(ctx.vendor_adev, ctx.vendor_in);
+    ctx.vendor_adev->close_output_stream(ctx.vendor_adev, ctx.vendor_out);
+    ctx.vendor_adev->common.close(&ctx.vendor_adev->common);
+    free(ctx.buffer);
+
+    return 0;
+}
@@ -0,0 +1,561 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays the policy call sequences AudioService, AudioFlinger and
+ * AudioPolicyService produce for a few common situations and measures every
+ * call, once through the audio_policy wrapper and once directly on the fake
+ * vendor policy. In both cases the vendor policy calls back through the
+ * audio_policy_service_ops wrapper into a fake AudioPolicyService, so the
+ * difference is the overhead of the audio_policy wrapper itself.
+ *
+ * Usage: audio_policy_wrapper_benchmark [-n replays]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/audio_policy.h>
+
+#include "include/4.0/system/audio.h"
+#include "include/4.0/hardware/audio_policy.h"
+#include "aps_wrapper.h"
+#include "common.h"
+#include "mock_hardware.h"
+
+extern struct audio_policy_module HAL_MODULE_INFO_SYM;
+
+enum policy_call {
+    CALL_SET_DEVICE_CONNECTION_STATE,
+    CALL_GET_DEVICE_CONNECTION_STATE,
+    CALL_SET_PHONE_STATE,
+    CALL_SET_FORCE_USE,
+    CALL_GET_OUTPUT,
+    CALL_START_OUTPUT,
+    CALL_STOP_OUTPUT,
+    CALL_RELEASE_OUTPUT,
+    CALL_GET_INPUT,
+    CALL_START_INPUT,
+    CALL_STOP_INPUT,
+    CALL_RELEASE_INPUT,
+    CALL_SET_STREAM_VOLUME_INDEX,
+    CALL_APPLY_ALL_VOLUMES,
+    CALL_GET_STREAM_VOLUME_INDEX,
+    CALL_GET_STRATEGY_FOR_STREAM,
+    CALL_GET_DEVICES_FOR_STREAM,
+    CALL_IS_STREAM_ACTIVE,
+    CALL_CNT
+};
+
+static const char *policy_call_names[CALL_CNT] = {
+    "set_device_connection_state",
+    "get_device_connection_state",
+    "set_phone_state",
+    "set_force_use",
+    "get_output",
+    "start_output",
+    "stop_output",
+    "release_output",
+    "get_input",
+    "start_input",
+    "stop_input",
+    "release_input",
+    "set_stream_volume_index",
+    "apply_all_volumes",
+    "get_stream_volume_index",
+    "get_strategy_for_stream",
+    "get_devices_for_stream",
+    "is_stream_active",
+};
+
+/**
+ * One recorded policy call. The meaning of the arguments depends on the call:
+ * stream type, phone state, force use or input source for a, device,
+ * connection state, forced config or volume index for b.
+ */
+struct policy_step {
+    enum policy_call call;
+    int a;
+    int b;
+};
+
+struct policy_scenario {
+    const char *name;
+    const struct policy_step *steps;
+    int count;
+};
+
+#define SCENARIO(name, steps) { name, steps, sizeof(steps) / sizeof(steps[0]) }
+
+/* AudioTrack creation, e.g. on app startup */
+static const struct policy_step audiotrack_steps[] = {
+    { CALL_GET_OUTPUT, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_GET_STRATEGY_FOR_STREAM, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_START_OUTPUT, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_IS_STREAM_ACTIVE, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_STOP_OUTPUT, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_RELEASE_OUTPUT, AUDIO_STREAM_MUSIC, 0 },
+};
+
+/* Incoming call that is not answered */
+static const struct policy_step ringtone_steps[] = {
+    { CALL_SET_PHONE_STATE, AUDIO_MODE_RINGTONE, 0 },
+    { CALL_GET_STREAM_VOLUME_INDEX, AUDIO_STREAM_RING, 0 },
+    { CALL_GET_OUTPUT, AUDIO_STREAM_RING, 0 },
+    { CALL_GET_STRATEGY_FOR_STREAM, AUDIO_STREAM_RING, 0 },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_RING, 0 },
+    { CALL_START_OUTPUT, AUDIO_STREAM_RING, 0 },
+    { CALL_IS_STREAM_ACTIVE, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_RING, 0 },
+    { CALL_STOP_OUTPUT, AUDIO_STREAM_RING, 0 },
+    { CALL_RELEASE_OUTPUT, AUDIO_STREAM_RING, 0 },
+    { CALL_SET_PHONE_STATE, AUDIO_MODE_NORMAL, 0 },
+};
+
+/* Incoming call that is answered, switched to the speaker and hung up */
+static const struct policy_step call_setup_steps[] = {
+    { CALL_SET_PHONE_STATE, AUDIO_MODE_RINGTONE, 0 },
+    { CALL_GET_OUTPUT, AUDIO_STREAM_RING, 0 },
+    { CALL_START_OUTPUT, AUDIO_STREAM_RING, 0 },
+    { CALL_STOP_OUTPUT, AUDIO_STREAM_RING, 0 },
+    { CALL_RELEASE_OUTPUT, AUDIO_STREAM_RING, 0 },
+    { CALL_SET_PHONE_STATE, AUDIO_MODE_IN_CALL, 0 },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_VOICE_CALL, 0 },
+    { CALL_SET_STREAM_VOLUME_INDEX, AUDIO_STREAM_VOICE_CALL, 4 },
+    { CALL_GET_INPUT, AUDIO_SOURCE_VOICE_COMMUNICATION, 0 },
+    { CALL_START_INPUT, 0, 0 },
+    { CALL_SET_FORCE_USE, AUDIO_POLICY_FORCE_FOR_COMMUNICATION, AUDIO_POLICY_FORCE_SPEAKER },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_VOICE_CALL, 0 },
+    { CALL_SET_FORCE_USE, AUDIO_POLICY_FORCE_FOR_COMMUNICATION, AUDIO_POLICY_FORCE_NONE },
+    { CALL_STOP_INPUT, 0, 0 },
+    { CALL_RELEASE_INPUT, 0, 0 },
+    { CALL_SET_PHONE_STATE, AUDIO_MODE_NORMAL, 0 },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_VOICE_CALL, 0 },
+};
+
+/* Wired headset plugged in during music playback and removed again */
+static const struct policy_step headset_plug_steps[] = {
+    { CALL_GET_OUTPUT, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_START_OUTPUT, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_SET_DEVICE_CONNECTION_STATE, AUDIO_POLICY_DEVICE_STATE_AVAILABLE,
+      AUDIO_DEVICE_OUT_WIRED_HEADSET },
+    { CALL_GET_DEVICE_CONNECTION_STATE, 0, AUDIO_DEVICE_OUT_WIRED_HEADSET },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_RING, 0 },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_SYSTEM, 0 },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_VOICE_CALL, 0 },
+    { CALL_SET_STREAM_VOLUME_INDEX, AUDIO_STREAM_MUSIC, 5 },
+    { CALL_SET_DEVICE_CONNECTION_STATE, AUDIO_POLICY_DEVICE_STATE_UNAVAILABLE,
+      AUDIO_DEVICE_OUT_WIRED_HEADSET },
+    { CALL_GET_DEVICES_FOR_STREAM, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_SET_STREAM_VOLUME_INDEX, AUDIO_STREAM_MUSIC, 9 },
+    { CALL_STOP_OUTPUT, AUDIO_STREAM_MUSIC, 0 },
+    { CALL_RELEASE_OUTPUT, AUDIO_STREAM_MUSIC, 0 },
+};
+
+/*
+ * AudioService restoring the volumes at boot, every stream gets its index for
+ * every device (StreamState.applyAllVolumes())
+ */
+static const struct policy_step boot_volumes_steps[] = {
+    { CALL_APPLY_ALL_VOLUMES, AUDIO_STREAM_VOICE_CALL, 4 },
+    { CALL_APPLY_ALL_VOLUMES, AUDIO_STREAM_SYSTEM, 5 },
+    { CALL_APPLY_ALL_VOLUMES, AUDIO_STREAM_RING, 5 },
+    { CALL_APPLY_ALL_VOLUMES, AUDIO_STREAM_MUSIC, 11 },
+    { CALL_APPLY_ALL_VOLUMES, AUDIO_STREAM_ALARM, 6 },
+    { CALL_APPLY_ALL_VOLUMES, AUDIO_STREAM_NOTIFICATION, 5 },
+    { CALL_APPLY_ALL_VOLUMES, AUDIO_STREAM_BLUETOOTH_SCO, 7 },
+    { CALL_APPLY_ALL_VOLUMES, AUDIO_STREAM_DTMF, 11 },
+};
+
+/*
+ * Devices AudioService keeps an index for. The index of step b is used for
+ * the first one and is lowered by one for each following device.
+ */
+static const audio_devices_t volume_devices[] = {
+    AUDIO_DEVICE_OUT_SPEAKER,
+    AUDIO_DEVICE_OUT_EARPIECE,
+    AUDIO_DEVICE_OUT_WIRED_HEADSET,
+    AUDIO_DEVICE_OUT_WIRED_HEADPHONE,
+    AUDIO_DEVICE_OUT_BLUETOOTH_A2DP,
+    AUDIO_DEVICE_OUT_DEFAULT,
+};
+
+#define VOLUME_DEVICES_CNT (sizeof(volume_devices) / sizeof(volume_devices[0]))
+
+static const struct policy_scenario scenarios[] = {
+    SCENARIO("audiotrack", audiotrack_steps),
+    SCENARIO("ringtone", ringtone_steps),
+    SCENARIO("call setup", call_setup_steps),
+    SCENARIO("headset plug", headset_plug_steps),
+    SCENARIO("boot volumes", boot_volumes_steps),
+};
+
+struct replay_context {
+    struct audio_policy *ap;
+    struct wrapper::audio_policy *vendor_ap;
+    audio_io_handle_t output;
+    audio_io_handle_t input;
+};
+
+struct call_samples {
+    int64_t *samples;
+    int count;
+};
+
+/**
+ * Makes the call of step through the wrapper and returns its duration.
+ */
+static int64_t replay_wrapper_step(struct replay_context *ctx,
+                                   const struct policy_step *step)
+{
+    struct audio_policy *ap = ctx->ap;
+    audio_stream_type_t stream = (audio_stream_type_t) step->a;
+    int index;
+    int64_t start = mock_now_ns();
+
+    switch (step->call) {
+    case CALL_SET_DEVICE_CONNECTION_STATE:
+        ap->set_device_connection_state(ap, (audio_devices_t) step->b,
+                                        (audio_policy_dev_state_t) step->a, "");
+        break;
+    case CALL_GET_DEVICE_CONNECTION_STATE:
+        ap->get_device_connection_state(ap, (audio_devices_t) step->b, "");
+        break;
+    case CALL_SET_PHONE_STATE:
+        ap->set_phone_state(ap, (audio_mode_t) step->a);
+        break;
+    case CALL_SET_FORCE_USE:
+        ap->set_force_use(ap, (audio_policy_force_use_t) step->a,
+                          (audio_policy_forced_cfg_t) step->b);
+        break;
+    case CALL_GET_OUTPUT:
+        ctx->output = ap->get_output(ap, stream, 44100, AUDIO_FORMAT_PCM_16_BIT,
+                                     AUDIO_CHANNEL_OUT_STEREO, AUDIO_OUTPUT_FLAG_NONE);
+        break;
+    case CALL_START_OUTPUT:
+        ap->start_output(ap, ctx->output, stream, 0);
+        break;
+    case CALL_STOP_OUTPUT:
+        ap->stop_output(ap, ctx->output, stream, 0);
+        break;
+    case CALL_RELEASE_OUTPUT:
+        ap->release_output(ap, ctx->output);
+        break;
+    case CALL_GET_INPUT:
+        ctx->input = ap->get_input(ap, (audio_source_t) step->a, 8000,
+                                   AUDIO_FORMAT_PCM_16_BIT, AUDIO_CHANNEL_IN_MONO,
+                                   (audio_in_acoustics_t) 0);
+        break;
+    case CALL_START_INPUT:
+        ap->start_input(ap, ctx->input);
+        break;
+    case CALL_STOP_INPUT:
+        ap->stop_input(ap, ctx->input);
+        break;
+    case CALL_RELEASE_INPUT:
+        ap->release_input(ap, ctx->input);
+        break;
+    case CALL_SET_STREAM_VOLUME_INDEX:
+#ifndef ICS_AUDIO_BLOB
+        // AudioService sets the index for the device the stream is routed to
+        ap->set_stream_volume_index_for_device(ap, stream, step->b,
+                                               ap->get_devices_for_stream(ap, stream));
+#else
+        ap->set_stream_volume_index(ap, stream, step->b);
+#endif
+        break;
+    case CALL_APPLY_ALL_VOLUMES:
+        for (size_t i = 0; i < VOLUME_DEVICES_CNT; i++) {
+#ifndef ICS_AUDIO_BLOB
+            ap->set_stream_volume_index_for_device(ap, stream, step->b - i, volume_devices[i]);
+#else
+            ap->set_stream_volume_index(ap, stream, step->b - i);
+#endif
+        }
+        break;
+    case CALL_GET_STREAM_VOLUME_INDEX:
+        ap->get_stream_volume_index(ap, stream, &index);
+        break;
+    case CALL_GET_STRATEGY_FOR_STREAM:
+        ap->get_strategy_for_stream(ap, stream);
+        break;
+    case CALL_GET_DEVICES_FOR_STREAM:
+        ap->get_devices_for_stream(ap, stream);
+        break;
+    case CALL_IS_STREAM_ACTIVE:
+        ap->is_stream_active(ap, stream, 0);
+        break;
+    case CALL_CNT:
+        break;
+    }
+
+    return mock_now_ns() - start;
+}
+
+/**
+ * Makes the call of step directly on the vendor policy and returns its
+ * duration. Device arguments are converted before the clock starts.
+ */
+static int64_t replay_vendor_step(struct replay_context *ctx,
+                                  const struct policy_step *step)
+{
+    struct wrapper::audio_policy *ap = ctx->vendor_ap;
+    audio_stream_type_t stream = (audio_stream_type_t) step->a;
+    wrapper::audio_devices_t device =
+        (wrapper::audio_devices_t) convert_audio_devices(step->b, JB_TO_ICS);
+    int index;
+    int64_t start = mock_now_ns();
+
+    switch (step->call) {
+    case CALL_SET_DEVICE_CONNECTION_STATE:
+        ap->set_device_connection_state(ap, device, (audio_policy_dev_state_t) step->a, "");
+        break;
+    case CALL_GET_DEVICE_CONNECTION_STATE:
+        ap->get_device_connection_state(ap, device, "");
+        break;
+    case CALL_SET_PHONE_STATE:
+        ap->set_phone_state(ap, step->a);
+        break;
+    case CALL_SET_FORCE_USE:
+        ap->set_force_use(ap, (audio_policy_force_use_t) step->a,
+                          (audio_policy_forced_cfg_t) step->b);
+        break;
+    case CALL_GET_OUTPUT:
+        ctx->output = ap->get_output(ap, stream, 44100, AUDIO_FORMAT_PCM_16_BIT,
+                                     AUDIO_CHANNEL_OUT_STEREO, AUDIO_OUTPUT_FLAG_NONE);
+        break;
+    case CALL_START_OUTPUT:
+        ap->start_output(ap, ctx->output, stream, 0);
+        break;
+    case CALL_STOP_OUTPUT:
+        ap->stop_output(ap, ctx->output, stream, 0);
+        break;
+    case CALL_RELEASE_OUTPUT:
+        ap->release_output(ap, ctx->output);
+        break;
+    case CALL_GET_INPUT:
+        ctx->input = ap->get_input(ap, step->a, 8000, AUDIO_FORMAT_PCM_16_BIT,
+                                   AUDIO_CHANNEL_IN_MONO, (audio_in_acoustics_t) 0);
+        break;
+    case CALL_START_INPUT:
+        ap->start_input(ap, ctx->input);
+        break;
+    case CALL_STOP_INPUT:
+        ap->stop_input(ap, ctx->input);
+        break;
+    case CALL_RELEASE_INPUT:
+        ap->release_input(ap, ctx->input);
+        break;
+    case CALL_SET_STREAM_VOLUME_INDEX:
+        ap->set_stream_volume_index(ap, stream, step->b);
+        break;
+    case CALL_APPLY_ALL_VOLUMES:
+        // What the wrapper did before it kept an index per device
+        for (size_t i = 0; i < VOLUME_DEVICES_CNT; i++)
+            ap->set_stream_volume_index(ap, stream, step->b - i);
+        break;
+    case CALL_GET_STREAM_VOLUME_INDEX:
+        ap->get_stream_volume_index(ap, stream, &index);
+        break;
+    case CALL_GET_STRATEGY_FOR_STREAM:
+        ap->get_strategy_for_stream(ap, stream);
+        break;
+    case CALL_GET_DEVICES_FOR_STREAM:
+        ap->get_devices_for_stream(ap, stream);
+        break;
+    case CALL_IS_STREAM_ACTIVE:
+        ap->is_stream_active(ap, stream, 0);
+        break;
+    case CALL_CNT:
+        break;
+    }
+
+    return mock_now_ns() - start;
+}
+
+static void print_samples(const char *name, int64_t *samples, int count)
+{
+    struct mock_sample_summary summary;
+
+    if (!count)
+        return;
+
+    mock_summarize_samples(samples, count, &summary);
+    printf("%-40s %9d %9lld %9lld %9lld %9lld %9lld\n", name, count,
+           (long long) summary.mean, (long long) summary.min, (long long) summary.p50,
+           (long long) summary.p99, (long long) summary.max);
+}
+
+/**
+ * Replays scenario iterations times and prints the timings of each call type
+ * and of the whole sequence.
+ */
+static int run_scenario(const struct policy_scenario *scenario,
+                        struct replay_context *ctx, int iterations, bool vendor)
+{
+    struct call_samples calls[CALL_CNT];
+    struct mock_audio_policy_stats stats;
+    int64_t *totals;
+    int ret = 0;
+
+    memset(calls, 0, sizeof(calls));
+    totals = (int64_t *) malloc(iterations * sizeof(int64_t));
+    for (int i = 0; i < scenario->count; i++) {
+        struct call_samples *c = &calls[scenario->steps[i].call];
+        if (!c->samples)
+            c->samples = (int64_t *) malloc(iterations * scenario->count * sizeof(int64_t));
+        if (!c->samples)
+            ret = -ENOMEM;
+    }
+    if (!totals || ret) {
+        fprintf(stderr, "%s: out of memory\n", scenario->name);
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    // Warm up caches and lazily initialized state.
+    for (int i = 0; i < iterations / 100 + 1; i++) {
+        for (int j = 0; j < scenario->count; j++) {
+            if (vendor)
+                replay_vendor_step(ctx, &scenario->steps[j]);
+            else
+                replay_wrapper_step(ctx, &scenario->steps[j]);
+        }
+    }
+
+    stats = mock_audio_policy_stats;
+    for (int i = 0; i < iterations; i++) {
+        totals[i] = 0;
+        for (int j = 0; j < scenario->count; j++) {
+            const struct policy_step *step = &scenario->steps[j];
+            struct call_samples *c = &calls[step->call];
+            int64_t duration = vendor ? replay_vendor_step(ctx, step) :
+                                        replay_wrapper_step(ctx, step);
+            c->samples[c->count++] = duration;
+            totals[i] += duration;
+        }
+    }
+
+    printf("%s (%s)\n", scenario->name, vendor ? "vendor" : "wrapper");
+    for (int i = 0; i < CALL_CNT; i++)
+        print_samples(policy_call_names[i], calls[i].samples, calls[i].count);
+    print_samples("= whole sequence", totals, iterations);
+    printf("fake service callbacks per replay: %.1f routing changes, %.1f volume changes\n\n",
+           (double) (mock_audio_policy_stats.routing_changes - stats.routing_changes) / iterations,
+           (double) (mock_audio_policy_stats.volume_changes - stats.volume_changes) / iterations);
+
+out:
+    for (int i = 0; i < CALL_CNT; i++)
+        free(calls[i].samples);
+    free(totals);
+    return ret;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n replays]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    struct replay_context ctx;
+    struct audio_policy_device *dev;
+    const struct hw_module_t *vendor_module;
+    struct wrapper::audio_policy_device *vendor_dev;
+    void *vendor_service;
+    struct wrapper::audio_policy_service_ops *vendor_aps_ops;
+    int iterations = 10000;
+    int opt;
+    int ret;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (iterations <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    mock_audio_policy_register();
+
+    ret = HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common,
+                                                   AUDIO_POLICY_INTERFACE,
+                                                   (hw_device_t **) &dev);
+    if (!ret)
+        ret = dev->create_audio_policy(dev, mock_audio_policy_service_ops(), &ctx, &ctx.ap);
+    if (ret) {
+        fprintf(stderr, "Failed to create wrapper policy: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    // The vendor policy gets the service ops wrapper as well, like it does
+    // when it is created by the wrapper.
+    ret = hw_get_module("vendor-audio_policy", &vendor_module);
+    if (!ret)
+        ret = vendor_module->methods->open(vendor_module, AUDIO_POLICY_INTERFACE,
+                                           (hw_device_t **) &vendor_dev);
+    if (!ret)
+        ret = aps_wrapper_create(&ctx, mock_audio_policy_service_ops(), &vendor_service,
+                                 &vendor_aps_ops);
+    if (!ret)
+        ret = vendor_dev->create_audio_policy(vendor_dev, vendor_aps_ops, vendor_service,
+                                              &ctx.vendor_ap);
+    if (ret) {
+        fprintf(stderr, "Failed to create vendor policy: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    for (int i = 0; i < AUDIO_STREAM_CNT; i++) {
+        ctx.ap->init_stream_volume(ctx.ap, (audio_stream_type_t) i, 0, 15);
+        ctx.vendor_ap->init_stream_volume(ctx.vendor_ap, (audio_stream_type_t) i, 0, 15);
+    }
+
+    printf("%-40s %9s %9s %9s %9s %9s %9s\n", "call (ns)", "calls", "mean", "min",
+           "p50", "p99", "max");
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (run_scenario(&scenarios[i], &ctx, iterations, false) ||
+            run_scenario(&scenarios[i], &ctx, iterations, true))
+            return 1;
+    }
+
+    printf("fake service callbacks: %lu routing changes, %lu volume changes, "
+           "%lu set_parameters, %lu set_stream_volume, %lu open_input\n",
+           mock_audio_policy_stats.routing_changes, mock_audio_policy_stats.volume_changes,
+           mock_audio_policy_stats.set_parameters, mock_audio_policy_stats.set_stream_volume,
+           mock_audio_policy_stats.open_input);
+
+    vendor_dev->destroy_audio_policy(vendor_dev, ctx.vendor_ap);
+    aps_wrapper_destroy(vendor_service);
+    vendor_dev->common.close(&vendor_dev->common);
+    dev->destroy_audio_policy(dev, ctx.ap);
+    dev->common.close(&dev->common);
+
+    return 0;
+}
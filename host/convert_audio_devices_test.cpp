@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the lookup table based lookup_audio_devices() against the original
+ * branchy conversion code for all 2^32 inputs in both directions. Exits with
+ * 1 and prints the first mismatches if they differ.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "common.h"
+
+/*
+ * Reference implementation. Copy of the conversion code before it was
+ * replaced by lookup tables, minus the logging.
+ */
+#ifdef CONVERT_AUDIO_DEVICES_T
+static audio_devices_t convert_ics_to_jb(const wrapper::audio_devices_t wrapped_devices)
+{
+    audio_devices_t devices = 0;
+
+    if((wrapped_devices & ~wrapper::AUDIO_DEVICE_OUT_ALL) == 0) {
+        devices = wrapped_devices & ~wrapper::AUDIO_DEVICE_OUT_DEFAULT;
+
+        if(wrapped_devices & wrapper::AUDIO_DEVICE_OUT_DEFAULT) {
+            devices |= AUDIO_DEVICE_OUT_DEFAULT;
+        }
+    } else if((wrapped_devices & ~wrapper::AUDIO_DEVICE_IN_ALL) == 0) {
+        devices = ((wrapped_devices & ~wrapper::AUDIO_DEVICE_IN_DEFAULT) >> 16) | AUDIO_DEVICE_BIT_IN;
+
+        if((wrapped_devices & wrapper::AUDIO_DEVICE_IN_DEFAULT) == wrapper::AUDIO_DEVICE_IN_DEFAULT) {
+            devices |= AUDIO_DEVICE_IN_DEFAULT;
+        }
+    } else {
+        devices = wrapped_devices;
+    }
+
+    return devices;
+}
+
+#define DEVICE_OUT_MASK 0x3FFF
+#define DEVICE_IN_MASK 0xFF
+
+static wrapper::audio_devices_t convert_jb_to_ics(const audio_devices_t devices)
+{
+    wrapper::audio_devices_t wrapped_devices;
+
+    if(audio_is_output_devices(devices)) {
+        wrapped_devices = (devices & DEVICE_OUT_MASK);
+        if(devices & AUDIO_DEVICE_OUT_DEFAULT)
+            wrapped_devices |= wrapper::AUDIO_DEVICE_OUT_DEFAULT;
+    } else if((devices & AUDIO_DEVICE_BIT_IN) == AUDIO_DEVICE_BIT_IN) {
+        wrapped_devices = (devices & DEVICE_IN_MASK) << 16;
+        if((devices & AUDIO_DEVICE_IN_DEFAULT) == AUDIO_DEVICE_IN_DEFAULT)
+            wrapped_devices |= wrapper::AUDIO_DEVICE_IN_DEFAULT;
+    } else {
+        wrapped_devices = devices;
+    }
+
+    return wrapped_devices;
+}
+#endif
+
+static wrapper::audio_devices_t fixup_audio_devices(wrapper::audio_devices_t device)
+{
+#ifdef NO_HTC_POLICY_MANAGER
+    if((device & wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC) == wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC) {
+        device &= ~wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC;
+        device |= wrapper::AUDIO_DEVICE_IN_VOICE_CALL;
+    }
+#endif
+    return device;
+}
+
+static uint32_t reference_convert_audio_devices(const uint32_t devices,
+                                                flags_conversion_mode_t mode)
+{
+    uint32_t ret;
+    switch(mode) {
+    case ICS_TO_JB:
+#ifdef CONVERT_AUDIO_DEVICES_T
+        ret = convert_ics_to_jb(devices);
+#else
+        ret = devices;
+#endif
+        break;
+    case JB_TO_ICS:
+#ifdef CONVERT_AUDIO_DEVICES_T
+        ret = convert_jb_to_ics(devices);
+#else
+        ret = devices;
+#endif
+        ret = fixup_audio_devices(ret);
+        break;
+    default:
+        ret = devices;
+    }
+
+    return ret;
+}
+
+#define MAX_REPORTED_MISMATCHES 8
+
+struct check_range {
+    flags_conversion_mode_t mode;
+    uint64_t first;
+    uint64_t last;
+    unsigned long mismatches;
+};
+
+static void *check_thread(void *arg)
+{
+    struct check_range *range = (struct check_range *) arg;
+
+    for (uint64_t i = range->first; i < range->last; i++) {
+        uint32_t devices = (uint32_t) i;
+        uint32_t expected = reference_convert_audio_devices(devices, range->mode);
+        uint32_t actual = lookup_audio_devices(devices, range->mode);
+        if (actual != expected) {
+            if (range->mismatches < MAX_REPORTED_MISMATCHES)
+                printf("mode %d: 0x%08x -> 0x%08x, expected 0x%08x\n",
+                       range->mode, devices, actual, expected);
+            range->mismatches++;
+        }
+    }
+    return NULL;
+}
+
+static unsigned long check_mode(flags_conversion_mode_t mode, int num_threads)
+{
+    pthread_t threads[num_threads];
+    struct check_range ranges[num_threads];
+    const uint64_t total = 1ULL << 32;
+    unsigned long mismatches = 0;
+
+    for (int i = 0; i < num_threads; i++) {
+        ranges[i].mode = mode;
+        ranges[i].first = total * i / num_threads;
+        ranges[i].last = total * (i + 1) / num_threads;
+        ranges[i].mismatches = 0;
+        pthread_create(&threads[i], NULL, check_thread, &ranges[i]);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        mismatches += ranges[i].mismatches;
+    }
+    return mismatches;
+}
+
+int main()
+{
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long ics_to_jb, jb_to_ics;
+
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads > 64)
+        num_threads = 64;
+
+    ics_to_jb = check_mode(ICS_TO_JB, num_threads);
+    printf("ICS_TO_JB: %lu mismatches\n", ics_to_jb);
+    jb_to_ics = check_mode(JB_TO_ICS, num_threads);
+    printf("JB_TO_ICS: %lu mismatches\n", jb_to_ics);
+
+    return (ics_to_jb || jb_to_ics) ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the output latency from out_write() to the (fake) DAC for a plain,
+ * an async and fast outputs. The fake blob plays in real time with a buffer of
+ * its reported latency. A mixer loop writes silence with a marker sample
+ * every half second and the time from the write to the marker leaving the
+ * fake blob is the latency. It is compared with get_latency() and the p99 and
+ * longest out_write() call, which is what a FastMixer has to survive.
+ *
+ * Usage: audio_wrapper_latency_benchmark [-s seconds] [-l blob_latency_ms]
+ *                                        [-b blob_buffer_bytes]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/audio.h>
+
+#include "include/4.0/system/audio.h"
+#include "include/4.0/hardware/audio.h"
+#include "mock_hardware.h"
+
+extern struct audio_module HAL_MODULE_INFO_SYM;
+
+struct latency_mode {
+    const char *name;
+    // Wrapper-private parameter that sets the mode, NULL for a plain output
+    const char *kvpairs;
+};
+
+static const struct latency_mode modes[] = {
+    { "plain", NULL },
+    { "async 4", "audiowrap_async_write=4" },
+    { "fast /2", "audiowrap_fast_output=2" },
+    { "fast /4", "audiowrap_fast_output=4" },
+    { "fast /8", "audiowrap_fast_output=8" },
+};
+
+static int open_output(struct audio_hw_device *adev, struct audio_stream_out **out)
+{
+#ifndef ICS_AUDIO_BLOB
+    struct audio_config config;
+
+    memset(&config, 0, sizeof(config));
+    return adev->open_output_stream(adev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                    (audio_output_flags_t) (AUDIO_OUTPUT_FLAG_PRIMARY |
+                                                            AUDIO_OUTPUT_FLAG_FAST),
+                                    &config, out);
+#else
+    int format = 0;
+    uint32_t channels = 0, rate = 0;
+
+    return adev->open_output_stream(adev, AUDIO_DEVICE_OUT_SPEAKER, &format, &channels,
+                                    &rate, out);
+#endif
+}
+
+static void run_mode(struct audio_hw_device *adev, const struct latency_mode *mode,
+                     int seconds)
+{
+    struct audio_stream_out *out;
+    int16_t *buffer;
+    size_t bytes, frames, frame_size;
+    uint32_t rate;
+    int64_t start_ns, *call_ns, mix_ns = 0;
+    int64_t sum_ns = 0, min_ns = INT64_MAX, max_ns = 0;
+    struct mock_sample_summary calls;
+    int32_t marker = 0;
+    unsigned long writes, interval, count = 0;
+    int ret;
+
+    ret = open_output(adev, &out);
+    if (!ret && mode->kvpairs)
+        ret = out->common.set_parameters(&out->common, mode->kvpairs);
+    if (ret) {
+        printf("%-8s failed: %s\n", mode->name, strerror(-ret));
+        if (out)
+            adev->close_output_stream(adev, out);
+        return;
+    }
+
+    bytes = out->common.get_buffer_size(&out->common);
+    rate = out->common.get_sample_rate(&out->common);
+    frame_size = popcount(out->common.get_channels(&out->common)) * sizeof(int16_t);
+    frames = bytes / frame_size;
+    writes = frames ? (unsigned long) seconds * rate / frames : 0;
+    buffer = (int16_t *) calloc(1, bytes);
+    call_ns = (int64_t *) calloc(writes + 1, sizeof(int64_t));
+    if (!buffer || !call_ns || writes <= (rate / 2 + frames - 1) / frames + 1) {
+        fprintf(stderr, "out of memory or run too short\n");
+        exit(1);
+    }
+    // A marker about every half second, well above the latency. The odd
+    // interval moves it through the positions within a blob buffer.
+    interval = (rate / 2 + frames - 1) / frames | 1;
+    mock_audio_hw_stats.underruns = 0;
+    __atomic_store_n(&mock_audio_hw_stats.marker, 0, __ATOMIC_RELAXED);
+
+    for (unsigned long i = 0; i < writes; i++) {
+        if (i % interval == interval / 2) {
+            marker = marker % 32767 + 1;
+            buffer[0] = marker;
+            mix_ns = mock_now_ns();
+        }
+        start_ns = mock_now_ns();
+        out->write(out, buffer, bytes);
+        call_ns[i] = mock_now_ns() - start_ns;
+        buffer[0] = 0;
+        if (mix_ns && __atomic_load_n(&mock_audio_hw_stats.marker, __ATOMIC_ACQUIRE) == marker) {
+            int64_t latency_ns = mock_audio_hw_stats.marker_play_ns - mix_ns;
+            sum_ns += latency_ns;
+            if (latency_ns < min_ns)
+                min_ns = latency_ns;
+            if (latency_ns > max_ns)
+                max_ns = latency_ns;
+            count++;
+            mix_ns = 0;
+        }
+    }
+
+    // Without the writes that filled the buffers
+    writes -= interval;
+    mock_summarize_samples(call_ns + interval, writes, &calls);
+    if (count)
+        printf("%-8s %7zu %9u %8.1f %8.1f %8.1f %9.1f %9.1f %9lu\n", mode->name, frames,
+               out->get_latency(out), min_ns / 1e6, sum_ns / 1e6 / count, max_ns / 1e6,
+               calls.p99 / 1e6, calls.max / 1e6,
+               mock_audio_hw_stats.underruns);
+    else
+        printf("%-8s %7zu %9u no marker played\n", mode->name, frames, out->get_latency(out));
+
+    out->common.standby(&out->common);
+    adev->close_output_stream(adev, out);
+    free(call_ns);
+    free(buffer);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s seconds] [-l blob_latency_ms] [-b blob_buffer_bytes]\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    struct audio_hw_device *adev;
+    int seconds = 5;
+    int opt;
+    int ret;
+
+    while ((opt = getopt(argc, argv, "s:l:b:h")) != -1) {
+        switch (opt) {
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case 'l':
+            mock_audio_hw_config.out_latency_ms = atoi(optarg);
+            break;
+        case 'b':
+            mock_audio_hw_config.out_buffer_size = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (seconds <= 0 || !mock_audio_hw_config.out_latency_ms ||
+            !mock_audio_hw_config.out_buffer_size) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    mock_audio_hw_config.realtime = true;
+    mock_audio_hw_register();
+    ret = HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common,
+                                                   AUDIO_HARDWARE_INTERFACE,
+                                                   (hw_device_t **) &adev);
+    if (ret) {
+        fprintf(stderr, "Failed to open wrapper device: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    printf("%-8s %7s %9s %8s %8s %8s %9s %9s %9s\n", "output", "frames", "reported",
+           "min ms", "mean ms", "max ms", "write p99", "write max", "underruns");
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+        run_mode(adev, &modes[i], seconds);
+
+    adev->common.close(&adev->common);
+    return 0;
+}
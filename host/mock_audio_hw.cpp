@@ -0,0 +1,588 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fake vendor-audio.primary module that implements the ICS audio HAL API.
+ * It does no audio processing, it only mimics the calling conventions of the
+ * legacy blobs closely enough for benchmarking the wrapper.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hardware/audio.h>
+
+#include "include/4.0/system/audio.h"
+#include "include/4.0/hardware/audio.h"
+#include "mock_hardware.h"
+
+struct mock_audio_hw_config mock_audio_hw_config = {
+    /* out_sample_rate */ 44100,
+    /* in_sample_rate */ 44100,
+    /* out_buffer_size */ 4096,
+    /* in_buffer_size */ 4096,
+    /* out_latency_ms */ 92,
+    /* write_delay_us */ 0,
+    /* read_delay_us */ 0,
+    /* stall_every */ 0,
+    /* stall_us */ 0,
+    /* max_inputs */ 0,
+    /* realtime */ false,
+};
+
+struct mock_audio_hw_stats mock_audio_hw_stats;
+
+struct mock_stream_out {
+    struct wrapper::audio_stream_out stream;
+    uint32_t sample_rate;
+    uint32_t channels;
+    int format;
+    uint32_t devices;
+    uint32_t frames_written;
+    // Stall time the following writes catch up on
+    unsigned int stall_debt_us;
+    // Realtime playback: frame play_frames plays at play_start_ns + its
+    // duration, 0 in standby
+    int64_t play_start_ns;
+    uint64_t play_frames;
+};
+
+struct mock_stream_in {
+    struct wrapper::audio_stream_in stream;
+    uint32_t sample_rate;
+    uint32_t channels;
+    int format;
+    uint32_t devices;
+};
+
+struct mock_audio_device {
+    struct wrapper::audio_hw_device device;
+    uint32_t devices;
+    bool mic_mute;
+};
+
+static char *mock_get_parameters(uint32_t devices, const char *keys)
+{
+    char buf[64];
+
+    mock_audio_hw_stats.get_parameters++;
+    if (!strstr(keys, "routing"))
+        return strdup("");
+    snprintf(buf, sizeof(buf), "routing=%d", (int) devices);
+    return strdup(buf);
+}
+
+static void mock_parse_routing(uint32_t *devices, const char *kv_pairs)
+{
+    const char *routing = strstr(kv_pairs, "routing=");
+
+    mock_audio_hw_stats.set_parameters++;
+    if (routing)
+        *devices = (uint32_t) strtol(routing + strlen("routing="), NULL, 10);
+}
+
+/** audio_stream_out **/
+static uint32_t out_get_sample_rate(const struct wrapper::audio_stream *stream)
+{
+    return ((const struct mock_stream_out *) stream)->sample_rate;
+}
+
+static int out_set_sample_rate(struct wrapper::audio_stream *stream, uint32_t rate)
+{
+    return -ENOSYS;
+}
+
+static size_t out_get_buffer_size(const struct wrapper::audio_stream *stream)
+{
+    return mock_audio_hw_config.out_buffer_size;
+}
+
+static uint32_t out_get_channels(const struct wrapper::audio_stream *stream)
+{
+    return ((const struct mock_stream_out *) stream)->channels;
+}
+
+static audio_format_t out_get_format(const struct wrapper::audio_stream *stream)
+{
+    return (audio_format_t) ((const struct mock_stream_out *) stream)->format;
+}
+
+static int out_set_format(struct wrapper::audio_stream *stream, int format)
+{
+    return -ENOSYS;
+}
+
+static int out_standby(struct wrapper::audio_stream *stream)
+{
+    ((struct mock_stream_out *) stream)->play_start_ns = 0;
+    ((struct mock_stream_out *) stream)->play_frames = 0;
+    mock_audio_hw_stats.standby++;
+    return 0;
+}
+
+static int out_dump(const struct wrapper::audio_stream *stream, int fd)
+{
+    return 0;
+}
+
+static int out_set_parameters(struct wrapper::audio_stream *stream, const char *kv_pairs)
+{
+    mock_parse_routing(&((struct mock_stream_out *) stream)->devices, kv_pairs);
+    return 0;
+}
+
+static char *out_get_parameters(const struct wrapper::audio_stream *stream, const char *keys)
+{
+    return mock_get_parameters(((const struct mock_stream_out *) stream)->devices, keys);
+}
+
+static int out_add_audio_effect(const struct wrapper::audio_stream *stream,
+                                effect_handle_t effect)
+{
+    return 0;
+}
+
+static int out_remove_audio_effect(const struct wrapper::audio_stream *stream,
+                                   effect_handle_t effect)
+{
+    return 0;
+}
+
+static uint32_t out_get_latency(const struct wrapper::audio_stream_out *stream)
+{
+    return mock_audio_hw_config.out_latency_ms;
+}
+
+static int out_set_volume(struct wrapper::audio_stream_out *stream, float left,
+                          float right)
+{
+    return 0;
+}
+
+static int64_t out_frames_to_ns(const struct mock_stream_out *out, uint64_t frames)
+{
+    return (int64_t) (frames * 1000000000ULL / out->sample_rate);
+}
+
+/**
+ * Blocks until frames fit into the playback buffer and queues them.
+ */
+static void out_play_realtime(struct mock_stream_out *out, const int16_t *buffer,
+                              size_t frames)
+{
+    uint64_t limit = (uint64_t) mock_audio_hw_config.out_latency_ms * out->sample_rate / 1000;
+    unsigned int channels = popcount(out->channels);
+    int64_t now_ns = mock_now_ns();
+    uint64_t played;
+
+    if (!out->play_start_ns)
+        out->play_start_ns = now_ns;
+    played = (uint64_t) (now_ns - out->play_start_ns) * out->sample_rate / 1000000000ULL;
+    if (played > out->play_frames) {
+        // Played silence since the buffer ran empty, continue from now
+        if (out->play_frames)
+            mock_audio_hw_stats.underruns++;
+        out->play_start_ns = now_ns - out_frames_to_ns(out, out->play_frames);
+        played = out->play_frames;
+    }
+    if (out->play_frames - played + frames > limit)
+        mock_sleep_us(out_frames_to_ns(out, out->play_frames - played + frames - limit) / 1000);
+
+    for (size_t i = 0; i < frames; i++) {
+        if (buffer[i * channels]) {
+            mock_audio_hw_stats.marker_play_ns = out->play_start_ns +
+                out_frames_to_ns(out, out->play_frames + i);
+            __atomic_store_n(&mock_audio_hw_stats.marker, buffer[i * channels],
+                             __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    out->play_frames += frames;
+}
+
+static ssize_t out_write(struct wrapper::audio_stream_out *stream, const void *buffer,
+                         size_t bytes)
+{
+    struct mock_stream_out *out = (struct mock_stream_out *) stream;
+    unsigned int delay_us = mock_audio_hw_config.write_delay_us;
+
+    if (mock_audio_hw_config.stall_every &&
+            (mock_audio_hw_stats.writes + 1) % mock_audio_hw_config.stall_every == 0) {
+        delay_us += mock_audio_hw_config.stall_us;
+        out->stall_debt_us += mock_audio_hw_config.stall_us;
+    } else {
+        // The DSP kept playing during the stall, so there is room for the
+        // next writes sooner
+        unsigned int catch_up_us = out->stall_debt_us < delay_us ? out->stall_debt_us : delay_us;
+        delay_us -= catch_up_us;
+        out->stall_debt_us -= catch_up_us;
+    }
+    mock_sleep_us(delay_us);
+    if (mock_audio_hw_config.realtime)
+        out_play_realtime(out, (const int16_t *) buffer,
+                          bytes / (popcount(out->channels) * sizeof(int16_t)));
+    out->frames_written += bytes / (popcount(out->channels) * sizeof(int16_t));
+    mock_audio_hw_stats.writes++;
+    mock_audio_hw_stats.bytes_written += bytes;
+    return bytes;
+}
+
+static int out_get_render_position(const struct wrapper::audio_stream_out *stream,
+                                   uint32_t *dsp_frames)
+{
+    *dsp_frames = ((const struct mock_stream_out *) stream)->frames_written;
+    return 0;
+}
+
+/** audio_stream_in **/
+static uint32_t in_get_sample_rate(const struct wrapper::audio_stream *stream)
+{
+    return ((const struct mock_stream_in *) stream)->sample_rate;
+}
+
+static int in_set_sample_rate(struct wrapper::audio_stream *stream, uint32_t rate)
+{
+    return -ENOSYS;
+}
+
+static size_t in_get_buffer_size(const struct wrapper::audio_stream *stream)
+{
+    return mock_audio_hw_config.in_buffer_size;
+}
+
+static uint32_t in_get_channels(const struct wrapper::audio_stream *stream)
+{
+    return ((const struct mock_stream_in *) stream)->channels;
+}
+
+static audio_format_t in_get_format(const struct wrapper::audio_stream *stream)
+{
+    return (audio_format_t) ((const struct mock_stream_in *) stream)->format;
+}
+
+static int in_set_format(struct wrapper::audio_stream *stream, int format)
+{
+    return -ENOSYS;
+}
+
+static int in_standby(struct wrapper::audio_stream *stream)
+{
+    mock_audio_hw_stats.standby++;
+    return 0;
+}
+
+static int in_dump(const struct wrapper::audio_stream *stream, int fd)
+{
+    return 0;
+}
+
+static int in_set_parameters(struct wrapper::audio_stream *stream, const char *kv_pairs)
+{
+    mock_parse_routing(&((struct mock_stream_in *) stream)->devices, kv_pairs);
+    return 0;
+}
+
+static char *in_get_parameters(const struct wrapper::audio_stream *stream, const char *keys)
+{
+    return mock_get_parameters(((const struct mock_stream_in *) stream)->devices, keys);
+}
+
+static int in_add_audio_effect(const struct wrapper::audio_stream *stream,
+                               effect_handle_t effect)
+{
+    return 0;
+}
+
+static int in_remove_audio_effect(const struct wrapper::audio_stream *stream,
+                                  effect_handle_t effect)
+{
+    return 0;
+}
+
+static int in_set_gain(struct wrapper::audio_stream_in *stream, float gain)
+{
+    return 0;
+}
+
+static ssize_t in_read(struct wrapper::audio_stream_in *stream, void *buffer,
+                       size_t bytes)
+{
+    mock_sleep_us(mock_audio_hw_config.read_delay_us);
+    memset(buffer, 0, bytes);
+    mock_audio_hw_stats.reads++;
+    mock_audio_hw_stats.bytes_read += bytes;
+    return bytes;
+}
+
+static uint32_t in_get_input_frames_lost(struct wrapper::audio_stream_in *stream)
+{
+    return 0;
+}
+
+/** audio_hw_device **/
+static uint32_t adev_get_supported_devices(const struct wrapper::audio_hw_device *dev)
+{
+    return wrapper::AUDIO_DEVICE_OUT_ALL | wrapper::AUDIO_DEVICE_IN_ALL;
+}
+
+static int adev_init_check(const struct wrapper::audio_hw_device *dev)
+{
+    return 0;
+}
+
+static int adev_set_voice_volume(struct wrapper::audio_hw_device *dev, float volume)
+{
+    return 0;
+}
+
+static int adev_set_master_volume(struct wrapper::audio_hw_device *dev, float volume)
+{
+    return -ENOSYS;
+}
+
+static int adev_set_mode(struct wrapper::audio_hw_device *dev, int mode)
+{
+    return 0;
+}
+
+static int adev_set_mic_mute(struct wrapper::audio_hw_device *dev, bool state)
+{
+    ((struct mock_audio_device *) dev)->mic_mute = state;
+    return 0;
+}
+
+static int adev_get_mic_mute(const struct wrapper::audio_hw_device *dev, bool *state)
+{
+    *state = ((const struct mock_audio_device *) dev)->mic_mute;
+    return 0;
+}
+
+static int adev_set_parameters(struct wrapper::audio_hw_device *dev, const char *kv_pairs)
+{
+    mock_parse_routing(&((struct mock_audio_device *) dev)->devices, kv_pairs);
+    return 0;
+}
+
+static char *adev_get_parameters(const struct wrapper::audio_hw_device *dev,
+                                 const char *keys)
+{
+    return mock_get_parameters(((const struct mock_audio_device *) dev)->devices, keys);
+}
+
+static size_t adev_get_input_buffer_size(const struct wrapper::audio_hw_device *dev,
+                                         uint32_t sample_rate, int format,
+                                         int channel_count)
+{
+    if (sample_rate != mock_audio_hw_config.in_sample_rate)
+        return 0;
+    return mock_audio_hw_config.in_buffer_size;
+}
+
+static int adev_open_output_stream(struct wrapper::audio_hw_device *dev,
+                                   uint32_t devices, int *format,
+                                   uint32_t *channels, uint32_t *sample_rate,
+                                   struct wrapper::audio_stream_out **stream_out)
+{
+    struct mock_stream_out *out;
+
+    *stream_out = NULL;
+    if (*format == 0)
+        *format = AUDIO_FORMAT_PCM_16_BIT;
+    if (*channels == 0)
+        *channels = AUDIO_CHANNEL_OUT_STEREO;
+    if (*sample_rate == 0)
+        *sample_rate = mock_audio_hw_config.out_sample_rate;
+
+    if (*format != AUDIO_FORMAT_PCM_16_BIT ||
+            *sample_rate != mock_audio_hw_config.out_sample_rate) {
+        *format = AUDIO_FORMAT_PCM_16_BIT;
+        *sample_rate = mock_audio_hw_config.out_sample_rate;
+        return -EINVAL;
+    }
+
+    out = (struct mock_stream_out *) calloc(1, sizeof(*out));
+    if (!out)
+        return -ENOMEM;
+
+    out->stream.common.get_sample_rate = out_get_sample_rate;
+    out->stream.common.set_sample_rate = out_set_sample_rate;
+    out->stream.common.get_buffer_size = out_get_buffer_size;
+    out->stream.common.get_channels = out_get_channels;
+    out->stream.common.get_format = out_get_format;
+    out->stream.common.set_format = out_set_format;
+    out->stream.common.standby = out_standby;
+    out->stream.common.dump = out_dump;
+    out->stream.common.set_parameters = out_set_parameters;
+    out->stream.common.get_parameters = out_get_parameters;
+    out->stream.common.add_audio_effect = out_add_audio_effect;
+    out->stream.common.remove_audio_effect = out_remove_audio_effect;
+    out->stream.get_latency = out_get_latency;
+    out->stream.set_volume = out_set_volume;
+    out->stream.write = out_write;
+    out->stream.get_render_position = out_get_render_position;
+
+    out->sample_rate = *sample_rate;
+    out->channels = *channels;
+    out->format = *format;
+    out->devices = devices;
+
+    *stream_out = &out->stream;
+    return 0;
+}
+
+static void adev_close_output_stream(struct wrapper::audio_hw_device *dev,
+                                     struct wrapper::audio_stream_out *stream)
+{
+    free(stream);
+}
+
+static int adev_open_input_stream(struct wrapper::audio_hw_device *dev,
+                                  uint32_t devices, int *format,
+                                  uint32_t *channels, uint32_t *sample_rate,
+                                  audio_in_acoustics_t acoustics,
+                                  struct wrapper::audio_stream_in **stream_in)
+{
+    struct mock_stream_in *in;
+
+    *stream_in = NULL;
+    if (*format == 0)
+        *format = AUDIO_FORMAT_PCM_16_BIT;
+    if (*channels == 0)
+        *channels = AUDIO_CHANNEL_IN_MONO;
+    if (*sample_rate == 0)
+        *sample_rate = mock_audio_hw_config.in_sample_rate;
+
+    if (*format != AUDIO_FORMAT_PCM_16_BIT ||
+            *sample_rate != mock_audio_hw_config.in_sample_rate) {
+        *format = AUDIO_FORMAT_PCM_16_BIT;
+        *sample_rate = mock_audio_hw_config.in_sample_rate;
+        return -EINVAL;
+    }
+    if (mock_audio_hw_config.max_inputs &&
+            mock_audio_hw_stats.open_inputs >= mock_audio_hw_config.max_inputs)
+        return -EBUSY;
+
+    in = (struct mock_stream_in *) calloc(1, sizeof(*in));
+    if (!in)
+        return -ENOMEM;
+    mock_audio_hw_stats.open_inputs++;
+
+    in->stream.common.get_sample_rate = in_get_sample_rate;
+    in->stream.common.set_sample_rate = in_set_sample_rate;
+    in->stream.common.get_buffer_size = in_get_buffer_size;
+    in->stream.common.get_channels = in_get_channels;
+    in->stream.common.get_format = in_get_format;
+    in->stream.common.set_format = in_set_format;
+    in->stream.common.standby = in_standby;
+    in->stream.common.dump = in_dump;
+    in->stream.common.set_parameters = in_set_parameters;
+    in->stream.common.get_parameters = in_get_parameters;
+    in->stream.common.add_audio_effect = in_add_audio_effect;
+    in->stream.common.remove_audio_effect = in_remove_audio_effect;
+    in->stream.set_gain = in_set_gain;
+    in->stream.read = in_read;
+    in->stream.get_input_frames_lost = in_get_input_frames_lost;
+
+    in->sample_rate = *sample_rate;
+    in->channels = *channels;
+    in->format = *format;
+    in->devices = devices;
+
+    *stream_in = &in->stream;
+    return 0;
+}
+
+static void adev_close_input_stream(struct wrapper::audio_hw_device *dev,
+                                    struct wrapper::audio_stream_in *stream)
+{
+    mock_audio_hw_stats.open_inputs--;
+    free(stream);
+}
+
+static int adev_dump(const struct wrapper::audio_hw_device *dev, int fd)
+{
+    return 0;
+}
+
+static int adev_close(hw_device_t *dev)
+{
+    free(dev);
+    return 0;
+}
+
+static int adev_open(const hw_module_t *module, const char *name,
+                     hw_device_t **device)
+{
+    struct mock_audio_device *adev;
+
+    if (strcmp(name, AUDIO_HARDWARE_INTERFACE) != 0)
+        return -EINVAL;
+
+    adev = (struct mock_audio_device *) calloc(1, sizeof(*adev));
+    if (!adev)
+        return -ENOMEM;
+
+    adev->device.common.tag = HARDWARE_DEVICE_TAG;
+    adev->device.common.version = 0;
+    adev->device.common.module = (struct hw_module_t *) module;
+    adev->device.common.close = adev_close;
+
+    adev->device.get_supported_devices = adev_get_supported_devices;
+    adev->device.init_check = adev_init_check;
+    adev->device.set_voice_volume = adev_set_voice_volume;
+    adev->device.set_master_volume = adev_set_master_volume;
+    adev->device.set_mode = adev_set_mode;
+    adev->device.set_mic_mute = adev_set_mic_mute;
+    adev->device.get_mic_mute = adev_get_mic_mute;
+    adev->device.set_parameters = adev_set_parameters;
+    adev->device.get_parameters = adev_get_parameters;
+    adev->device.get_input_buffer_size = adev_get_input_buffer_size;
+    adev->device.open_output_stream = adev_open_output_stream;
+    adev->device.close_output_stream = adev_close_output_stream;
+    adev->device.open_input_stream = adev_open_input_stream;
+    adev->device.close_input_stream = adev_close_input_stream;
+    adev->device.dump = adev_dump;
+
+    adev->devices = wrapper::AUDIO_DEVICE_OUT_SPEAKER;
+
+    *device = &adev->device.common;
+    return 0;
+}
+
+static struct hw_module_methods_t mock_module_methods = {
+    /* open */ adev_open,
+};
+
+static struct wrapper::audio_module mock_module = {
+    /* common */ {
+        /* tag */ HARDWARE_MODULE_TAG,
+        /* version_major */ { 1 },
+        /* version_minor */ { 0 },
+        /* id */ "vendor-audio.primary",
+        /* name */ "Fake ICS audio HW HAL",
+        /* author */ "The Android Open Source Project",
+        /* methods */ &mock_module_methods,
+        /* dso */ NULL,
+        /* reserved */ {0},
+    },
+};
+
+int mock_audio_hw_register()
+{
+    return mock_register_module(&mock_module.common);
+}
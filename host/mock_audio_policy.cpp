@@ -0,0 +1,663 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fake vendor-audio_policy module that implements the ICS audio policy API
+ * and a fake AudioPolicyService (the audio_policy_service_ops the framework
+ * passes to create_audio_policy). The policy keeps just enough state to call
+ * back into the service the way AudioPolicyManagerBase does: it opens the
+ * primary output on creation, reroutes it on device and phone state changes
+ * and applies stream volumes.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hardware/audio_policy.h>
+
+#include "include/4.0/system/audio.h"
+#include "include/4.0/hardware/audio_policy.h"
+#include "mock_hardware.h"
+
+struct mock_audio_policy_stats mock_audio_policy_stats;
+
+struct mock_audio_policy {
+    struct wrapper::audio_policy policy;
+    struct wrapper::audio_policy_service_ops *aps_ops;
+    void *service;
+    audio_io_handle_t output;
+    uint32_t available_devices;
+    uint32_t output_device;
+    int phone_state;
+    int force_use[AUDIO_POLICY_FORCE_USE_CNT];
+    int index_min[AUDIO_STREAM_CNT];
+    int index_max[AUDIO_STREAM_CNT];
+    int index[AUDIO_STREAM_CNT];
+    int active[AUDIO_STREAM_CNT];
+};
+
+#define MOCK_POLICY(p) ((struct mock_audio_policy *) (p))
+
+/** Policy decisions **/
+
+static uint32_t mock_get_device(const struct mock_audio_policy *mp,
+                                audio_stream_type_t stream)
+{
+    if (stream == AUDIO_STREAM_VOICE_CALL || mp->phone_state == AUDIO_MODE_IN_CALL) {
+        if (mp->available_devices & wrapper::AUDIO_DEVICE_OUT_WIRED_HEADSET)
+            return wrapper::AUDIO_DEVICE_OUT_WIRED_HEADSET;
+        if (mp->force_use[AUDIO_POLICY_FORCE_FOR_COMMUNICATION] == AUDIO_POLICY_FORCE_SPEAKER)
+            return wrapper::AUDIO_DEVICE_OUT_SPEAKER;
+        return wrapper::AUDIO_DEVICE_OUT_EARPIECE;
+    }
+
+    // Ringtones and alarms play on the speaker and the headset
+    if (stream == AUDIO_STREAM_RING || stream == AUDIO_STREAM_ALARM ||
+        stream == AUDIO_STREAM_NOTIFICATION)
+        return wrapper::AUDIO_DEVICE_OUT_SPEAKER |
+               (mp->available_devices & wrapper::AUDIO_DEVICE_OUT_WIRED_HEADSET);
+
+    if (mp->available_devices & wrapper::AUDIO_DEVICE_OUT_WIRED_HEADSET)
+        return wrapper::AUDIO_DEVICE_OUT_WIRED_HEADSET;
+    if (mp->available_devices & wrapper::AUDIO_DEVICE_OUT_WIRED_HEADPHONE)
+        return wrapper::AUDIO_DEVICE_OUT_WIRED_HEADPHONE;
+    return wrapper::AUDIO_DEVICE_OUT_SPEAKER;
+}
+
+/**
+ * Routes the primary output to the device of the most important active
+ * stream, like AudioPolicyManagerBase::getNewDevice() does.
+ */
+static void mock_update_routing(struct mock_audio_policy *mp, int delay_ms)
+{
+    audio_stream_type_t stream = AUDIO_STREAM_MUSIC;
+    uint32_t device;
+    char kv_pairs[32];
+
+    if (mp->phone_state == AUDIO_MODE_IN_CALL)
+        stream = AUDIO_STREAM_VOICE_CALL;
+    else if (mp->active[AUDIO_STREAM_RING])
+        stream = AUDIO_STREAM_RING;
+
+    device = mock_get_device(mp, stream);
+    if (device == mp->output_device)
+        return;
+
+    mp->output_device = device;
+    snprintf(kv_pairs, sizeof(kv_pairs), "routing=%u", device);
+    mp->aps_ops->set_parameters(mp->service, mp->output, kv_pairs, delay_ms);
+    mock_audio_policy_stats.routing_changes++;
+}
+
+static void mock_apply_volume(struct mock_audio_policy *mp, audio_stream_type_t stream,
+                              int delay_ms)
+{
+    int range = mp->index_max[stream] - mp->index_min[stream];
+    float volume = range > 0 ? (float) (mp->index[stream] - mp->index_min[stream]) / range : 1.0f;
+
+    mp->aps_ops->set_stream_volume(mp->service, stream, volume, mp->output, delay_ms);
+    if (stream == AUDIO_STREAM_VOICE_CALL)
+        mp->aps_ops->set_voice_volume(mp->service, volume, delay_ms);
+    mock_audio_policy_stats.volume_changes++;
+}
+
+/** audio_policy **/
+
+static int ap_set_device_connection_state(struct wrapper::audio_policy *pol,
+                                          wrapper::audio_devices_t device,
+                                          audio_policy_dev_state_t state,
+                                          const char *device_address)
+{
+    struct mock_audio_policy *mp = MOCK_POLICY(pol);
+
+    if (state == AUDIO_POLICY_DEVICE_STATE_AVAILABLE)
+        mp->available_devices |= device;
+    else
+        mp->available_devices &= ~device;
+    mock_update_routing(mp, 0);
+    return 0;
+}
+
+static audio_policy_dev_state_t ap_get_device_connection_state(
+                                            const struct wrapper::audio_policy *pol,
+                                            wrapper::audio_devices_t device,
+                                            const char *device_address)
+{
+    return (MOCK_POLICY(pol)->available_devices & device) ?
+        AUDIO_POLICY_DEVICE_STATE_AVAILABLE : AUDIO_POLICY_DEVICE_STATE_UNAVAILABLE;
+}
+
+static void ap_set_phone_state(struct wrapper::audio_policy *pol, int state)
+{
+    struct mock_audio_policy *mp = MOCK_POLICY(pol);
+
+    if (mp->phone_state == state)
+        return;
+    mp->phone_state = state;
+    mock_update_routing(mp, 0);
+    if (state == AUDIO_MODE_IN_CALL)
+        mock_apply_volume(mp, AUDIO_STREAM_VOICE_CALL, 0);
+}
+
+static void ap_set_ringer_mode(struct wrapper::audio_policy *pol, uint32_t mode,
+                               uint32_t mask)
+{
+}
+
+static void ap_set_force_use(struct wrapper::audio_policy *pol,
+                             audio_policy_force_use_t usage,
+                             audio_policy_forced_cfg_t config)
+{
+    struct mock_audio_policy *mp = MOCK_POLICY(pol);
+
+    if (usage < 0 || usage >= AUDIO_POLICY_FORCE_USE_CNT)
+        return;
+    mp->force_use[usage] = config;
+    mock_update_routing(mp, 0);
+}
+
+static audio_policy_forced_cfg_t ap_get_force_use(const struct wrapper::audio_policy *pol,
+                                                  audio_policy_force_use_t usage)
+{
+    if (usage < 0 || usage >= AUDIO_POLICY_FORCE_USE_CNT)
+        return AUDIO_POLICY_FORCE_NONE;
+    return (audio_policy_forced_cfg_t) MOCK_POLICY(pol)->force_use[usage];
+}
+
+static void ap_set_can_mute_enforced_audible(struct wrapper::audio_policy *pol,
+                                             bool can_mute)
+{
+}
+
+static int ap_init_check(const struct wrapper::audio_policy *pol)
+{
+    return MOCK_POLICY(pol)->output ? 0 : -ENODEV;
+}
+
+static audio_io_handle_t ap_get_output(struct wrapper::audio_policy *pol,
+                                       audio_stream_type_t stream,
+                                       uint32_t sampling_rate,
+                                       uint32_t format,
+                                       uint32_t channels,
+                                       audio_output_flags_t flags)
+{
+    return MOCK_POLICY(pol)->output;
+}
+
+static int ap_start_output(struct wrapper::audio_policy *pol,
+                           audio_io_handle_t output,
+                           audio_stream_type_t stream,
+                           int session)
+{
+    struct mock_audio_policy *mp = MOCK_POLICY(pol);
+
+    if (stream < 0 || stream >= AUDIO_STREAM_CNT || output != mp->output)
+        return -EINVAL;
+    if (mp->active[stream]++ == 0) {
+        mock_update_routing(mp, 0);
+        mock_apply_volume(mp, stream, 0);
+    }
+    return 0;
+}
+
+static int ap_stop_output(struct wrapper::audio_policy *pol,
+                          audio_io_handle_t output,
+                          audio_stream_type_t stream,
+                          int session)
+{
+    struct mock_audio_policy *mp = MOCK_POLICY(pol);
+
+    if (stream < 0 || stream >= AUDIO_STREAM_CNT || output != mp->output ||
+        !mp->active[stream])
+        return -EINVAL;
+    if (--mp->active[stream] == 0)
+        mock_update_routing(mp, 0);
+    return 0;
+}
+
+static void ap_release_output(struct wrapper::audio_policy *pol,
+                              audio_io_handle_t output)
+{
+}
+
+static audio_io_handle_t ap_get_input(struct wrapper::audio_policy *pol, int input_source,
+                                      uint32_t sampling_rate,
+                                      uint32_t format,
+                                      uint32_t channels,
+                                      audio_in_acoustics_t acoustics)
+{
+    struct mock_audio_policy *mp = MOCK_POLICY(pol);
+    audio_devices_t device = (audio_devices_t) wrapper::AUDIO_DEVICE_IN_BUILTIN_MIC;
+    audio_format_t fmt = (audio_format_t) format;
+    audio_channel_mask_t channel_mask = channels;
+
+    if (mp->available_devices & wrapper::AUDIO_DEVICE_OUT_WIRED_HEADSET)
+        device = (audio_devices_t) wrapper::AUDIO_DEVICE_IN_WIRED_HEADSET;
+    return mp->aps_ops->open_input(mp->service, &device, &sampling_rate, &fmt,
+                                   &channel_mask, acoustics);
+}
+
+static int ap_start_input(struct wrapper::audio_policy *pol, audio_io_handle_t input)
+{
+    return 0;
+}
+
+static int ap_stop_input(struct wrapper::audio_policy *pol, audio_io_handle_t input)
+{
+    return 0;
+}
+
+static void ap_release_input(struct wrapper::audio_policy *pol, audio_io_handle_t input)
+{
+    struct mock_audio_policy *mp = MOCK_POLICY(pol);
+
+    mp->aps_ops->close_input(mp->service, input);
+}
+
+static void ap_init_stream_volume(struct wrapper::audio_policy *pol,
+                                  audio_stream_type_t stream,
+                                  int index_min,
+                                  int index_max)
+{
+    struct mock_audio_policy *mp = MOCK_POLICY(pol);
+
+    if (stream < 0 || stream >= AUDIO_STREAM_CNT)
+        return;
+    mp->index_min[stream] = index_min;
+    mp->index_max[stream] = index_max;
+}
+
+static int ap_set_stream_volume_index(struct wrapper::audio_policy *pol,
+                                      audio_stream_type_t stream,
+                                      int index)
+{
+    struct mock_audio_policy *mp = MOCK_POLICY(pol);
+
+    if (stream < 0 || stream >= AUDIO_STREAM_CNT ||
+        index < mp->index_min[stream] || index > mp->index_max[stream])
+        return -EINVAL;
+    mp->index[stream] = index;
+    mock_apply_volume(mp, stream, 0);
+    return 0;
+}
+
+static int ap_get_stream_volume_index(const struct wrapper::audio_policy *pol,
+                                      audio_stream_type_t stream,
+                                      int *index)
+{
+    if (stream < 0 || stream >= AUDIO_STREAM_CNT || !index)
+        return -EINVAL;
+    *index = MOCK_POLICY(pol)->index[stream];
+    return 0;
+}
+
+static uint32_t ap_get_strategy_for_stream(const struct wrapper::audio_policy *pol,
+                                           audio_stream_type_t stream)
+{
+    // Same grouping as AudioPolicyManagerBase::getStrategy()
+    switch (stream) {
+    case AUDIO_STREAM_VOICE_CALL:
+    case AUDIO_STREAM_BLUETOOTH_SCO:
+        return 1; // STRATEGY_PHONE
+    case AUDIO_STREAM_RING:
+    case AUDIO_STREAM_NOTIFICATION:
+    case AUDIO_STREAM_ALARM:
+        return 2; // STRATEGY_SONIFICATION
+    case AUDIO_STREAM_DTMF:
+        return 3; // STRATEGY_DTMF
+    default:
+        return 0; // STRATEGY_MEDIA
+    }
+}
+
+static uint32_t ap_get_devices_for_stream(const struct wrapper::audio_policy *pol,
+                                          audio_stream_type_t stream)
+{
+    return mock_get_device(MOCK_POLICY(pol), stream);
+}
+
+static audio_io_handle_t ap_get_output_for_effect(struct wrapper::audio_policy *pol,
+                                                  const struct effect_descriptor_s *desc)
+{
+    return MOCK_POLICY(pol)->output;
+}
+
+static int ap_register_effect(struct wrapper::audio_policy *pol,
+                              const struct effect_descriptor_s *desc,
+                              audio_io_handle_t output,
+                              uint32_t strategy,
+                              int session,
+                              int id)
+{
+    return 0;
+}
+
+static int ap_unregister_effect(struct wrapper::audio_policy *pol, int id)
+{
+    return 0;
+}
+
+static int ap_set_effect_enabled(struct wrapper::audio_policy *pol, int id, bool enabled)
+{
+    return 0;
+}
+
+static bool ap_is_stream_active(const struct wrapper::audio_policy *pol, int stream,
+                                uint32_t in_past_ms)
+{
+    if (stream < 0 || stream >= AUDIO_STREAM_CNT)
+        return false;
+    return MOCK_POLICY(pol)->active[stream] > 0;
+}
+
+static int ap_dump(const struct wrapper::audio_policy *pol, int fd)
+{
+    return 0;
+}
+
+/** audio_policy_device **/
+
+static int create_mock_ap(const struct wrapper::audio_policy_device *device,
+                          struct wrapper::audio_policy_service_ops *aps_ops,
+                          void *service,
+                          struct wrapper::audio_policy **ap)
+{
+    struct mock_audio_policy *mp;
+    audio_devices_t devices = (audio_devices_t) wrapper::AUDIO_DEVICE_OUT_SPEAKER;
+    uint32_t sample_rate = 44100, latency_ms = 0;
+    audio_format_t format = AUDIO_FORMAT_PCM_16_BIT;
+    audio_channel_mask_t channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+
+    *ap = NULL;
+
+    mp = (struct mock_audio_policy *) calloc(1, sizeof(*mp));
+    if (!mp)
+        return -ENOMEM;
+
+    mp->policy.set_device_connection_state = ap_set_device_connection_state;
+    mp->policy.get_device_connection_state = ap_get_device_connection_state;
+    mp->policy.set_phone_state = ap_set_phone_state;
+    mp->policy.set_ringer_mode = ap_set_ringer_mode;
+    mp->policy.set_force_use = ap_set_force_use;
+    mp->policy.get_force_use = ap_get_force_use;
+    mp->policy.set_can_mute_enforced_audible = ap_set_can_mute_enforced_audible;
+    mp->policy.init_check = ap_init_check;
+    mp->policy.get_output = ap_get_output;
+    mp->policy.start_output = ap_start_output;
+    mp->policy.stop_output = ap_stop_output;
+    mp->policy.release_output = ap_release_output;
+    mp->policy.get_input = ap_get_input;
+    mp->policy.start_input = ap_start_input;
+    mp->policy.stop_input = ap_stop_input;
+    mp->policy.release_input = ap_release_input;
+    mp->policy.init_stream_volume = ap_init_stream_volume;
+    mp->policy.set_stream_volume_index = ap_set_stream_volume_index;
+    mp->policy.get_stream_volume_index = ap_get_stream_volume_index;
+    mp->policy.get_strategy_for_stream = ap_get_strategy_for_stream;
+    mp->policy.get_devices_for_stream = ap_get_devices_for_stream;
+    mp->policy.get_output_for_effect = ap_get_output_for_effect;
+    mp->policy.register_effect = ap_register_effect;
+    mp->policy.unregister_effect = ap_unregister_effect;
+    mp->policy.set_effect_enabled = ap_set_effect_enabled;
+    mp->policy.is_stream_active = ap_is_stream_active;
+    mp->policy.dump = ap_dump;
+
+    mp->aps_ops = aps_ops;
+    mp->service = service;
+    mp->available_devices = wrapper::AUDIO_DEVICE_OUT_EARPIECE |
+                            wrapper::AUDIO_DEVICE_OUT_SPEAKER;
+    mp->output_device = wrapper::AUDIO_DEVICE_OUT_SPEAKER;
+    for (int i = 0; i < AUDIO_STREAM_CNT; i++) {
+        mp->index_max[i] = 15;
+        mp->index[i] = 7;
+    }
+
+    // The legacy policy managers open the hardware output in their constructor
+    mp->output = aps_ops->open_output(service, &devices, &sample_rate, &format,
+                                      &channel_mask, &latency_ms,
+                                      AUDIO_OUTPUT_FLAG_NONE);
+    if (!mp->output) {
+        free(mp);
+        return -ENODEV;
+    }
+
+    *ap = &mp->policy;
+    return 0;
+}
+
+static int destroy_mock_ap(const struct wrapper::audio_policy_device *device,
+                           struct wrapper::audio_policy *ap)
+{
+    struct mock_audio_policy *mp = MOCK_POLICY(ap);
+
+    mp->aps_ops->close_output(mp->service, mp->output);
+    free(mp);
+    return 0;
+}
+
+static int mock_ap_dev_close(hw_device_t *device)
+{
+    free(device);
+    return 0;
+}
+
+static int mock_ap_dev_open(const hw_module_t *module, const char *name,
+                            hw_device_t **device)
+{
+    struct wrapper::audio_policy_device *dev;
+
+    if (strcmp(name, AUDIO_POLICY_INTERFACE) != 0)
+        return -EINVAL;
+
+    dev = (struct wrapper::audio_policy_device *) calloc(1, sizeof(*dev));
+    if (!dev)
+        return -ENOMEM;
+
+    dev->common.tag = HARDWARE_DEVICE_TAG;
+    dev->common.version = 0;
+    dev->common.module = (struct hw_module_t *) module;
+    dev->common.close = mock_ap_dev_close;
+    dev->create_audio_policy = create_mock_ap;
+    dev->destroy_audio_policy = destroy_mock_ap;
+
+    *device = &dev->common;
+    return 0;
+}
+
+static struct hw_module_methods_t mock_ap_module_methods = {
+    /* open */ mock_ap_dev_open,
+};
+
+static struct audio_policy_module mock_ap_module = {
+    /* common */ {
+        /* tag */ HARDWARE_MODULE_TAG,
+        /* version_major */ { 1 },
+        /* version_minor */ { 0 },
+        /* id */ "vendor-audio_policy",
+        /* name */ "Fake ICS audio policy HAL",
+        /* author */ "The Android Open Source Project",
+        /* methods */ &mock_ap_module_methods,
+        /* dso */ NULL,
+        /* reserved */ {0},
+    },
+};
+
+int mock_audio_policy_register()
+{
+    return mock_register_module(&mock_ap_module.common);
+}
+
+/** audio_policy_service_ops of the fake AudioPolicyService **/
+
+static audio_io_handle_t next_io_handle = 1;
+
+static audio_io_handle_t aps_open_output(void *service,
+                                         audio_devices_t *pDevices,
+                                         uint32_t *pSamplingRate,
+                                         audio_format_t *pFormat,
+                                         audio_channel_mask_t *pChannelMask,
+                                         uint32_t *pLatencyMs,
+                                         audio_output_flags_t flags)
+{
+    mock_audio_policy_stats.open_output++;
+    *pLatencyMs = 92;
+    return next_io_handle++;
+}
+
+static audio_io_handle_t aps_open_duplicate_output(void *service,
+                                                   audio_io_handle_t output1,
+                                                   audio_io_handle_t output2)
+{
+    return next_io_handle++;
+}
+
+static int aps_close_output(void *service, audio_io_handle_t output)
+{
+    return 0;
+}
+
+static int aps_suspend_output(void *service, audio_io_handle_t output)
+{
+    return 0;
+}
+
+static int aps_restore_output(void *service, audio_io_handle_t output)
+{
+    return 0;
+}
+
+static audio_io_handle_t aps_open_input(void *service,
+                                        audio_devices_t *pDevices,
+                                        uint32_t *pSamplingRate,
+                                        audio_format_t *pFormat,
+                                        audio_channel_mask_t *pChannelMask,
+                                        audio_in_acoustics_t acoustics)
+{
+    mock_audio_policy_stats.open_input++;
+    return next_io_handle++;
+}
+
+static int aps_close_input(void *service, audio_io_handle_t input)
+{
+    return 0;
+}
+
+static int aps_set_stream_volume(void *service, audio_stream_type_t stream,
+                                 float volume, audio_io_handle_t output,
+                                 int delay_ms)
+{
+    mock_audio_policy_stats.set_stream_volume++;
+    return 0;
+}
+
+static int aps_set_stream_output(void *service, audio_stream_type_t stream,
+                                 audio_io_handle_t output)
+{
+    return 0;
+}
+
+static void aps_set_parameters(void *service, audio_io_handle_t io_handle,
+                               const char *kv_pairs, int delay_ms)
+{
+    mock_audio_policy_stats.set_parameters++;
+}
+
+static char *aps_get_parameters(void *service, audio_io_handle_t io_handle,
+                                const char *keys)
+{
+    return strdup("");
+}
+
+static int aps_start_tone(void *service, audio_policy_tone_t tone,
+                          audio_stream_type_t stream)
+{
+    return 0;
+}
+
+static int aps_stop_tone(void *service)
+{
+    return 0;
+}
+
+static int aps_set_voice_volume(void *service, float volume, int delay_ms)
+{
+    mock_audio_policy_stats.set_voice_volume++;
+    return 0;
+}
+
+static int aps_move_effects(void *service, int session,
+                            audio_io_handle_t src_output,
+                            audio_io_handle_t dst_output)
+{
+    return 0;
+}
+
+static audio_module_handle_t aps_load_hw_module(void *service, const char *name)
+{
+    return 1;
+}
+
+static audio_io_handle_t aps_open_output_on_module(void *service,
+                                                   audio_module_handle_t module,
+                                                   audio_devices_t *pDevices,
+                                                   uint32_t *pSamplingRate,
+                                                   audio_format_t *pFormat,
+                                                   audio_channel_mask_t *pChannelMask,
+                                                   uint32_t *pLatencyMs,
+                                                   audio_output_flags_t flags)
+{
+    return aps_open_output(service, pDevices, pSamplingRate, pFormat, pChannelMask,
+                           pLatencyMs, flags);
+}
+
+static audio_io_handle_t aps_open_input_on_module(void *service,
+                                                  audio_module_handle_t module,
+                                                  audio_devices_t *pDevices,
+                                                  uint32_t *pSamplingRate,
+                                                  audio_format_t *pFormat,
+                                                  audio_channel_mask_t *pChannelMask)
+{
+    return aps_open_input(service, pDevices, pSamplingRate, pFormat, pChannelMask,
+                          (audio_in_acoustics_t) 0);
+}
+
+static struct audio_policy_service_ops mock_aps_ops = {
+    /* open_output */ aps_open_output,
+    /* open_duplicate_output */ aps_open_duplicate_output,
+    /* close_output */ aps_close_output,
+    /* suspend_output */ aps_suspend_output,
+    /* restore_output */ aps_restore_output,
+    /* open_input */ aps_open_input,
+    /* close_input */ aps_close_input,
+    /* set_stream_volume */ aps_set_stream_volume,
+    /* set_stream_output */ aps_set_stream_output,
+    /* set_parameters */ aps_set_parameters,
+    /* get_parameters */ aps_get_parameters,
+    /* start_tone */ aps_start_tone,
+    /* stop_tone */ aps_stop_tone,
+    /* set_voice_volume */ aps_set_voice_volume,
+    /* move_effects */ aps_move_effects,
+    /* load_hw_module */ aps_load_hw_module,
+    /* open_output_on_module */ aps_open_output_on_module,
+    /* open_input_on_module */ aps_open_input_on_module,
+};
+
+struct audio_policy_service_ops *mock_audio_policy_service_ops()
+{
+    return &mock_aps_ops;
+}
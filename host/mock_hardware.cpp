@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stand-in for libhardware's hw_get_module() so the wrappers can be linked
+ * into host executables together with fake vendor modules. Also counts the
+ * heap allocations of the process for the benchmarks.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mock_hardware.h"
+
+#define MOCK_MAX_MODULES 4
+
+static const struct hw_module_t *mock_modules[MOCK_MAX_MODULES];
+
+int mock_register_module(const struct hw_module_t *module)
+{
+    for (int i = 0; i < MOCK_MAX_MODULES; i++) {
+        if (!mock_modules[i] || mock_modules[i] == module) {
+            mock_modules[i] = module;
+            return 0;
+        }
+    }
+    return -ENOMEM;
+}
+
+int hw_get_module(const char *id, const struct hw_module_t **module)
+{
+    for (int i = 0; i < MOCK_MAX_MODULES && mock_modules[i]; i++) {
+        if (strcmp(mock_modules[i]->id, id) == 0) {
+            *module = mock_modules[i];
+            return 0;
+        }
+    }
+    *module = NULL;
+    return -ENOENT;
+}
+
+int64_t mock_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void mock_sleep_us(unsigned int us)
+{
+    if (!us)
+        return;
+
+    struct timespec ts;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a;
+    int64_t y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+void mock_summarize_samples(int64_t *samples, int count, struct mock_sample_summary *summary)
+{
+    int64_t total = 0;
+
+    qsort(samples, count, sizeof(int64_t), compare_int64);
+    for (int i = 0; i < count; i++)
+        total += samples[i];
+
+    summary->count = count;
+    summary->mean = total / count;
+    summary->min = samples[0];
+    summary->p50 = samples[count / 2];
+    summary->p99 = samples[(int) ((int64_t) count * 99 / 100)];
+    summary->max = samples[count - 1];
+}
+
+unsigned long mock_heap_allocs;
+
+// glibc's allocator entry points, malloc() and friends are interposed below
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t nmemb, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+    __atomic_fetch_add(&mock_heap_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t nmemb, size_t size)
+{
+    __atomic_fetch_add(&mock_heap_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&mock_heap_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
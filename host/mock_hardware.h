@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_WRAPPER_MOCK_HARDWARE_H
+#define AUDIO_WRAPPER_MOCK_HARDWARE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware/hardware.h>
+
+/**
+ * Makes module available through the stand-in hw_get_module(). The module is
+ * looked up by module->id, e.g. "vendor-audio.primary".
+ */
+int mock_register_module(const struct hw_module_t *module);
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+int64_t mock_now_ns();
+
+/**
+ * Sleeps for the given number of microseconds. Does nothing for 0.
+ */
+void mock_sleep_us(unsigned int us);
+
+/**
+ * Timings of a benchmark, in the unit of its samples.
+ */
+struct mock_sample_summary {
+    int count;
+    int64_t mean;
+    int64_t min;
+    int64_t p50;
+    int64_t p99;
+    int64_t max;
+};
+
+/**
+ * Sorts the count samples in place and summarizes them. count must not be 0.
+ */
+void mock_summarize_samples(int64_t *samples, int count, struct mock_sample_summary *summary);
+
+/**
+ * Number of malloc(), calloc() and realloc() calls of the process so far,
+ * including the ones of strdup() and operator new.
+ */
+extern unsigned long mock_heap_allocs;
+
+/**
+ * Configuration and counters of the fake ICS vendor-audio.primary HAL.
+ */
+struct mock_audio_hw_config {
+    /* Rate the fake blob accepts. Other rates are rejected with -EINVAL
+     * and the supported rate is written back like the legacy HALs do. */
+    uint32_t out_sample_rate;
+    uint32_t in_sample_rate;
+    size_t out_buffer_size;
+    size_t in_buffer_size;
+    uint32_t out_latency_ms;
+    /* Time write / read block inside the fake blob. */
+    unsigned int write_delay_us;
+    unsigned int read_delay_us;
+    /* Every stall_every-th write blocks for stall_us more, like a blob that
+     * waits for the DSP or a slow codec. The following writes return that
+     * much sooner. 0 disables the stalls. */
+    unsigned int stall_every;
+    unsigned int stall_us;
+    /* Inputs that can be open at the same time, like the blobs that only
+     * have one. 0 means no limit. */
+    unsigned int max_inputs;
+    /* Plays the output at its sample rate: write blocks until the frames fit
+     * into a buffer of out_latency_ms, like a blob writing to ALSA. The
+     * first non-zero sample of a write is a marker, the time it plays is
+     * recorded in the stats. */
+    bool realtime;
+};
+
+struct mock_audio_hw_stats {
+    unsigned long writes;
+    unsigned long reads;
+    unsigned long set_parameters;
+    unsigned long get_parameters;
+    unsigned long standby;
+    size_t bytes_written;
+    size_t bytes_read;
+    unsigned int open_inputs;
+    /* Realtime output only. The buffer ran empty while playing. */
+    unsigned long underruns;
+    /* Value of the last marker and when it plays. marker is stored last
+     * (release), so another thread can read both after seeing it change. */
+    int64_t marker_play_ns;
+    int32_t marker;
+};
+
+extern struct mock_audio_hw_config mock_audio_hw_config;
+extern struct mock_audio_hw_stats mock_audio_hw_stats;
+
+/**
+ * Registers the fake vendor-audio.primary module.
+ */
+int mock_audio_hw_register();
+
+/**
+ * Counters of the fake ICS vendor-audio_policy HAL and of the fake
+ * AudioPolicyService it calls back into.
+ */
+struct mock_audio_policy_stats {
+    unsigned long routing_changes;
+    unsigned long volume_changes;
+    unsigned long open_output;
+    unsigned long open_input;
+    unsigned long set_parameters;
+    unsigned long set_stream_volume;
+    unsigned long set_voice_volume;
+};
+
+extern struct mock_audio_policy_stats mock_audio_policy_stats;
+
+/**
+ * Registers the fake vendor-audio_policy module.
+ */
+int mock_audio_policy_register();
+
+struct audio_policy_service_ops;
+
+/**
+ * Returns the service ops of the fake AudioPolicyService, i.e. what the
+ * framework passes to create_audio_policy().
+ */
+struct audio_policy_service_ops *mock_audio_policy_service_ops();
+
+#endif // AUDIO_WRAPPER_MOCK_HARDWARE_H
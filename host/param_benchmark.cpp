@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the parameter string conversion of set_parameters() and
+ * get_parameters() for typical strings. The table driven
+ * fixup_audio_parameters_scratch() is compared with the routing-only scan it
+ * replaced and with the AudioParameter round trip the wrapper started with.
+ * The scan's output is checked against the table's for every string.
+ *
+ * Usage: audio_wrapper_param_benchmark [-s seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "mock_hardware.h"
+#include "scratch.h"
+
+// Output buffer of the reference converters
+#define BUFFER_SIZE 256
+
+static const char * const corpus[] = {
+    "routing=2",
+    "routing=-2147483644",
+    "screen_state=on",
+    "routing=8;format=1;channels=3;sampling_rate=44100",
+    "input_source=1;routing=-2147483644",
+    "bt_headset_name=Headset;bt_headset_nrec=on;routing=32",
+    "A2dpSuspended=false;bt_samplerate=44100;tty_mode=tty_off;screen_state=off",
+};
+
+#define CORPUS_CNT (sizeof(corpus) / sizeof(corpus[0]))
+
+// Only checked, not timed
+static const char * const edge_cases[] = {
+    "",
+    "routing",
+    "routing=",
+    "routing=;routing=2",
+    "routing=12abc;x=1",
+    ";;routing=4;",
+    "routingx=2;xrouting=2",
+    "routing=2=3",
+};
+
+/*
+ * The routing-only scan before the translation table, kept as the reference.
+ */
+static ssize_t scan_routing(const char *kv_pairs, flags_conversion_mode_t mode, char *buf,
+                            size_t size)
+{
+    static const size_t key_len = strlen(android::AudioParameter::keyRouting);
+    const char *pair = kv_pairs;
+    bool converted = false;
+    size_t len = 0;
+
+    while (*pair) {
+        const char *end = strchr(pair, ';');
+        const char *value = NULL;
+        size_t copy_len;
+        char fixed_value[16];
+        char *value_end;
+
+        if (!end)
+            end = pair + strlen(pair);
+        copy_len = end - pair;
+        if (copy_len > key_len && pair[key_len] == '=' &&
+                strncmp(pair, android::AudioParameter::keyRouting, key_len) == 0) {
+            value = pair + key_len + 1;
+            long long devices = strtoll(value, &value_end, 10);
+            if (value_end != value && value_end <= end) {
+                snprintf(fixed_value, sizeof(fixed_value), "%d",
+                         (int) convert_audio_devices((uint32_t) devices, mode));
+                copy_len = key_len + 1;
+                if (strlen(fixed_value) != (size_t) (end - value) ||
+                        strncmp(fixed_value, value, end - value) != 0)
+                    converted = true;
+            } else {
+                value = NULL;
+            }
+        }
+
+        if (len < size)
+            memcpy(buf + len, pair, copy_len < size - len ? copy_len : size - len);
+        len += copy_len;
+        if (value) {
+            size_t value_len = strlen(fixed_value);
+            if (len < size)
+                memcpy(buf + len, fixed_value, value_len < size - len ? value_len : size - len);
+            len += value_len;
+        }
+        if (*end == ';') {
+            if (len < size)
+                buf[len] = ';';
+            len++;
+            end++;
+        }
+        pair = end;
+    }
+
+    if (!converted)
+        return -1;
+    if (size)
+        buf[len < size ? len : size - 1] = '\0';
+    return len;
+}
+
+static const char *convert_scan(const char *kv_pairs, flags_conversion_mode_t mode, char *buf,
+                                size_t size)
+{
+    ssize_t len = scan_routing(kv_pairs, mode, buf, size);
+
+    return len < 0 ? kv_pairs : (size_t) len < size ? buf : NULL;
+}
+
+/*
+ * The converter in use. The result is in scratch memory, the caller holds the
+ * ScratchScope.
+ */
+static const char *convert_table(const char *kv_pairs, flags_conversion_mode_t mode, char *buf,
+                                 size_t size)
+{
+    return fixup_audio_parameters_scratch(kv_pairs, mode);
+}
+
+/*
+ * The original conversion: parse, replace and serialize with AudioParameter.
+ */
+static const char *convert_audio_parameter(const char *kv_pairs, flags_conversion_mode_t mode,
+                                           char *buf, size_t size)
+{
+    android::AudioParameter param = android::AudioParameter(android::String8(kv_pairs));
+    android::String8 key = android::String8(android::AudioParameter::keyRouting);
+    int value;
+
+    if (param.getInt(key, value) != android::NO_ERROR)
+        return kv_pairs;
+    param.addInt(key, (int) lookup_audio_devices((uint32_t) value, mode));
+    snprintf(buf, size, "%s", param.toString().string());
+    return buf;
+}
+
+// Keeps the compiler from dropping the conversions
+static volatile size_t sink;
+
+struct converter {
+    const char *name;
+    const char *(*convert)(const char *kv_pairs, flags_conversion_mode_t mode, char *buf,
+                           size_t size);
+};
+
+static const struct converter converters[] = {
+    { "AudioParameter", convert_audio_parameter },
+    { "routing scan", convert_scan },
+    { "table", convert_table },
+};
+
+static void check_output(const char *kv_pairs)
+{
+    char scan_buf[BUFFER_SIZE], table_buf[BUFFER_SIZE];
+
+    for (int mode = ICS_TO_JB; mode <= JB_TO_ICS; mode++) {
+        SCRATCH_SCOPE();
+        const char *scan = convert_scan(kv_pairs, (flags_conversion_mode_t) mode,
+                                        scan_buf, sizeof(scan_buf));
+        const char *table = convert_table(kv_pairs, (flags_conversion_mode_t) mode,
+                                          table_buf, sizeof(table_buf));
+        if (!scan || !table || strcmp(scan, table)) {
+            fprintf(stderr, "mismatch for \"%s\" (mode %d): \"%s\" != \"%s\"\n", kv_pairs,
+                    mode, scan ? scan : "(null)", table ? table : "(null)");
+            exit(1);
+        }
+    }
+}
+
+static void run_bench(const struct converter *converter, int seconds)
+{
+    char buf[BUFFER_SIZE];
+    unsigned long calls = 0;
+    size_t bytes = 0;
+    int64_t start, elapsed;
+
+    start = mock_now_ns();
+    do {
+        for (int n = 0; n < 1000; n++) {
+            SCRATCH_SCOPE();
+            const char *kv_pairs = corpus[calls % CORPUS_CNT];
+            const char *out = converter->convert(kv_pairs, (flags_conversion_mode_t) (calls & 1),
+                                                 buf, sizeof(buf));
+            sink += out ? out[0] : 0;
+            bytes += strlen(kv_pairs);
+            calls++;
+        }
+        elapsed = mock_now_ns() - start;
+    } while (elapsed < seconds * 1000000000LL);
+
+    printf("%-15s %10lu %10.1f %10.1f\n", converter->name, calls, (double) elapsed / calls,
+           bytes / (elapsed / 1e9) / 1e6);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s seconds]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = 2;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:h")) != -1) {
+        switch (opt) {
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < CORPUS_CNT; i++)
+        check_output(corpus[i]);
+    for (size_t i = 0; i < sizeof(edge_cases) / sizeof(edge_cases[0]); i++)
+        check_output(edge_cases[i]);
+    printf("%-15s %10s %10s %10s\n", "conversion", "calls", "ns/call", "MB/s");
+    for (size_t i = 0; i < sizeof(converters) / sizeof(converters[0]); i++)
+        run_bench(&converters[i], seconds);
+
+    return 0;
+}
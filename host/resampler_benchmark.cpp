@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the cost of the output resampler for every preset and the common
+ * rate pairs. A multiply-add per tap counts as two floating point operations.
+ * MFLOPS/ch is the rate the resampler achieved per channel, rt MFLOPS/ch what
+ * one channel needs in real time and load/ch the share of one CPU that takes.
+ *
+ * Usage: audio_wrapper_resampler_benchmark [-s seconds] [-c channels]
+ *                                          [-b frames_per_call]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "resampler.h"
+#include "mock_hardware.h"
+
+static const uint32_t rate_pairs[][2] = {
+    { 48000, 44100 },
+    { 44100, 48000 },
+    { 32000, 44100 },
+    { 22050, 44100 },
+    { 16000, 44100 },
+    { 8000, 44100 },
+};
+
+static void run_bench(uint32_t in_rate, uint32_t out_rate, enum resampler_quality quality,
+                      unsigned channels, int seconds, size_t chunk)
+{
+    struct resampler *rs = resampler_create(in_rate, out_rate, channels, quality);
+    size_t in_frames = (size_t) in_rate * seconds, out_frames = 0;
+    int16_t *in, *out;
+    int64_t start, elapsed;
+    double flops, mflops, rt_mflops;
+
+    if (!rs) {
+        printf("%5u -> %5u %-7s unsupported\n", in_rate, out_rate,
+               resampler_quality_to_string(quality));
+        return;
+    }
+
+    in = (int16_t *) malloc(in_frames * channels * sizeof(int16_t));
+    out = (int16_t *) malloc(resampler_max_output(rs, chunk) * channels * sizeof(int16_t));
+    if (!in || !out) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < in_frames; i++) {
+        for (unsigned c = 0; c < channels; c++)
+            in[i * channels + c] = (int16_t) (16384 * sin(2 * M_PI * 1000 * i / in_rate));
+    }
+
+    start = mock_now_ns();
+    for (size_t done = 0; done < in_frames; done += chunk) {
+        size_t frames = in_frames - done < chunk ? in_frames - done : chunk;
+        out_frames += resampler_process(rs, in + done * channels, frames, out);
+    }
+    elapsed = mock_now_ns() - start;
+
+    // Per channel, the channels share elapsed
+    flops = 2.0 * resampler_taps(rs) * out_frames;
+    mflops = flops / (elapsed / 1e3 / channels);
+    rt_mflops = 2.0 * resampler_taps(rs) * out_rate / 1e6;
+    printf("%5u -> %5u %-7s %5u %10.2f %10.1f %12.1f %8.2f%%\n", in_rate, out_rate,
+           resampler_quality_to_string(quality), resampler_taps(rs),
+           (double) elapsed / out_frames / channels, mflops, rt_mflops,
+           100.0 * elapsed / 1e9 / seconds / channels);
+
+    free(in);
+    free(out);
+    resampler_free(rs);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s seconds] [-c channels] [-b frames_per_call]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = 10;
+    unsigned channels = 2;
+    size_t chunk = 1024;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:c:b:h")) != -1) {
+        switch (opt) {
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case 'c':
+            channels = atoi(optarg);
+            break;
+        case 'b':
+            chunk = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (seconds <= 0 || !channels || !chunk) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%-14s %-7s %5s %10s %10s %12s %9s\n", "rates (Hz)", "preset", "taps",
+           "ns/frm/ch", "MFLOPS/ch", "rt MFLOPS/ch", "load/ch");
+    for (size_t i = 0; i < sizeof(rate_pairs) / sizeof(rate_pairs[0]); i++) {
+        for (int q = RESAMPLER_QUALITY_LOW; q <= RESAMPLER_QUALITY_HIGH; q++)
+            run_bench(rate_pairs[i][0], rate_pairs[i][1], (enum resampler_quality) q,
+                      channels, seconds, chunk);
+    }
+
+    return 0;
+}
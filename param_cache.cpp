@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "param_cache.h"
+#include "stats.h"
+
+/**
+ * Keys whose answers only change when the stream is reconfigured, which
+ * clears the cache. Other keys are always passed to the blob, it may change
+ * their answers on its own, e.g. when a headset is plugged.
+ */
+static const char * const static_keys[] = {
+    "sup_formats",
+    "sup_channels",
+    "sup_sampling_rates",
+};
+
+/**
+ * Returns true if every key of the query keys is a static key.
+ */
+static bool static_query(const char *keys)
+{
+    const char *key = keys;
+
+    if (!*key)
+        return false;
+
+    while (*key) {
+        size_t len = strcspn(key, "=;");
+        bool known = false;
+
+        for (size_t i = 0; i < sizeof(static_keys) / sizeof(static_keys[0]); i++) {
+            if (strlen(static_keys[i]) == len && !strncmp(static_keys[i], key, len)) {
+                known = true;
+                break;
+            }
+        }
+        if (!known)
+            return false;
+        key += strcspn(key, ";");
+        if (*key)
+            key++;
+    }
+    return true;
+}
+
+static void entry_free(struct param_cache_entry *entry)
+{
+    free(entry->keys);
+    free(entry->value);
+    entry->keys = NULL;
+    entry->value = NULL;
+}
+
+void param_cache_init(struct param_cache *cache, bool enabled)
+{
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->enabled = enabled;
+}
+
+void param_cache_free(struct param_cache *cache)
+{
+    for (int i = 0; i < PARAM_CACHE_SIZE; i++)
+        entry_free(&cache->entries[i]);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+char * param_cache_get(struct param_cache *cache, const char *keys, uint32_t *generation)
+{
+    char *value = NULL;
+
+    if (!cache->enabled || !keys || !static_query(keys))
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    *generation = cache->generation;
+    for (int i = 0; i < PARAM_CACHE_SIZE; i++) {
+        if (cache->entries[i].keys && !strcmp(cache->entries[i].keys, keys)) {
+            value = strdup(cache->entries[i].value);
+            break;
+        }
+    }
+    // A failed strdup() counts as a miss and asks the blob
+    if (value)
+        cache->hits++;
+    else
+        cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return value;
+}
+
+void param_cache_put(struct param_cache *cache, const char *keys, const char *value,
+                     uint32_t generation)
+{
+    struct param_cache_entry *entry;
+
+    if (!cache->enabled || !keys || !value || !static_query(keys))
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    if (generation == cache->generation) {
+        entry = &cache->entries[cache->next];
+        cache->next = (cache->next + 1) % PARAM_CACHE_SIZE;
+        entry_free(entry);
+        entry->keys = strdup(keys);
+        entry->value = strdup(value);
+        if (!entry->keys || !entry->value)
+            entry_free(entry);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void param_cache_invalidate(struct param_cache *cache, const char *kv_pairs)
+{
+    const char *pair = kv_pairs;
+
+    if (!cache->enabled || !kv_pairs)
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    cache->generation++;
+    while (*pair) {
+        const char *end = pair + strcspn(pair, ";");
+        size_t key_len = strcspn(pair, "=;");
+        char key[64];
+
+        if (key_len >= sizeof(key)) {
+            // Can't be compared, play safe
+            for (int i = 0; i < PARAM_CACHE_SIZE; i++)
+                entry_free(&cache->entries[i]);
+            break;
+        }
+        memcpy(key, pair, key_len);
+        key[key_len] = '\0';
+        for (int i = 0; key_len && i < PARAM_CACHE_SIZE; i++) {
+            if (cache->entries[i].keys && has_audio_parameter(cache->entries[i].keys, key))
+                entry_free(&cache->entries[i]);
+        }
+        pair = *end ? end + 1 : end;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void param_cache_clear(struct param_cache *cache)
+{
+    if (!cache->enabled)
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    cache->generation++;
+    for (int i = 0; i < PARAM_CACHE_SIZE; i++)
+        entry_free(&cache->entries[i]);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void param_cache_dump(struct param_cache *cache, int fd)
+{
+    int cached = 0;
+
+    if (!cache->enabled)
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+    for (int i = 0; i < PARAM_CACHE_SIZE; i++)
+        cached += cache->entries[i].keys != NULL;
+    dump_printf(fd, "    get_parameters cache: %d entries, %u hits, %u misses\n", cached,
+                cache->hits, cache->misses);
+    pthread_mutex_unlock(&cache->lock);
+}
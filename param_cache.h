@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_WRAPPER_PARAM_CACHE_H
+#define AUDIO_WRAPPER_PARAM_CACHE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+/**
+ * Answers kept per device or blob stream. Replaced round robin when full.
+ */
+#define PARAM_CACHE_SIZE 8
+
+struct param_cache_entry {
+    // Query as passed to get_parameters(), NULL if the entry is unused
+    char *keys;
+    // Converted answer of the blob
+    char *value;
+};
+
+/**
+ * Answers of get_parameters() keyed by the query string. Only queries for
+ * keys that don't change while a stream is configured (sup_formats,
+ * sup_channels, sup_sampling_rates) are kept. An entry is dropped
+ * when a set_parameters() sets one of the keys it asked for. generation
+ * changes with every invalidation, so an answer the blob gave while a
+ * set_parameters() ran is not stored.
+ */
+struct param_cache {
+    pthread_mutex_t lock;
+    bool enabled;
+    struct param_cache_entry entries[PARAM_CACHE_SIZE];
+    unsigned int next;
+    uint32_t generation;
+    uint32_t hits;
+    uint32_t misses;
+};
+
+void param_cache_init(struct param_cache *cache, bool enabled);
+
+void param_cache_free(struct param_cache *cache);
+
+/**
+ * Returns a malloc'ed copy of the answer to keys or NULL if it is not cached
+ * or not cacheable. generation is set for a following param_cache_put().
+ */
+char *param_cache_get(struct param_cache *cache, const char *keys, uint32_t *generation);
+
+/**
+ * Stores the answer to keys unless the cache was invalidated since the
+ * param_cache_get() that returned generation.
+ */
+void param_cache_put(struct param_cache *cache, const char *keys, const char *value,
+                     uint32_t generation);
+
+/**
+ * Drops the answers to queries for any key of kv_pairs.
+ */
+void param_cache_invalidate(struct param_cache *cache, const char *kv_pairs);
+
+/**
+ * Drops all answers.
+ */
+void param_cache_clear(struct param_cache *cache);
+
+void param_cache_dump(struct param_cache *cache, int fd);
+
+#endif // AUDIO_WRAPPER_PARAM_CACHE_H
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pcm.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_SIMD
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PCM_SIMD
+#endif
+
+static inline int16_t clamp16(int32_t sample)
+{
+    if (sample > 32767)
+        return 32767;
+    if (sample < -32768)
+        return -32768;
+    return sample;
+}
+
+static void apply_gain_16_c(int16_t *dst, const int16_t *src, size_t frames,
+                            unsigned channels, float gain_start, float step)
+{
+    for (size_t i = 0; i < frames; i++) {
+        float gain = gain_start + step * i;
+        for (unsigned c = 0; c < channels; c++)
+            *dst++ = clamp16((int32_t) (*src++ * gain));
+    }
+}
+
+void pcm_apply_gain_16(int16_t *dst, const int16_t *src, size_t frames,
+                       unsigned channels, float gain_start, float gain_end)
+{
+    float step = frames ? (gain_end - gain_start) / frames : 0;
+    size_t done = 0;
+
+#ifdef PCM_SIMD
+    // 8 samples per iteration. The gain of each lane follows its frame, so
+    // this only works if a vector holds whole frames.
+    if (channels && 4 % channels == 0) {
+        size_t vectors = frames * channels / 8;
+        float vector_step = step * (8 / channels);
+        float lanes[8];
+
+        for (int i = 0; i < 8; i++)
+            lanes[i] = gain_start + step * (i / channels);
+
+#if defined(__ARM_NEON__)
+        float32x4_t g0 = vld1q_f32(lanes);
+        float32x4_t g1 = vld1q_f32(lanes + 4);
+        float32x4_t s = vdupq_n_f32(vector_step);
+
+        for (size_t i = 0; i < vectors; i++) {
+            int16x8_t in = vld1q_s16(src + i * 8);
+            float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(in)));
+            float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(in)));
+            int16x4_t out_lo = vqmovn_s32(vcvtq_s32_f32(vmulq_f32(lo, g0)));
+            int16x4_t out_hi = vqmovn_s32(vcvtq_s32_f32(vmulq_f32(hi, g1)));
+            vst1q_s16(dst + i * 8, vcombine_s16(out_lo, out_hi));
+            g0 = vaddq_f32(g0, s);
+            g1 = vaddq_f32(g1, s);
+        }
+#else
+        __m128 g0 = _mm_loadu_ps(lanes);
+        __m128 g1 = _mm_loadu_ps(lanes + 4);
+        __m128 s = _mm_set1_ps(vector_step);
+
+        for (size_t i = 0; i < vectors; i++) {
+            __m128i in = _mm_loadu_si128((const __m128i *) (src + i * 8));
+            // Sign extend to 32 bit
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16);
+            __m128i out_lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), g0));
+            __m128i out_hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), g1));
+            _mm_storeu_si128((__m128i *) (dst + i * 8), _mm_packs_epi32(out_lo, out_hi));
+            g0 = _mm_add_ps(g0, s);
+            g1 = _mm_add_ps(g1, s);
+        }
+#endif
+        done = vectors * 8 / channels;
+    }
+#endif
+
+    apply_gain_16_c(dst + done * channels, src + done * channels, frames - done,
+                    channels, gain_start + step * done, step);
+}
+
+void pcm_dither_init(struct pcm_dither *dither, uint32_t seed)
+{
+    // xorshift must not start at 0
+    for (int i = 0; i < 4; i++) {
+        seed = seed * 1664525 + 1013904223;
+        dither->state[i] = seed ? seed : 1;
+    }
+}
+
+static inline uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ * Converts samples with shift fractional bits below the 16 bit LSB. The
+ * sample is halved first so adding the rounding offset and the noise can't
+ * overflow, the noise is the sum of two uniform values of shift - 1 bits
+ * taken from one random number.
+ */
+static void convert_to_16_c(int16_t *dst, const int32_t *src, size_t samples,
+                            unsigned shift, struct pcm_dither *dither)
+{
+    const int32_t round = 1 << (shift - 2);
+    const int32_t offset = 1 << (shift - 1);
+    const uint32_t mask = (1U << (shift - 1)) - 1;
+
+    for (size_t i = 0; i < samples; i++) {
+        int32_t sample = (src[i] >> 1) + round;
+        if (dither) {
+            uint32_t r = xorshift32(&dither->state[0]);
+            sample += (int32_t) ((r >> (33 - shift)) + (r & mask)) - offset;
+        }
+        dst[i] = clamp16(sample >> (shift - 1));
+    }
+}
+
+static void convert_to_16(int16_t *dst, const int32_t *src, size_t samples,
+                          unsigned shift, struct pcm_dither *dither)
+{
+    size_t done = 0;
+
+#if defined(__ARM_NEON__)
+    size_t vectors = samples / 8;
+    int32x4_t round = vdupq_n_s32(1 << (shift - 2));
+    int32x4_t offset = vdupq_n_s32(1 << (shift - 1));
+    uint32x4_t mask = vdupq_n_u32((1U << (shift - 1)) - 1);
+    int32x4_t noise_shift = vdupq_n_s32(-(int32_t) (33 - shift));
+    int32x4_t out_shift = vdupq_n_s32(-(int32_t) (shift - 1));
+    uint32x4_t state = dither ? vld1q_u32(dither->state) : vdupq_n_u32(0);
+
+    for (size_t i = 0; i < vectors; i++) {
+        int32x4_t lo = vaddq_s32(vshrq_n_s32(vld1q_s32(src + i * 8), 1), round);
+        int32x4_t hi = vaddq_s32(vshrq_n_s32(vld1q_s32(src + i * 8 + 4), 1), round);
+        if (dither) {
+            for (int half = 0; half < 2; half++) {
+                state = veorq_u32(state, vshlq_n_u32(state, 13));
+                state = veorq_u32(state, vshrq_n_u32(state, 17));
+                state = veorq_u32(state, vshlq_n_u32(state, 5));
+                int32x4_t noise = vsubq_s32(vreinterpretq_s32_u32(
+                        vaddq_u32(vshlq_u32(state, noise_shift), vandq_u32(state, mask))),
+                        offset);
+                if (half)
+                    hi = vaddq_s32(hi, noise);
+                else
+                    lo = vaddq_s32(lo, noise);
+            }
+        }
+        vst1q_s16(dst + i * 8, vcombine_s16(vqmovn_s32(vshlq_s32(lo, out_shift)),
+                                            vqmovn_s32(vshlq_s32(hi, out_shift))));
+    }
+    if (dither)
+        vst1q_u32(dither->state, state);
+    done = vectors * 8;
+#elif defined(__SSE2__)
+    size_t vectors = samples / 8;
+    __m128i round = _mm_set1_epi32(1 << (shift - 2));
+    __m128i offset = _mm_set1_epi32(1 << (shift - 1));
+    __m128i mask = _mm_set1_epi32((1U << (shift - 1)) - 1);
+    __m128i noise_shift = _mm_cvtsi32_si128(33 - shift);
+    __m128i out_shift = _mm_cvtsi32_si128(shift - 1);
+    __m128i state = dither ? _mm_loadu_si128((const __m128i *) dither->state)
+                           : _mm_setzero_si128();
+
+    for (size_t i = 0; i < vectors; i++) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + i * 8));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + i * 8 + 4));
+        lo = _mm_add_epi32(_mm_srai_epi32(lo, 1), round);
+        hi = _mm_add_epi32(_mm_srai_epi32(hi, 1), round);
+        if (dither) {
+            for (int half = 0; half < 2; half++) {
+                state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+                state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+                state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+                __m128i noise = _mm_sub_epi32(_mm_add_epi32(_mm_srl_epi32(state, noise_shift),
+                                                            _mm_and_si128(state, mask)),
+                                              offset);
+                if (half)
+                    hi = _mm_add_epi32(hi, noise);
+                else
+                    lo = _mm_add_epi32(lo, noise);
+            }
+        }
+        _mm_storeu_si128((__m128i *) (dst + i * 8),
+                         _mm_packs_epi32(_mm_sra_epi32(lo, out_shift),
+                                         _mm_sra_epi32(hi, out_shift)));
+    }
+    if (dither)
+        _mm_storeu_si128((__m128i *) dither->state, state);
+    done = vectors * 8;
+#endif
+
+    convert_to_16_c(dst + done, src + done, samples - done, shift, dither);
+}
+
+void pcm_convert_32_to_16(int16_t *dst, const int32_t *src, size_t samples,
+                          struct pcm_dither *dither)
+{
+    convert_to_16(dst, src, samples, 16, dither);
+}
+
+void pcm_convert_8_24_to_16(int16_t *dst, const int32_t *src, size_t samples,
+                            struct pcm_dither *dither)
+{
+    convert_to_16(dst, src, samples, 9, dither);
+}
+
+void pcm_mono_to_stereo_16(int16_t *dst, const int16_t *src, size_t frames)
+{
+    size_t done = 0;
+
+#if defined(__ARM_NEON__)
+    size_t vectors = frames / 8;
+
+    for (size_t i = 0; i < vectors; i++) {
+        int16x8x2_t out;
+        out.val[0] = out.val[1] = vld1q_s16(src + i * 8);
+        vst2q_s16(dst + i * 16, out);
+    }
+    done = vectors * 8;
+#elif defined(__SSE2__)
+    size_t vectors = frames / 8;
+
+    for (size_t i = 0; i < vectors; i++) {
+        __m128i in = _mm_loadu_si128((const __m128i *) (src + i * 8));
+        _mm_storeu_si128((__m128i *) (dst + i * 16), _mm_unpacklo_epi16(in, in));
+        _mm_storeu_si128((__m128i *) (dst + i * 16 + 8), _mm_unpackhi_epi16(in, in));
+    }
+    done = vectors * 8;
+#endif
+
+    for (size_t i = done; i < frames; i++)
+        dst[i * 2] = dst[i * 2 + 1] = src[i];
+}
+
+void pcm_stereo_to_mono_16(int16_t *dst, const int16_t *src, size_t frames)
+{
+    size_t done = 0;
+
+#if defined(__ARM_NEON__)
+    size_t vectors = frames / 8;
+
+    for (size_t i = 0; i < vectors; i++) {
+        int16x8x2_t in = vld2q_s16(src + i * 16);
+        vst1q_s16(dst + i * 8, vhaddq_s16(in.val[0], in.val[1]));
+    }
+    done = vectors * 8;
+#elif defined(__SSE2__)
+    size_t vectors = frames / 8;
+    __m128i ones = _mm_set1_epi16(1);
+
+    for (size_t i = 0; i < vectors; i++) {
+        // left + right of each frame as 32 bit
+        __m128i lo = _mm_madd_epi16(_mm_loadu_si128((const __m128i *) (src + i * 16)), ones);
+        __m128i hi = _mm_madd_epi16(_mm_loadu_si128((const __m128i *) (src + i * 16 + 8)), ones);
+        _mm_storeu_si128((__m128i *) (dst + i * 8),
+                         _mm_packs_epi32(_mm_srai_epi32(lo, 1), _mm_srai_epi32(hi, 1)));
+    }
+    done = vectors * 8;
+#endif
+
+    for (size_t i = done; i < frames; i++)
+        dst[i] = (src[i * 2] + src[i * 2 + 1]) >> 1;
+}
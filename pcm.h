@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_WRAPPER_PCM_H
+#define AUDIO_WRAPPER_PCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * PCM processing kernels for the audio paths. Each kernel has a NEON (ARM),
+ * SSE2 (x86 host builds) and a plain C version, the C version also handles
+ * the tails.
+ */
+
+/**
+ * Multiplies interleaved 16 bit samples by a gain that moves linearly from
+ * gain_start at the first frame to gain_end after the last frame. All samples
+ * of a frame get the same gain. src and dst may be the same buffer.
+ */
+void pcm_apply_gain_16(int16_t *dst, const int16_t *src, size_t frames,
+                       unsigned channels, float gain_start, float gain_end);
+
+/**
+ * State of the TPDF dither, one xorshift generator per vector lane.
+ */
+struct pcm_dither {
+    uint32_t state[4];
+};
+
+void pcm_dither_init(struct pcm_dither *dither, uint32_t seed);
+
+/**
+ * Converts signed 32 bit samples (AUDIO_FORMAT_PCM_32_BIT, 1.31) to 16 bit
+ * with rounding and saturation. If dither is not NULL triangular noise of
+ * +-1 LSB of the output is added before rounding.
+ */
+void pcm_convert_32_to_16(int16_t *dst, const int32_t *src, size_t samples,
+                          struct pcm_dither *dither);
+
+/**
+ * Same as pcm_convert_32_to_16() for 8.24 fixed point samples
+ * (AUDIO_FORMAT_PCM_8_24_BIT). Values beyond +-1.0 saturate.
+ */
+void pcm_convert_8_24_to_16(int16_t *dst, const int32_t *src, size_t samples,
+                            struct pcm_dither *dither);
+
+/**
+ * Duplicates 16 bit mono samples into stereo frames. dst holds 2 * frames
+ * samples.
+ */
+void pcm_mono_to_stereo_16(int16_t *dst, const int16_t *src, size_t frames);
+
+/**
+ * Mixes 16 bit stereo frames down to mono, (left + right) >> 1.
+ */
+void pcm_stereo_to_mono_16(int16_t *dst, const int16_t *src, size_t frames);
+
+#endif // AUDIO_WRAPPER_PCM_H
@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resampler.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define RESAMPLER_MAX_PHASES 1024
+#define RESAMPLER_MAX_CHANNELS 8
+// Input frames deinterleaved at a time
+#define RESAMPLER_CHUNK 256
+
+struct resampler_preset {
+    const char *name;
+    unsigned taps;
+    float cutoff;
+    float beta;
+};
+
+static const struct resampler_preset presets[] = {
+    { "low", 16, 0.80f, 6.0f },
+    { "medium", 32, 0.88f, 8.0f },
+    { "high", 64, 0.94f, 10.0f },
+};
+
+struct resampler {
+    // Ratio in_rate / out_rate reduced to M / L
+    uint32_t L;
+    uint32_t M;
+    unsigned channels;
+    unsigned taps;
+    // L phases of taps coefficients, in the order of the input samples
+    float *coefs;
+    // Per channel: taps - 1 samples of history followed by new input
+    float *history;
+    size_t stride;
+    size_t filled;
+    // Newest input sample of the next output frame and its phase
+    size_t pos;
+    uint32_t phase;
+    uint32_t delay;
+};
+
+enum resampler_quality resampler_quality_from_string(const char *name)
+{
+    for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+        if (strcmp(name, presets[i].name) == 0)
+            return (enum resampler_quality) i;
+    }
+    return RESAMPLER_QUALITY_OFF;
+}
+
+const char * resampler_quality_to_string(enum resampler_quality quality)
+{
+    if (quality < 0 || (size_t) quality >= sizeof(presets) / sizeof(presets[0]))
+        return "off";
+    return presets[quality].name;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/**
+ * Zeroth order modified Bessel function of the first kind, for the Kaiser
+ * window.
+ */
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/**
+ * Designs the prototype low pass at L times the input rate and splits it into
+ * the phases. Every phase is normalized to unity gain at DC.
+ */
+static void design_filter(struct resampler *rs, uint32_t in_rate, uint32_t out_rate,
+                          const struct resampler_preset *preset)
+{
+    size_t length = (size_t) rs->taps * rs->L;
+    double center = (length - 1) / 2.0;
+    // Cycles per sample of the upsampled signal
+    double fc = preset->cutoff * 0.5 * (in_rate < out_rate ? in_rate : out_rate) /
+        ((double) in_rate * rs->L);
+    double i0_beta = bessel_i0(preset->beta);
+
+    for (uint32_t p = 0; p < rs->L; p++) {
+        float *phase = rs->coefs + (size_t) p * rs->taps;
+        double sum = 0;
+
+        for (unsigned j = 0; j < rs->taps; j++) {
+            double k = p + (double) j * rs->L;
+            double x = 2 * fc * (k - center);
+            double r = (k - center) / center;
+            double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+            double window = bessel_i0(preset->beta * sqrt(r * r < 1 ? 1 - r * r : 0)) / i0_beta;
+            // Tap j weights input sample i - j, the coefficients are stored
+            // oldest sample first
+            phase[rs->taps - 1 - j] = sinc * window;
+            sum += sinc * window;
+        }
+        for (unsigned j = 0; j < rs->taps && sum != 0; j++)
+            phase[j] /= sum;
+    }
+    rs->delay = (uint32_t) (center / rs->M + 0.5);
+}
+
+struct resampler * resampler_create(uint32_t in_rate, uint32_t out_rate, unsigned channels,
+                                    enum resampler_quality quality)
+{
+    struct resampler *rs;
+    uint32_t g, factor;
+
+    if (!in_rate || !out_rate || !channels || channels > RESAMPLER_MAX_CHANNELS ||
+            quality < 0 || (size_t) quality >= sizeof(presets) / sizeof(presets[0]))
+        return NULL;
+
+    g = gcd(in_rate, out_rate);
+    if (out_rate / g > RESAMPLER_MAX_PHASES)
+        return NULL;
+
+    rs = (struct resampler *) calloc(1, sizeof(*rs));
+    if (!rs)
+        return NULL;
+
+    rs->L = out_rate / g;
+    rs->M = in_rate / g;
+    rs->channels = channels;
+    // Downsampling narrows the filter, it needs proportionally more taps.
+    // This also keeps the input advance per output frame below taps.
+    factor = (rs->M + rs->L - 1) / rs->L;
+    rs->taps = presets[quality].taps * (factor > 1 ? factor : 1);
+    rs->stride = rs->taps - 1 + RESAMPLER_CHUNK;
+    rs->coefs = (float *) malloc((size_t) rs->L * rs->taps * sizeof(float));
+    rs->history = (float *) malloc(rs->stride * channels * sizeof(float));
+    if (!rs->coefs || !rs->history) {
+        resampler_free(rs);
+        return NULL;
+    }
+
+    design_filter(rs, in_rate, out_rate, &presets[quality]);
+    resampler_reset(rs);
+    return rs;
+}
+
+void resampler_free(struct resampler *rs)
+{
+    if (!rs)
+        return;
+    free(rs->coefs);
+    free(rs->history);
+    free(rs);
+}
+
+void resampler_reset(struct resampler *rs)
+{
+    memset(rs->history, 0, rs->stride * rs->channels * sizeof(float));
+    rs->filled = rs->taps - 1;
+    rs->pos = rs->taps - 1;
+    rs->phase = 0;
+}
+
+size_t resampler_max_output(const struct resampler *rs, size_t in_frames)
+{
+    return ((uint64_t) in_frames * rs->L + rs->M - 1) / rs->M + 1;
+}
+
+uint32_t resampler_delay(const struct resampler *rs)
+{
+    return rs->delay;
+}
+
+unsigned resampler_taps(const struct resampler *rs)
+{
+    return rs->taps;
+}
+
+/**
+ * taps must be a multiple of 8.
+ */
+static inline float dot_product(const float *coefs, const float *samples, unsigned taps)
+{
+#if defined(__ARM_NEON__)
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+
+    for (unsigned i = 0; i < taps; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(coefs + i), vld1q_f32(samples + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(coefs + i + 4), vld1q_f32(samples + i + 4));
+    }
+    acc0 = vaddq_f32(acc0, acc1);
+    float32x2_t sum = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#elif defined(__SSE__)
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+
+    for (unsigned i = 0; i < taps; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(coefs + i), _mm_loadu_ps(samples + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(coefs + i + 4),
+                                           _mm_loadu_ps(samples + i + 4)));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+#else
+    float sum = 0;
+
+    for (unsigned i = 0; i < taps; i++)
+        sum += coefs[i] * samples[i];
+    return sum;
+#endif
+}
+
+static inline int16_t to_int16(float sample)
+{
+    long value = lrintf(sample);
+
+    if (value > 32767)
+        return 32767;
+    if (value < -32768)
+        return -32768;
+    return value;
+}
+
+size_t resampler_process(struct resampler *rs, const int16_t *in, size_t in_frames,
+                         int16_t *out)
+{
+    const unsigned channels = rs->channels;
+    size_t frames = 0;
+
+    while (in_frames) {
+        size_t chunk = in_frames < RESAMPLER_CHUNK ? in_frames : RESAMPLER_CHUNK;
+        size_t drop;
+
+        for (unsigned c = 0; c < channels; c++) {
+            float *dst = rs->history + c * rs->stride + rs->filled;
+            for (size_t i = 0; i < chunk; i++)
+                dst[i] = in[i * channels + c];
+        }
+        rs->filled += chunk;
+        in += chunk * channels;
+        in_frames -= chunk;
+
+        while (rs->pos < rs->filled) {
+            const float *coefs = rs->coefs + (size_t) rs->phase * rs->taps;
+            const float *samples = rs->history + rs->pos - (rs->taps - 1);
+
+            for (unsigned c = 0; c < channels; c++)
+                *out++ = to_int16(dot_product(coefs, samples + c * rs->stride, rs->taps));
+            frames++;
+
+            rs->phase += rs->M;
+            rs->pos += rs->phase / rs->L;
+            rs->phase %= rs->L;
+        }
+
+        // Keep the history of the next output frame. When downsampling pos
+        // may already be past the input, those samples are skipped later.
+        drop = rs->pos - (rs->taps - 1);
+        for (unsigned c = 0; c < channels; c++)
+            memmove(rs->history + c * rs->stride, rs->history + c * rs->stride + drop,
+                    (rs->filled - drop) * sizeof(float));
+        rs->filled -= drop;
+        rs->pos -= drop;
+    }
+
+    return frames;
+}
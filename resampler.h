@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_WRAPPER_RESAMPLER_H
+#define AUDIO_WRAPPER_RESAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Polyphase sample rate converter for interleaved 16 bit PCM. The ratio is
+ * reduced to L/M and a Kaiser windowed sinc is split into L phases of a
+ * fixed number of taps, so every output frame is one dot product per
+ * channel. The dot product has a NEON (ARM), SSE (x86 host builds) and a
+ * plain C version.
+ */
+struct resampler;
+
+/**
+ * Presets trading CPU for pass band width and stop band attenuation. The tap
+ * counts are per phase when upsampling, downsampling by a factor of n uses n
+ * times as many.
+ */
+enum resampler_quality {
+    RESAMPLER_QUALITY_OFF = -1,
+    // 16 taps, cutoff at 80% of the lower Nyquist frequency
+    RESAMPLER_QUALITY_LOW,
+    // 32 taps, 88%
+    RESAMPLER_QUALITY_MEDIUM,
+    // 64 taps, 94%
+    RESAMPLER_QUALITY_HIGH,
+};
+
+/**
+ * Parses "off", "low", "medium" or "high". Returns RESAMPLER_QUALITY_OFF for
+ * anything else.
+ */
+enum resampler_quality resampler_quality_from_string(const char *name);
+
+const char * resampler_quality_to_string(enum resampler_quality quality);
+
+/**
+ * Returns NULL if the ratio needs more than 1024 phases, for more than 8
+ * channels or if out of memory.
+ */
+struct resampler * resampler_create(uint32_t in_rate, uint32_t out_rate, unsigned channels,
+                                    enum resampler_quality quality);
+
+void resampler_free(struct resampler *rs);
+
+/**
+ * Drops the filter history, e.g. after standby.
+ */
+void resampler_reset(struct resampler *rs);
+
+/**
+ * Upper bound of the frames resampler_process() returns for in_frames.
+ */
+size_t resampler_max_output(const struct resampler *rs, size_t in_frames);
+
+/**
+ * Resamples all of in and writes the output frames that became available to
+ * out, which must hold resampler_max_output() frames. Returns the number of
+ * frames written.
+ */
+size_t resampler_process(struct resampler *rs, const int16_t *in, size_t in_frames,
+                         int16_t *out);
+
+/**
+ * Group delay of the filter in output frames.
+ */
+uint32_t resampler_delay(const struct resampler *rs);
+
+unsigned resampler_taps(const struct resampler *rs);
+
+#endif // AUDIO_WRAPPER_RESAMPLER_H
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+int ring_init(struct byte_ring *ring, size_t size)
+{
+    uint32_t storage = 1;
+
+    if (!size || size > 0x80000000U)
+        return -EINVAL;
+    while (storage < size)
+        storage <<= 1;
+
+    ring->data = (char *) malloc(storage);
+    if (!ring->data)
+        return -ENOMEM;
+    ring->mask = storage - 1;
+    ring->capacity = size;
+    ring->read_pos = 0;
+    ring->write_pos = 0;
+    return 0;
+}
+
+void ring_free(struct byte_ring *ring)
+{
+    free(ring->data);
+    ring->data = NULL;
+    ring->mask = 0;
+    ring->capacity = 0;
+}
+
+size_t ring_write(struct byte_ring *ring, const void *src, size_t bytes)
+{
+    uint32_t pos = __atomic_load_n(&ring->write_pos, __ATOMIC_RELAXED);
+    uint32_t offset = pos & ring->mask;
+    size_t first;
+
+    if (bytes > ring_writable(ring))
+        bytes = ring_writable(ring);
+
+    first = ring->mask + 1 - offset < bytes ? ring->mask + 1 - offset : bytes;
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, (const char *) src + first, bytes - first);
+
+    // Publish the data before the position
+    __atomic_store_n(&ring->write_pos, pos + (uint32_t) bytes, __ATOMIC_RELEASE);
+    return bytes;
+}
+
+size_t ring_read(struct byte_ring *ring, void *dst, size_t bytes)
+{
+    uint32_t pos = __atomic_load_n(&ring->read_pos, __ATOMIC_RELAXED);
+    uint32_t offset = pos & ring->mask;
+    size_t first;
+
+    if (bytes > ring_readable(ring))
+        bytes = ring_readable(ring);
+
+    first = ring->mask + 1 - offset < bytes ? ring->mask + 1 - offset : bytes;
+    memcpy(dst, ring->data + offset, first);
+    memcpy((char *) dst + first, ring->data, bytes - first);
+
+    // The producer may reuse the space once it sees the new position
+    __atomic_store_n(&ring->read_pos, pos + (uint32_t) bytes, __ATOMIC_RELEASE);
+    return bytes;
+}
+
+size_t ring_skip(struct byte_ring *ring, size_t bytes)
+{
+    uint32_t pos = __atomic_load_n(&ring->read_pos, __ATOMIC_RELAXED);
+
+    if (bytes > ring_readable(ring))
+        bytes = ring_readable(ring);
+    __atomic_store_n(&ring->read_pos, pos + (uint32_t) bytes, __ATOMIC_RELEASE);
+    return bytes;
+}
+
+void ring_discard(struct byte_ring *ring)
+{
+    __atomic_store_n(&ring->read_pos, __atomic_load_n(&ring->write_pos, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+}
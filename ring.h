@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_WRAPPER_RING_H
+#define AUDIO_WRAPPER_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Lock-free byte ring with one producer and one consumer thread. The storage
+ * is a power of 2 and the positions are free running 32 bit counters, so
+ * write_pos - read_pos is the fill level even after they wrapped. capacity
+ * limits the fill level to the size that was asked for.
+ */
+struct byte_ring {
+    char *data;
+    uint32_t mask;
+    uint32_t capacity;
+    // Written by the consumer
+    uint32_t read_pos;
+    // Written by the producer
+    uint32_t write_pos;
+};
+
+/**
+ * Allocates a ring that holds size bytes. Returns 0, -EINVAL or -ENOMEM.
+ */
+int ring_init(struct byte_ring *ring, size_t size);
+
+void ring_free(struct byte_ring *ring);
+
+/**
+ * Bytes the consumer can read.
+ */
+static inline uint32_t ring_readable(const struct byte_ring *ring)
+{
+    return __atomic_load_n(&ring->write_pos, __ATOMIC_ACQUIRE) -
+        __atomic_load_n(&ring->read_pos, __ATOMIC_RELAXED);
+}
+
+/**
+ * Bytes the producer can write.
+ */
+static inline uint32_t ring_writable(const struct byte_ring *ring)
+{
+    return ring->capacity - (__atomic_load_n(&ring->write_pos, __ATOMIC_RELAXED) -
+                            __atomic_load_n(&ring->read_pos, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * Copies up to bytes from src into the ring. Producer only. Returns the
+ * number of bytes copied.
+ */
+size_t ring_write(struct byte_ring *ring, const void *src, size_t bytes);
+
+/**
+ * Copies up to bytes from the ring to dst. Consumer only. Returns the number
+ * of bytes copied.
+ */
+size_t ring_read(struct byte_ring *ring, void *dst, size_t bytes);
+
+/**
+ * Drops up to bytes of the oldest data. Consumer only. Returns the number of
+ * bytes dropped.
+ */
+size_t ring_skip(struct byte_ring *ring, size_t bytes);
+
+/**
+ * Drops everything that was written so far. Consumer only.
+ */
+void ring_discard(struct byte_ring *ring);
+
+#endif // AUDIO_WRAPPER_RING_H
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scratch.h"
+
+// Keeps the returned pointers aligned for any type
+#define SCRATCH_ALIGN 8
+
+struct scratch_spill {
+    struct scratch_spill *next;
+    uint64_t data[];
+};
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_key_once = PTHREAD_ONCE_INIT;
+
+static void scratch_arena_free(void *arg)
+{
+    struct scratch_arena *arena = (struct scratch_arena *) arg;
+    struct scratch_mark empty = { 0, NULL };
+
+    scratch_restore(arena, empty);
+    free(arena);
+}
+
+static void scratch_key_create()
+{
+    pthread_key_create(&scratch_key, scratch_arena_free);
+}
+
+struct scratch_arena *scratch_arena_get()
+{
+    struct scratch_arena *arena;
+
+    pthread_once(&scratch_key_once, scratch_key_create);
+    arena = (struct scratch_arena *) pthread_getspecific(scratch_key);
+    if (!arena) {
+        arena = (struct scratch_arena *) malloc(sizeof(*arena));
+        if (!arena)
+            return NULL;
+        arena->used = 0;
+        arena->spills = NULL;
+        pthread_setspecific(scratch_key, arena);
+    }
+    return arena;
+}
+
+void *scratch_alloc(size_t size)
+{
+    struct scratch_arena *arena = scratch_arena_get();
+    struct scratch_spill *spill;
+    size_t aligned = (size + SCRATCH_ALIGN - 1) & ~(size_t) (SCRATCH_ALIGN - 1);
+    void *ptr;
+
+    if (!arena)
+        return NULL;
+
+    if (aligned >= size && aligned <= SCRATCH_ARENA_SIZE - arena->used) {
+        ptr = arena->data + arena->used;
+        arena->used += aligned;
+        return ptr;
+    }
+
+    spill = (struct scratch_spill *) malloc(sizeof(*spill) + size);
+    if (!spill)
+        return NULL;
+    spill->next = arena->spills;
+    arena->spills = spill;
+    return spill->data;
+}
+
+char *scratch_strndup(const char *str, size_t len)
+{
+    char *copy = (char *) scratch_alloc(len + 1);
+
+    if (copy) {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+struct scratch_mark scratch_save(struct scratch_arena *arena)
+{
+    struct scratch_mark mark = { arena->used, arena->spills };
+    return mark;
+}
+
+void scratch_restore(struct scratch_arena *arena, struct scratch_mark mark)
+{
+    while (arena->spills != mark.spills) {
+        struct scratch_spill *spill = arena->spills;
+        arena->spills = spill->next;
+        free(spill);
+    }
+    arena->used = mark.used;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_WRAPPER_SCRATCH_H
+#define AUDIO_WRAPPER_SCRATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Size of the per-thread block. Larger than any parameter string AudioFlinger
+ * or the policy manager send, so spilling to the heap is the exception.
+ */
+#define SCRATCH_ARENA_SIZE 4096
+
+/**
+ * Per-thread bump allocator for the strings a parameter call builds while it
+ * converts its arguments. Memory is never freed individually, a ScratchScope
+ * at the top of the call gives back everything allocated during its lifetime.
+ * The block is allocated on the first use in a thread and freed when the
+ * thread exits (bionic has no __thread, so it hangs off a pthread key).
+ * Requests that don't fit are malloc'ed and freed with the scope.
+ */
+struct scratch_spill;
+
+struct scratch_arena {
+    size_t used;
+    // Allocations that didn't fit into data, newest first
+    struct scratch_spill *spills;
+    char data[SCRATCH_ARENA_SIZE];
+};
+
+struct scratch_mark {
+    size_t used;
+    struct scratch_spill *spills;
+};
+
+/**
+ * Returns the calling thread's arena, NULL if it can't be allocated.
+ */
+struct scratch_arena *scratch_arena_get();
+
+/**
+ * Returns size bytes that stay valid until the enclosing ScratchScope ends,
+ * NULL if out of memory.
+ */
+void *scratch_alloc(size_t size);
+
+/**
+ * Copies len bytes of str plus a terminating null byte into the arena.
+ */
+char *scratch_strndup(const char *str, size_t len);
+
+struct scratch_mark scratch_save(struct scratch_arena *arena);
+
+void scratch_restore(struct scratch_arena *arena, struct scratch_mark mark);
+
+/**
+ * Gives back the scratch memory allocated during its lifetime.
+ */
+class ScratchScope {
+public:
+    ScratchScope() : mArena(scratch_arena_get()) {
+        if (mArena)
+            mMark = scratch_save(mArena);
+    }
+    ~ScratchScope() {
+        if (mArena)
+            scratch_restore(mArena, mMark);
+    }
+
+private:
+    struct scratch_arena *mArena;
+    struct scratch_mark mMark;
+};
+
+#define SCRATCH_SCOPE() ScratchScope __scratch_scope
+
+#endif // AUDIO_WRAPPER_SCRATCH_H
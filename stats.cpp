@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+void dump_printf(int fd, const char *fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (len >= (int) sizeof(buf))
+        len = sizeof(buf) - 1;
+    if (len > 0)
+        write(fd, buf, len);
+}
+
+static uint32_t bucket_low(int bucket)
+{
+    return bucket ? 1U << (bucket - 1) : 0;
+}
+
+static uint32_t bucket_high(int bucket)
+{
+    return bucket ? (uint32_t) ((2ULL << (bucket - 1)) - 1) : 0;
+}
+
+/**
+ * Upper bound of the bucket that contains the given fraction of all values.
+ */
+static uint32_t histogram_percentile(const uint32_t *buckets, uint32_t count,
+                                     unsigned permille)
+{
+    uint64_t target = ((uint64_t) count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= target)
+            return bucket_high(i);
+    }
+    return bucket_high(STATS_HISTOGRAM_BUCKETS - 1);
+}
+
+void stats_histogram_dump(const struct stats_histogram *h, int fd, const char *name)
+{
+    uint32_t buckets[STATS_HISTOGRAM_BUCKETS];
+    uint32_t count = 0, p50, p99;
+    uint32_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    uint64_t sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+
+    // Take a snapshot, the count is derived from the buckets so that the
+    // percentiles stay consistent if a value is added meanwhile.
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        buckets[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+        count += buckets[i];
+    }
+
+    if (!count) {
+        dump_printf(fd, "    %s: no samples\n", name);
+        return;
+    }
+
+    p50 = histogram_percentile(buckets, count, 500);
+    p99 = histogram_percentile(buckets, count, 990);
+    dump_printf(fd, "    %s: count %u, mean %llu, p50 <= %u, p99 <= %u, max %u\n",
+                name, count, (unsigned long long) (sum / count),
+                p50 < max ? p50 : max, p99 < max ? p99 : max, max);
+
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        if (!buckets[i])
+            continue;
+        dump_printf(fd, "      [%10u, %10u]: %10u %5.1f%%\n", bucket_low(i),
+                    bucket_high(i), buckets[i], buckets[i] * 100.0 / count);
+    }
+}
+
+void stream_stats_dump(const struct stream_stats *stats, int fd, const char *name)
+{
+    char label[32];
+
+    snprintf(label, sizeof(label), "%s duration (us)", name);
+    stats_histogram_dump(&stats->duration_us, fd, label);
+    snprintf(label, sizeof(label), "%s interval (us)", name);
+    stats_histogram_dump(&stats->interval_us, fd, label);
+    snprintf(label, sizeof(label), "%s size (bytes)", name);
+    stats_histogram_dump(&stats->bytes, fd, label);
+}
+
+void glitch_stats_format(const struct glitch_stats *g, char *buf, size_t size)
+{
+    snprintf(buf, size, "writes:%u,underruns:%u,stalls:%u,bursts:%u,max_gap_us:%u,"
+             "max_stall_us:%u", __atomic_load_n(&g->writes, __ATOMIC_RELAXED),
+             __atomic_load_n(&g->underruns, __ATOMIC_RELAXED),
+             __atomic_load_n(&g->stalls, __ATOMIC_RELAXED),
+             __atomic_load_n(&g->bursts, __ATOMIC_RELAXED),
+             __atomic_load_n(&g->max_gap_us, __ATOMIC_RELAXED),
+             __atomic_load_n(&g->max_stall_us, __ATOMIC_RELAXED));
+}
+
+void glitch_stats_dump(const struct glitch_stats *g, int fd)
+{
+    dump_printf(fd, "    glitches: %u writes, %u underrun suspects (max gap %u us), "
+                "%u blob stalls (max %u us), %u bursts\n",
+                __atomic_load_n(&g->writes, __ATOMIC_RELAXED),
+                __atomic_load_n(&g->underruns, __ATOMIC_RELAXED),
+                __atomic_load_n(&g->max_gap_us, __ATOMIC_RELAXED),
+                __atomic_load_n(&g->stalls, __ATOMIC_RELAXED),
+                __atomic_load_n(&g->max_stall_us, __ATOMIC_RELAXED),
+                __atomic_load_n(&g->bursts, __ATOMIC_RELAXED));
+}
+
+void standby_stats_dump(const struct standby_stats *s, int fd)
+{
+    dump_printf(fd, "    standby: %u calls, %u redundant, %u forwarded to the blob\n",
+                __atomic_load_n(&s->requests, __ATOMIC_RELAXED),
+                __atomic_load_n(&s->dropped, __ATOMIC_RELAXED),
+                __atomic_load_n(&s->entered, __ATOMIC_RELAXED));
+    stats_histogram_dump(&s->cold_resume_us, fd, "resume from standby (us)");
+    stats_histogram_dump(&s->warm_resume_us, fd, "resume while warm (us)");
+}
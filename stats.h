@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_WRAPPER_STATS_H
+#define AUDIO_WRAPPER_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Bucket 0 counts zeros, bucket i > 0 counts values in [2^(i-1), 2^i).
+ */
+#define STATS_HISTOGRAM_BUCKETS 33
+
+/**
+ * Log2 bucketed histogram. Updated with relaxed atomics so dump() can read it
+ * while the audio thread keeps adding values. Each histogram has one writer.
+ */
+struct stats_histogram {
+    uint32_t buckets[STATS_HISTOGRAM_BUCKETS];
+    uint32_t max;
+    uint64_t sum;
+};
+
+#define STATS_ADD(var, value) \
+    __atomic_store_n(&(var), __atomic_load_n(&(var), __ATOMIC_RELAXED) + (value), \
+                     __ATOMIC_RELAXED)
+
+static inline void stats_histogram_add(struct stats_histogram *h, uint32_t value)
+{
+    int bucket = value ? 32 - __builtin_clz(value) : 0;
+
+    // There is only one writer per histogram, plain relaxed loads and stores
+    // are enough and avoid locked read-modify-write instructions.
+    STATS_ADD(h->buckets[bucket], 1);
+    STATS_ADD(h->sum, value);
+    if (value > __atomic_load_n(&h->max, __ATOMIC_RELAXED))
+        __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t stats_clamp(int64_t value)
+{
+    return value > 0xffffffffLL ? 0xffffffffU : value < 0 ? 0 : (uint32_t) value;
+}
+
+/**
+ * Duration, interval and size of the read or write calls of a stream.
+ */
+struct stream_stats {
+    struct stats_histogram duration_us;
+    struct stats_histogram interval_us;
+    struct stats_histogram bytes;
+    int64_t last_start_ns;
+};
+
+/**
+ * Accounts a call that started at start_ns and ended at end_ns. Must only be
+ * called from one thread at a time.
+ */
+static inline void stream_stats_add(struct stream_stats *stats, int64_t start_ns,
+                                    int64_t end_ns, ssize_t bytes)
+{
+    stats_histogram_add(&stats->duration_us, stats_clamp((end_ns - start_ns) / 1000));
+    if (stats->last_start_ns)
+        stats_histogram_add(&stats->interval_us,
+                            stats_clamp((start_ns - stats->last_start_ns) / 1000));
+    stats_histogram_add(&stats->bytes, bytes > 0 ? (uint32_t) bytes : 0);
+    stats->last_start_ns = start_ns;
+}
+
+/**
+ * Classifies the writes of an output against its period, the duration of one
+ * buffer. A write that blocks for more than GLITCH_LATE periods is a blob
+ * stall. A write that starts more than GLITCH_LATE periods after the previous
+ * one, with more than half a period spent outside of out_write(), is an
+ * underrun suspect: the mixer was late. Once a write blocked for half a
+ * period, one that starts less than GLITCH_BURST periods after the previous
+ * one is a burst, the blob took data faster than it plays it. Each stats has
+ * one writer like the histograms.
+ */
+#define GLITCH_LATE(period) ((period) * 3 / 2)
+#define GLITCH_BURST(period) ((period) / 4)
+
+struct glitch_stats {
+    uint32_t writes;
+    uint32_t underruns;
+    uint32_t stalls;
+    uint32_t bursts;
+    // Longest time outside of out_write() and longest blob stall
+    uint32_t max_gap_us;
+    uint32_t max_stall_us;
+    int64_t last_start_ns;
+    int64_t last_end_ns;
+    bool steady;
+};
+
+static inline void glitch_stats_add(struct glitch_stats *g, int64_t start_ns, int64_t end_ns,
+                                    int64_t period_ns)
+{
+    int64_t duration_ns = end_ns - start_ns;
+
+    STATS_ADD(g->writes, 1);
+    if (period_ns <= 0)
+        return;
+
+    if (duration_ns > GLITCH_LATE(period_ns)) {
+        STATS_ADD(g->stalls, 1);
+        if (duration_ns / 1000 > __atomic_load_n(&g->max_stall_us, __ATOMIC_RELAXED))
+            __atomic_store_n(&g->max_stall_us, stats_clamp(duration_ns / 1000), __ATOMIC_RELAXED);
+    }
+    if (g->last_start_ns) {
+        int64_t interval_ns = start_ns - g->last_start_ns;
+        int64_t gap_ns = start_ns - g->last_end_ns;
+
+        if (interval_ns > GLITCH_LATE(period_ns) && gap_ns > period_ns / 2)
+            STATS_ADD(g->underruns, 1);
+        else if (g->steady && interval_ns < GLITCH_BURST(period_ns))
+            STATS_ADD(g->bursts, 1);
+        if (gap_ns / 1000 > __atomic_load_n(&g->max_gap_us, __ATOMIC_RELAXED))
+            __atomic_store_n(&g->max_gap_us, stats_clamp(gap_ns / 1000), __ATOMIC_RELAXED);
+    }
+    if (duration_ns > period_ns / 2)
+        g->steady = true;
+    g->last_start_ns = start_ns;
+    g->last_end_ns = end_ns;
+}
+
+/**
+ * Starts over after standby, the first writes fill the blob's buffer. Called
+ * by the writer.
+ */
+static inline void glitch_stats_restart(struct glitch_stats *g)
+{
+    g->last_start_ns = 0;
+    g->steady = false;
+}
+
+/**
+ * Formats the counters as "writes:<n>,underruns:<n>,stalls:<n>,bursts:<n>,
+ * max_gap_us:<n>,max_stall_us:<n>", a value for get_parameters().
+ */
+void glitch_stats_format(const struct glitch_stats *g, char *buf, size_t size);
+
+void glitch_stats_dump(const struct glitch_stats *g, int fd);
+
+/**
+ * Standby calls of a stream and the duration of the first read or write after
+ * standby. A cold resume found the blob in standby, a warm one found it still
+ * running because its standby was delayed or the call was redundant.
+ */
+struct standby_stats {
+    uint32_t requests;
+    // Redundant calls that were not forwarded and blob standby calls
+    uint32_t dropped;
+    uint32_t entered;
+    struct stats_histogram cold_resume_us;
+    struct stats_histogram warm_resume_us;
+};
+
+void standby_stats_dump(const struct standby_stats *s, int fd);
+
+void stats_histogram_dump(const struct stats_histogram *h, int fd, const char *name);
+
+/**
+ * Prints the histograms of stats, name is "write" or "read".
+ */
+void stream_stats_dump(const struct stream_stats *stats, int fd, const char *name);
+
+/**
+ * snprintf() to fd, for the dump() functions.
+ */
+void dump_printf(int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif // AUDIO_WRAPPER_STATS_H
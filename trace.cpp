@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioWrapperTrace"
+// #define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "stats.h"
+#include "trace.h"
+
+#define TRACE_PROPERTY "persist.audiowrap.trace"
+#define TRACE_FILE_PROPERTY "persist.audiowrap.trace.file"
+#define TRACE_MAX_EVENTS (1 << 20)
+
+struct trace_header *trace_buffer = NULL;
+
+static pthread_mutex_t trace_init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char * const trace_event_names[TRACE_EVENT_CNT] = {
+    "none",
+#define TRACE_EVENT_NAME(prefix, func) #prefix "_" #func,
+    WRAPPER_TRACE_EVENTS(TRACE_EVENT_NAME)
+#undef TRACE_EVENT_NAME
+};
+
+static inline struct trace_event *trace_events(const struct trace_header *hdr)
+{
+    return (struct trace_event *) (hdr + 1);
+}
+
+static size_t trace_size(uint32_t capacity)
+{
+    return sizeof(struct trace_header) + capacity * sizeof(struct trace_event);
+}
+
+static bool trace_header_valid(const struct trace_header *hdr, size_t size)
+{
+    return size >= sizeof(*hdr) &&
+        hdr->magic == TRACE_MAGIC &&
+        hdr->version == TRACE_VERSION &&
+        hdr->event_size == sizeof(struct trace_event) &&
+        hdr->capacity && (hdr->capacity & (hdr->capacity - 1)) == 0 &&
+        size >= trace_size(hdr->capacity);
+}
+
+/**
+ * Maps the ring from path, or from anonymous memory if path is empty. An
+ * existing ring of this process is reused so that the hw and policy wrappers
+ * can share one file.
+ */
+static struct trace_header *trace_map(const char *path, uint32_t capacity)
+{
+    struct trace_header *hdr;
+    size_t size = trace_size(capacity);
+    int fd = -1;
+
+    if (path[0]) {
+        fd = open(path, O_RDWR | O_CREAT, 0640);
+        if (fd < 0) {
+            ALOGE("Failed to open trace file %s: %s", path, strerror(errno));
+            return NULL;
+        }
+        if (ftruncate(fd, size) < 0) {
+            ALOGE("Failed to resize trace file %s: %s", path, strerror(errno));
+            close(fd);
+            return NULL;
+        }
+        hdr = (struct trace_header *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED, fd, 0);
+        close(fd);
+    } else {
+        hdr = (struct trace_header *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    }
+
+    if (hdr == MAP_FAILED) {
+        ALOGE("Failed to map trace buffer: %s", strerror(errno));
+        return NULL;
+    }
+
+    if (trace_header_valid(hdr, size) && hdr->capacity == capacity &&
+        hdr->pid == getpid()) {
+        ALOGI("Attached to trace buffer %s", path);
+        return hdr;
+    }
+
+    memset(hdr, 0, size);
+    hdr->version = TRACE_VERSION;
+    hdr->event_size = sizeof(struct trace_event);
+    hdr->capacity = capacity;
+    hdr->pid = getpid();
+    __atomic_store_n(&hdr->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+
+    ALOGI("Tracing %u events to %s", capacity, path[0] ? path : "memory");
+    return hdr;
+}
+
+void trace_init()
+{
+    char value[PROPERTY_VALUE_MAX];
+    char path[PROPERTY_VALUE_MAX];
+    long events;
+    uint32_t capacity = 1;
+
+    pthread_mutex_lock(&trace_init_lock);
+
+    if (trace_buffer)
+        goto out;
+
+    property_get(TRACE_PROPERTY, value, "0");
+    events = strtol(value, NULL, 0);
+    if (events <= 0)
+        goto out;
+    if (events > TRACE_MAX_EVENTS)
+        events = TRACE_MAX_EVENTS;
+    while (capacity < (uint32_t) events)
+        capacity <<= 1;
+
+    property_get(TRACE_FILE_PROPERTY, path, "");
+    __atomic_store_n(&trace_buffer, trace_map(path, capacity), __ATOMIC_RELEASE);
+
+out:
+    pthread_mutex_unlock(&trace_init_lock);
+}
+
+int64_t trace_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void trace_record(enum trace_event_id id, uintptr_t handle, int64_t start_ns,
+                  int32_t ret)
+{
+    struct trace_header *hdr = __atomic_load_n(&trace_buffer, __ATOMIC_ACQUIRE);
+    struct trace_event *ev;
+    int64_t duration;
+    uint32_t seq;
+
+    if (!hdr)
+        return;
+
+    duration = trace_now_ns() - start_ns;
+    if (duration > 0xffffffffLL)
+        duration = 0xffffffffLL;
+
+    seq = __atomic_fetch_add(&hdr->head, 1, __ATOMIC_RELAXED);
+    ev = trace_events(hdr) + (seq & (hdr->capacity - 1));
+
+    // Mark the slot as being written before touching the payload
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    ev->id = id;
+    ev->handle = handle;
+    ev->timestamp_ns = start_ns;
+    ev->duration_ns = (uint32_t) duration;
+    ev->ret = ret;
+
+    __atomic_store_n(&ev->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+int trace_decode(const void *data, size_t size, int fd)
+{
+    const struct trace_header *hdr = (const struct trace_header *) data;
+    const struct trace_event *events;
+    uint32_t head, count, skipped = 0;
+
+    if (!trace_header_valid(hdr, size)) {
+        dump_printf(fd, "Invalid trace buffer\n");
+        return -EINVAL;
+    }
+
+    events = trace_events(hdr);
+    head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    count = head < hdr->capacity ? head : hdr->capacity;
+
+    dump_printf(fd, "Trace of pid %d: %u events, showing last %u\n",
+                 hdr->pid, head, count);
+    dump_printf(fd, "%17s %-36s %18s %12s %11s\n",
+                 "timestamp", "function", "handle", "duration_us", "ret");
+
+    for (uint32_t seq = head - count; seq != head; seq++) {
+        const struct trace_event *slot = &events[seq & (hdr->capacity - 1)];
+        struct trace_event ev;
+
+        // The writer may lap us, drop events that changed while copying
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+            skipped++;
+            continue;
+        }
+        ev = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq + 1) {
+            skipped++;
+            continue;
+        }
+
+        dump_printf(fd, "%10lld.%06lld %-36s 0x%016llx %8u.%03u %11d\n",
+                     (long long) (ev.timestamp_ns / 1000000000LL),
+                     (long long) (ev.timestamp_ns % 1000000000LL / 1000),
+                     ev.id < TRACE_EVENT_CNT ? trace_event_names[ev.id] : "unknown",
+                     (unsigned long long) ev.handle,
+                     ev.duration_ns / 1000, ev.duration_ns % 1000,
+                     ev.ret);
+    }
+
+    if (skipped)
+        dump_printf(fd, "%u events overwritten while decoding\n", skipped);
+
+    return 0;
+}
+
+int trace_dump(int fd)
+{
+    struct trace_header *hdr = __atomic_load_n(&trace_buffer, __ATOMIC_ACQUIRE);
+
+    if (!hdr) {
+        dump_printf(fd, "Tracing disabled, set %s to enable\n", TRACE_PROPERTY);
+        return 0;
+    }
+
+    return trace_decode(hdr, trace_size(hdr->capacity), fd);
+}
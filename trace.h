@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2013 Thomas Wendt <thoemy@gmx.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_WRAPPER_TRACE_H
+#define AUDIO_WRAPPER_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Binary call trace of the wrapped HAL entry points.
+ *
+ * Every traced call writes a fixed size trace_event into a ring buffer in
+ * shared memory. Nothing is formatted on the calling thread. The ring is
+ * decoded by adev_dump/ap_dump or, from a saved copy of the trace file, by the
+ * audio_wrapper_trace_dump host tool.
+ *
+ * Tracing is enabled with persist.audiowrap.trace=<number of events>. If
+ * persist.audiowrap.trace.file is set the ring is mapped from that file,
+ * otherwise from anonymous memory.
+ */
+
+/**
+ * All traced functions. Only append to this list, the ids are stored in trace
+ * files.
+ */
+#define WRAPPER_TRACE_EVENTS(X) \
+    X(adev, open) \
+    X(adev, close) \
+    X(adev, get_supported_devices) \
+    X(adev, init_check) \
+    X(adev, set_voice_volume) \
+    X(adev, set_master_volume) \
+    X(adev, get_master_volume) \
+    X(adev, set_master_mute) \
+    X(adev, get_master_mute) \
+    X(adev, set_mode) \
+    X(adev, set_mic_mute) \
+    X(adev, get_mic_mute) \
+    X(adev, set_parameters) \
+    X(adev, get_parameters) \
+    X(adev, get_input_buffer_size) \
+    X(adev, open_output_stream) \
+    X(adev, close_output_stream) \
+    X(adev, open_input_stream) \
+    X(adev, close_input_stream) \
+    X(adev, dump) \
+    X(out, get_sample_rate) \
+    X(out, set_sample_rate) \
+    X(out, get_buffer_size) \
+    X(out, get_channels) \
+    X(out, get_format) \
+    X(out, set_format) \
+    X(out, standby) \
+    X(out, dump) \
+    X(out, set_parameters) \
+    X(out, get_parameters) \
+    X(out, add_audio_effect) \
+    X(out, remove_audio_effect) \
+    X(out, get_latency) \
+    X(out, set_volume) \
+    X(out, write) \
+    X(out, get_render_position) \
+    X(out, get_next_write_timestamp) \
+    X(in, get_sample_rate) \
+    X(in, set_sample_rate) \
+    X(in, get_buffer_size) \
+    X(in, get_channels) \
+    X(in, get_format) \
+    X(in, set_format) \
+    X(in, standby) \
+    X(in, dump) \
+    X(in, set_parameters) \
+    X(in, get_parameters) \
+    X(in, add_audio_effect) \
+    X(in, remove_audio_effect) \
+    X(in, set_gain) \
+    X(in, read) \
+    X(in, get_input_frames_lost) \
+    X(ap, create) \
+    X(ap, destroy) \
+    X(ap, set_device_connection_state) \
+    X(ap, get_device_connection_state) \
+    X(ap, set_phone_state) \
+    X(ap, set_ringer_mode) \
+    X(ap, set_force_use) \
+    X(ap, get_force_use) \
+    X(ap, set_can_mute_enforced_audible) \
+    X(ap, init_check) \
+    X(ap, get_output) \
+    X(ap, start_output) \
+    X(ap, stop_output) \
+    X(ap, release_output) \
+    X(ap, get_input) \
+    X(ap, start_input) \
+    X(ap, stop_input) \
+    X(ap, release_input) \
+    X(ap, init_stream_volume) \
+    X(ap, set_stream_volume_index) \
+    X(ap, get_stream_volume_index) \
+    X(ap, set_stream_volume_index_for_device) \
+    X(ap, get_stream_volume_index_for_device) \
+    X(ap, get_strategy_for_stream) \
+    X(ap, get_devices_for_stream) \
+    X(ap, get_output_for_effect) \
+    X(ap, register_effect) \
+    X(ap, unregister_effect) \
+    X(ap, set_effect_enabled) \
+    X(ap, is_stream_active) \
+    X(ap, is_stream_active_remotely) \
+    X(ap, dump) \
+    X(aps, load_hw_module) \
+    X(aps, open_output) \
+    X(aps, open_output_on_module) \
+    X(aps, open_duplicate_output) \
+    X(aps, close_output) \
+    X(aps, suspend_output) \
+    X(aps, restore_output) \
+    X(aps, open_input) \
+    X(aps, open_input_on_module) \
+    X(aps, close_input) \
+    X(aps, set_stream_output) \
+    X(aps, move_effects) \
+    X(aps, get_parameters) \
+    X(aps, set_parameters) \
+    X(aps, set_stream_volume) \
+    X(aps, start_tone) \
+    X(aps, stop_tone) \
+    X(aps, set_voice_volume)
+
+enum trace_event_id {
+    TRACE_NONE = 0,
+#define TRACE_EVENT_ENUM(prefix, func) TRACE_##prefix##_##func,
+    WRAPPER_TRACE_EVENTS(TRACE_EVENT_ENUM)
+#undef TRACE_EVENT_ENUM
+    TRACE_EVENT_CNT,
+};
+
+#define TRACE_MAGIC 0x52545741 // "AWTR"
+#define TRACE_VERSION 1
+
+/**
+ * A slot of the ring. seq is the sequence number of the event plus one and is
+ * written last, 0 marks a slot that is being written.
+ */
+struct trace_event {
+    uint32_t seq;
+    uint16_t id;
+    uint16_t reserved;
+    uint64_t handle;
+    int64_t timestamp_ns;
+    uint32_t duration_ns;
+    int32_t ret;
+};
+
+/**
+ * Start of the mapping, followed by capacity trace_events.
+ */
+struct trace_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t event_size;
+    uint32_t capacity;
+    int32_t pid;
+    uint32_t head;
+    uint32_t reserved[3];
+};
+
+extern struct trace_header *trace_buffer;
+
+/**
+ * Maps the ring if enabled by the properties. Safe to call more than once.
+ */
+void trace_init();
+
+/**
+ * CLOCK_MONOTONIC in nanoseconds.
+ */
+int64_t trace_now_ns();
+
+static inline bool trace_enabled()
+{
+    return __atomic_load_n(&trace_buffer, __ATOMIC_RELAXED) != NULL;
+}
+
+void trace_record(enum trace_event_id id, uintptr_t handle, int64_t start_ns,
+                  int32_t ret);
+
+/**
+ * Writes the events of the live ring in text form to fd.
+ */
+int trace_dump(int fd);
+
+/**
+ * Writes the events of a ring copied to data in text form to fd.
+ */
+int trace_decode(const void *data, size_t size, int fd);
+
+/**
+ * Records one event for the lifetime of the object. The return value is
+ * picked up by passing it through ret().
+ */
+class TraceScope {
+public:
+    TraceScope(enum trace_event_id id, const void *handle)
+        : mId(id), mHandle((uintptr_t) handle), mRet(0),
+          mStart(trace_enabled() ? trace_now_ns() : 0) {}
+    TraceScope(enum trace_event_id id, uintptr_t handle)
+        : mId(id), mHandle(handle), mRet(0),
+          mStart(trace_enabled() ? trace_now_ns() : 0) {}
+    ~TraceScope() {
+        if (mStart)
+            trace_record(mId, mHandle, mStart, mRet);
+    }
+
+    template<typename T> T ret(T value) {
+        mRet = (int32_t) (intptr_t) value;
+        return value;
+    }
+
+private:
+    enum trace_event_id mId;
+    uintptr_t mHandle;
+    int32_t mRet;
+    int64_t mStart;
+};
+
+#define TRACE_SCOPE(id, handle) TraceScope __trace_scope(id, handle)
+#define TRACE_RETURN(value) __trace_scope.ret(value)
+
+#endif // AUDIO_WRAPPER_TRACE_H